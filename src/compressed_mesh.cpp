@@ -0,0 +1,454 @@
+/**
+ * \file compressed_mesh.cpp
+ * \brief Implements methods of class CompressedMesh.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "compressed_mesh.hpp"
+
+
+Object::Object(CompressedMesh &mesh) :
+	raw_object_{new CompressedMesh{std::move(mesh)}},
+	type_{PrimitiveType::kOther}
+{
+}
+
+
+/**
+ * \fn static std::uint16_t EncodeHalf(float value)
+ * \brief Converts a single-precision value to half precision, rounding to
+ *        the nearest even value.
+ */
+static std::uint16_t EncodeHalf(float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	std::uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+	std::uint32_t mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff) {
+		// Infinity or NaN
+		return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+	}
+	if (exponent >= 31) {
+		return sign | 0x7c00;
+	}
+	int shift = 13;
+	std::uint32_t half =
+		exponent > 0 ? static_cast<std::uint32_t>(exponent) << 10 : 0;
+	if (exponent <= 0) {
+		// Subnormal half, whose mantissa includes the implicit bit
+		if (exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+	}
+	half |= mantissa >> shift;
+	// A carry into the exponent gives the next power of two, as expected
+	std::uint32_t rest = mantissa & ((1u << shift) - 1);
+	std::uint32_t halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1))) {
+		half++;
+	}
+	return sign | half;
+}
+
+
+float CompressedMesh::DecodeHalf(std::uint16_t half) {
+	int exponent = (half >> 10) & 0x1f;
+	int mantissa = half & 0x3ff;
+	float value;
+	if (exponent == 0) {
+		value = std::ldexp(static_cast<float>(mantissa), -24);
+	} else if (exponent == 31) {
+		value = mantissa == 0 ? std::numeric_limits<float>::infinity()
+			: std::numeric_limits<float>::quiet_NaN();
+	} else {
+		value = std::ldexp(
+			static_cast<float>(mantissa | 0x400), exponent - 25
+		);
+	}
+	return (half & 0x8000) ? -value : value;
+}
+
+
+/**
+ * \fn static std::uint32_t EncodeNormal(double x, double y, double z)
+ * \brief Outputs the octahedral encoding of a normal: the normal is projected
+ *        on the octahedron |x|+|y|+|z| = 1, whose lower half is folded onto
+ *        the square |x|+|y| <= 1 along the diagonals.
+ */
+static std::uint32_t EncodeNormal(double x, double y, double z) {
+	double norm = std::abs(x) + std::abs(y) + std::abs(z);
+	if (norm == 0) {
+		return 0;
+	}
+	double ox = x / norm;
+	double oy = y / norm;
+	if (z < 0) {
+		double folded_x = (1 - std::abs(oy)) * (ox >= 0 ? 1 : -1);
+		oy = (1 - std::abs(ox)) * (oy >= 0 ? 1 : -1);
+		ox = folded_x;
+	}
+	auto quantize = [](double value) {
+		long q = std::lround(std::max(-1., std::min(1., value)) * 32767);
+		return static_cast<std::uint32_t>(static_cast<std::uint16_t>(
+			static_cast<std::int16_t>(q)));
+	};
+	return quantize(ox) | (quantize(oy) << 16);
+}
+
+
+Vector CompressedMesh::DecodeNormal(std::uint32_t normal) {
+	double ox = static_cast<std::int16_t>(normal & 0xffff) / 32767.;
+	double oy = static_cast<std::int16_t>(normal >> 16) / 32767.;
+	double oz = 1 - std::abs(ox) - std::abs(oy);
+	if (oz < 0) {
+		double unfolded_x = (1 - std::abs(oy)) * (ox >= 0 ? 1 : -1);
+		oy = (1 - std::abs(ox)) * (oy >= 0 ? 1 : -1);
+		ox = unfolded_x;
+	}
+	Vector n{ox, oy, oz};
+	n.Normalize();
+	return n;
+}
+
+
+CompressedMesh::CompressedMesh(
+	const std::string &filename,
+	const std::string &folder,
+	const Material &material,
+	const DecimationOptions &decimation
+) :
+	RawObject{material, false}
+{
+	ObjData data = LoadOBJ(filename, true, true);
+	if (decimation.IsEnabled()) {
+		DecimateOBJ(data, decimation);
+	}
+	surfaces_ = std::make_shared<const ObjSurfaces>(
+		data.materials, folder, material
+	);
+	if (surfaces_->materials.size()
+		> std::numeric_limits<std::uint16_t>::max()) {
+		throw std::runtime_error("CompressedMesh: too many materials");
+	}
+
+	// Quantization grid spanning the positions of the file
+	for (int i=0; i<3; i++) {
+		float low = std::numeric_limits<float>::infinity();
+		float high = -std::numeric_limits<float>::infinity();
+		for (size_t k=i; k<data.positions.size(); k+=3) {
+			low = std::min(low, data.positions[k]);
+			high = std::max(high, data.positions[k]);
+		}
+		origin_[i] = low <= high ? low : 0;
+		step_[i] = low < high ? (static_cast<double>(high) - low) / 65535 : 0;
+	}
+	auto quantize = [this](float value, int i) {
+		if (step_[i] == 0) {
+			return std::uint16_t{0};
+		}
+		long q = std::lround((value - origin_[i]) / step_[i]);
+		return static_cast<std::uint16_t>(std::max(0L, std::min(65535L, q)));
+	};
+
+	// Encodes the corners of the valid triangles in parallel
+	std::vector<PackedVertex> corners(3*data.NbTriangles());
+	std::vector<PackedTriangle> triangles(data.NbTriangles());
+	std::vector<char> is_valid(data.NbTriangles(), false);
+	#pragma omp parallel for schedule(dynamic, 4096)
+	for (size_t j=0; j<data.NbTriangles(); j++) {
+		ObjTriangle triangle;
+		if (!data.ExtractTriangle(j, triangle)) {
+			continue;
+		}
+		is_valid[j] = true;
+		bool has_uv = triangle.material != ObjData::kNone && triangle.has_uv;
+		triangles[j].material = triangle.material == ObjData::kNone ?
+			surfaces_->materials.size()-1 : triangle.material;
+		triangles[j].has_uv = has_uv;
+		for (int k=0; k<3; k++) {
+			PackedVertex &vertex = corners[3*j+k];
+			const float *p = &triangle.positions[3*k];
+			const float *n = &triangle.normals[3*k];
+			for (int i=0; i<3; i++) {
+				vertex.position[i] = quantize(p[i], i);
+			}
+			// Invalid UV coordinates are zeroed, so that they do not prevent
+			// sharing the vertex
+			vertex.uv[0] = has_uv ? EncodeHalf(triangle.uvs[2*k]) : 0;
+			vertex.uv[1] = has_uv ? EncodeHalf(triangle.uvs[2*k+1]) : 0;
+			vertex.normal = EncodeNormal(n[0], n[1], n[2]);
+		}
+	}
+
+	// Removes the invalid triangles
+	size_t nb_triangles = 0;
+	for (size_t j=0; j<triangles.size(); j++) {
+		if (is_valid[j]) {
+			triangles[nb_triangles] = triangles[j];
+			for (int k=0; k<3; k++) {
+				corners[3*nb_triangles+k] = corners[3*j+k];
+			}
+			nb_triangles++;
+		}
+	}
+	triangles.resize(nb_triangles);
+	corners.resize(3*nb_triangles);
+	std::vector<char>().swap(is_valid);
+	if (nb_triangles > std::numeric_limits<unsigned int>::max() / 3) {
+		throw std::runtime_error("CompressedMesh: too many triangles");
+	}
+
+	// Merges identical corners into shared vertices, by sorting their
+	// encodings
+	struct CornerKey {
+		std::uint64_t high;
+		std::uint64_t low;
+		unsigned int corner;
+	};
+	std::vector<CornerKey> keys(corners.size());
+	#pragma omp parallel for
+	for (size_t c=0; c<corners.size(); c++) {
+		const PackedVertex &vertex = corners[c];
+		keys[c].high = static_cast<std::uint64_t>(vertex.position[0])
+			| (static_cast<std::uint64_t>(vertex.position[1]) << 16)
+			| (static_cast<std::uint64_t>(vertex.position[2]) << 32)
+			| (static_cast<std::uint64_t>(vertex.uv[0]) << 48);
+		keys[c].low = static_cast<std::uint64_t>(vertex.uv[1])
+			| (static_cast<std::uint64_t>(vertex.normal) << 16);
+		keys[c].corner = c;
+	}
+	std::sort(keys.begin(), keys.end(),
+		[](const CornerKey &a, const CornerKey &b) {
+			return a.high < b.high || (a.high == b.high && a.low < b.low);
+		}
+	);
+	for (size_t c=0; c<keys.size(); c++) {
+		if (c == 0 || keys[c].high != keys[c-1].high
+			|| keys[c].low != keys[c-1].low) {
+			vertices_.push_back(corners[keys[c].corner]);
+		}
+		triangles[keys[c].corner / 3].vertices[keys[c].corner % 3] =
+			vertices_.size()-1;
+	}
+	vertices_.shrink_to_fit();
+	std::vector<CornerKey>().swap(keys);
+	std::vector<PackedVertex>().swap(corners);
+
+	// Stores the triangles in the order of the leaves of the BVH, bounding
+	// their decoded vertices
+	std::vector<Bounds> bounds(nb_triangles);
+	#pragma omp parallel for
+	for (size_t j=0; j<nb_triangles; j++) {
+		for (int k=0; k<3; k++) {
+			bounds[j].Grow(DecodePosition(vertices_[triangles[j].vertices[k]]));
+		}
+	}
+	std::vector<unsigned int> order = bvh_.Build(bounds, kLeafSize);
+	triangles_.resize(nb_triangles);
+	for (size_t j=0; j<nb_triangles; j++) {
+		triangles_[j] = triangles[order[j]];
+	}
+}
+
+
+size_t CompressedMesh::MemoryUsage() const {
+	return sizeof(CompressedMesh)
+		+ vertices_.capacity() * sizeof(PackedVertex)
+		+ triangles_.capacity() * sizeof(PackedTriangle)
+		+ surfaces_->materials.capacity() * sizeof(Material)
+		+ bvh_.MemoryUsage();
+}
+
+
+bool CompressedMesh::IntersectTriangle(
+	unsigned int i, const Ray &r, double &t, double &u, double &v
+) const {
+	const PackedTriangle &triangle = triangles_[i];
+	Point p1 = DecodePosition(vertices_[triangle.vertices[0]]);
+	Point p2 = DecodePosition(vertices_[triangle.vertices[1]]);
+	Point p3 = DecodePosition(vertices_[triangle.vertices[2]]);
+	const Vector &direction = r.Direction();
+
+	// Same computation as Triangle::Intersect
+	Vector edge1 = p2 - p1;
+	Vector edge2 = p3 - p1;
+	Vector p_vec = direction ^ edge2;
+	double det = (edge1 | p_vec);
+	if (det == 0) {
+		return false;
+	}
+	double inv_det = 1 / det;
+	Vector t_vec = r.Origin() - p1;
+	v = (t_vec | p_vec) * inv_det;
+	if (v <= 0 || v >= 1) {
+		return false;
+	}
+	Vector q_vec = t_vec ^ edge1;
+	u = (direction | q_vec) * inv_det;
+	if (u <= 0 || u + v >= 1) {
+		return false;
+	}
+	t = (edge2 | q_vec) * inv_det;
+	return t > 0;
+}
+
+
+Vector CompressedMesh::PlaneNormal(const PackedTriangle &triangle) const {
+	Point p1 = DecodePosition(vertices_[triangle.vertices[0]]);
+	Point p2 = DecodePosition(vertices_[triangle.vertices[1]]);
+	Point p3 = DecodePosition(vertices_[triangle.vertices[2]]);
+	Vector normal_plane = (p2-p1)^(p3-p1);
+	normal_plane.Normalize();
+	if ((normal_plane | DecodeNormal(vertices_[triangle.vertices[0]].normal))
+		< 0) {
+		normal_plane = -normal_plane;
+	}
+	return normal_plane;
+}
+
+
+Intersection CompressedMesh::Intersect(const Ray &r) const {
+	double t_max = std::numeric_limits<double>::infinity();
+	double u_hit = 0;
+	double v_hit = 0;
+	bool found = false;
+	unsigned int hit = 0;
+	bvh_.Traverse(r, t_max, [&](unsigned int first, unsigned int count) {
+		for (unsigned int i=first; i<first+count; i++) {
+			double t, u, v;
+			if (IntersectTriangle(i, r, t, u, v) && t < t_max) {
+				t_max = t;
+				u_hit = u;
+				v_hit = v;
+				hit = i;
+				found = true;
+			}
+		}
+	});
+
+	if (!found) {
+		return Intersection{*this};
+	}
+	// The side is only needed for the closest triangle
+	bool out = (r.Direction() | PlaneNormal(triangles_[hit])) < 0;
+	return Intersection{t_max, out, u_hit, v_hit, *this, hit};
+}
+
+
+Vector CompressedMesh::Normal(const Point &p) const {
+	return Vector{0, 0, 1};
+}
+
+
+AABB CompressedMesh::BoundingBox() const {
+	return bvh_.RootBounds().ToAABB();
+}
+
+
+SurfaceInteraction CompressedMesh::Interact(
+	const Ray &r,
+	const Intersection &inter
+) const {
+	const PackedTriangle &triangle = triangles_[inter.Primitive()];
+	const PackedVertex &vertex1 = vertices_[triangle.vertices[0]];
+	const PackedVertex &vertex2 = vertices_[triangle.vertices[1]];
+	const PackedVertex &vertex3 = vertices_[triangle.vertices[2]];
+	Point p1 = DecodePosition(vertex1);
+	Vector normal_plane = PlaneNormal(triangle);
+
+	// Same computation as Triangle::Interact
+	Point p = r(inter.Distance());
+	Vector barycentric{1-inter.U()-inter.V(), inter.V(), inter.U()};
+	Vector normal = barycentric.x()*DecodeNormal(vertex1.normal)
+		+ barycentric.y()*DecodeNormal(vertex2.normal)
+		+ barycentric.z()*DecodeNormal(vertex3.normal);
+	normal.Normalize();
+	if (((p1-p)|normal_plane) >= 0) {
+		normal = -normal;
+	}
+	SurfaceInteraction s{
+		p, normal, barycentric, surfaces_->materials[triangle.material], *this,
+		inter.Primitive()
+	};
+
+	s.ComputeDifferentials(r, inter.Distance(), normal_plane);
+	if (s.HasDifferentials() && triangle.has_uv) {
+		// Barycentric coordinates of the vertices 2 and 3 of a vector of the
+		// embedding plane, as Triangle::BarycenticCoordinates
+		Vector edge1 = DecodePosition(vertex2) - p1;
+		Vector edge2 = DecodePosition(vertex3) - p1;
+		double dot11 = edge1.NormSquared();
+		double dot12 = (edge1|edge2);
+		double dot22 = edge2.NormSquared();
+		double inv_denom = 1 / (dot11*dot22 - dot12*dot12);
+		auto uv_differential = [&](const Vector &d, double &du, double &dv) {
+			double b2 = (dot22*(edge1|d) - dot12*(edge2|d)) * inv_denom;
+			double b3 = (dot11*(edge2|d) - dot12*(edge1|d)) * inv_denom;
+			float u1 = DecodeHalf(vertex1.uv[0]);
+			float v1 = DecodeHalf(vertex1.uv[1]);
+			du = b2*(DecodeHalf(vertex2.uv[0]) - u1)
+				+ b3*(DecodeHalf(vertex3.uv[0]) - u1);
+			dv = b2*(DecodeHalf(vertex2.uv[1]) - v1)
+				+ b3*(DecodeHalf(vertex3.uv[1]) - v1);
+		};
+		double du_dx, dv_dx, du_dy, dv_dy;
+		uv_differential(s.PointDx(), du_dx, dv_dx);
+		uv_differential(s.PointDy(), du_dy, dv_dy);
+		s.SetUVDifferentials(du_dx, dv_dx, du_dy, dv_dy);
+	}
+	return s;
+}
+
+
+Vector CompressedMesh::TextureColor(
+	const SurfaceInteraction &s, const Texture &texture
+) const {
+	const PackedTriangle &triangle = triangles_[s.Primitive()];
+	const Vector &bary = s.BarycentricCoordinates();
+	const PackedVertex &vertex1 = vertices_[triangle.vertices[0]];
+	const PackedVertex &vertex2 = vertices_[triangle.vertices[1]];
+	const PackedVertex &vertex3 = vertices_[triangle.vertices[2]];
+	float u = bary.x()*DecodeHalf(vertex1.uv[0])
+		+ bary.y()*DecodeHalf(vertex2.uv[0])
+		+ bary.z()*DecodeHalf(vertex3.uv[0]);
+	float v = bary.x()*DecodeHalf(vertex1.uv[1])
+		+ bary.y()*DecodeHalf(vertex2.uv[1])
+		+ bary.z()*DecodeHalf(vertex3.uv[1]);
+	if (s.HasDifferentials()) {
+		// Mip level matching the footprint of the Ray
+		return texture.Trilinear(u, v, texture.LevelOfDetail(
+			s.DuDx(), s.DvDx(), s.DuDy(), s.DvDy()
+		));
+	}
+	return texture.Bilinear(u, v);
+}
+
+
+Vector CompressedMesh::DiffuseColor(const SurfaceInteraction &s) const {
+	const PackedTriangle &triangle = triangles_[s.Primitive()];
+	const auto &texture = surfaces_->diffuse_textures[triangle.material];
+	if (!texture || !triangle.has_uv) {
+		// If no texture can be accessed, uses the material color
+		return s.SurfaceMaterial().DiffuseColor();
+	}
+	return TextureColor(s, *texture);
+}
+
+
+Vector CompressedMesh::SpecularColor(const SurfaceInteraction &s) const {
+	const PackedTriangle &triangle = triangles_[s.Primitive()];
+	const auto &texture = surfaces_->specular_textures[triangle.material];
+	if (!texture || !triangle.has_uv) {
+		// If no texture can be accessed, uses the material color
+		return s.SurfaceMaterial().SpecularColor();
+	}
+	return TextureColor(s, *texture);
+}
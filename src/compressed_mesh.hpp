@@ -0,0 +1,180 @@
+/**
+ * \file compressed_mesh.hpp
+ * \brief Defines meshes storing quantized vertex attributes, decoded on the
+ *        fly.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+
+
+/**
+ * \struct PackedVertex
+ * \brief Vertex of a CompressedMesh, in 16 bytes.
+ */
+struct PackedVertex {
+	/// Coordinates quantized on 16 bits between the bounds of the mesh.
+	std::uint16_t position[3];
+
+	std::uint16_t uv[2]; //!< UV coordinates in half precision.
+
+	/// Octahedral encoding of the normal, as two 16-bit signed normalized
+	/// values.
+	std::uint32_t normal;
+};
+
+
+/**
+ * \struct PackedTriangle
+ * \brief Triangle of a CompressedMesh, referring to its vertices.
+ */
+struct PackedTriangle {
+	std::uint32_t vertices[3]; //!< Indices of the vertices.
+
+	/// Index of the material in ObjSurfaces::materials.
+	std::uint16_t material;
+
+	std::uint16_t has_uv; //!< Non-zero if the UV coordinates are valid.
+};
+
+
+/**
+ * \class CompressedMesh
+ * \brief Triangle mesh whose vertex attributes are stored in compact encodings
+ *        and decoded when intersecting and shading.
+ *
+ * Each distinct vertex costs 16 bytes: its position is quantized relative to
+ * the bounds of the mesh, its normal is stored in octahedral encoding and its
+ * UV coordinates in half precision. Triangles only store the indices of their
+ * vertices, and are sorted in the order of the leaves of a FlatBVH. A Triangle
+ * of Mesh, in comparison, costs more than 300 bytes.
+ *
+ * Vertices shared between triangles decode to the same position, so that the
+ * quantized surface stays watertight. The quantization step is 1/65535 of the
+ * extent of the mesh along each axis, and half-precision UV coordinates are
+ * accurate up to 1/2048 in [0,1].
+ */
+class CompressedMesh : public RawObject {
+public:
+	/// Maximal number of triangles per leaf of the BVH.
+	static const unsigned int kLeafSize = 4;
+
+private:
+	std::vector<PackedVertex> vertices_;     //!< Distinct vertices.
+	std::vector<PackedTriangle> triangles_; //!< Triangles, in BVH order.
+
+	double origin_[3]; //!< Position decoded from quantized coordinates 0.
+	double step_[3];   //!< Quantization step along each axis.
+
+	/// Materials and textures of the triangles.
+	std::shared_ptr<const ObjSurfaces> surfaces_;
+
+	/// BVH whose leaves are ranges of consecutive triangles.
+	FlatBVH bvh_;
+
+	/// Decodes the position of the input vertex.
+	inline Point DecodePosition(const PackedVertex &vertex) const {
+		return Point{
+			origin_[0] + vertex.position[0] * step_[0],
+			origin_[1] + vertex.position[1] * step_[1],
+			origin_[2] + vertex.position[2] * step_[2]
+		};
+	}
+
+	/**
+	 * \fn static Vector DecodeNormal(std::uint32_t normal)
+	 * \brief Decodes a normalized normal from its octahedral encoding.
+	 */
+	static Vector DecodeNormal(std::uint32_t normal);
+
+	/**
+	 * \fn static float DecodeHalf(std::uint16_t half)
+	 * \brief Converts a half-precision value to single precision.
+	 */
+	static float DecodeHalf(std::uint16_t half);
+
+	/**
+	 * \fn bool IntersectTriangle(unsigned int i, const Ray &r, double &t, double &u, double &v) const
+	 * \brief Computes the Intersection between the i-th triangle and the
+	 *        input Ray, as Triangle::Intersect.
+	 * \param t, u, v Output distance and parametric coordinates, if any.
+	 */
+	bool IntersectTriangle(
+		unsigned int i, const Ray &r, double &t, double &u, double &v
+	) const;
+
+	/**
+	 * \fn Vector PlaneNormal(const PackedTriangle &triangle) const
+	 * \brief Outputs the normal of the embedding plane of a triangle, oriented
+	 *        towards the same half-space as the normal of its first vertex.
+	 */
+	Vector PlaneNormal(const PackedTriangle &triangle) const;
+
+	/**
+	 * \fn Vector TextureColor(const SurfaceInteraction &s, const Texture &texture) const
+	 * \brief Outputs the color of the input texture at the UV coordinates of
+	 *        the hit point.
+	 */
+	Vector TextureColor(
+		const SurfaceInteraction &s, const Texture &texture
+	) const;
+
+public:
+	/**
+	 * \fn CompressedMesh(const std::string &filename, const std::string &folder, const Material &material=Material{}, const DecimationOptions &decimation=DecimationOptions{})
+	 * \brief Imports an .obj file and encodes its vertices.
+	 * \param filename Path to the .obj file.
+	 * \param folder Folder of the texture files (with separator at the end).
+	 * \param material Default material of the object, used when some parameter
+	 *        is missing in the input file.
+	 * \param decimation Simplification applied at import.
+	 * \throw std::runtime_error If the file cannot be read.
+	 *
+	 * The file is read with the native loader (see LoadOBJ), and produces the
+	 * same triangles as Mesh, up to the precision of the encodings.
+	 */
+	CompressedMesh(
+		const std::string &filename,
+		const std::string &folder,
+		const Material &material=Material{},
+		const DecimationOptions &decimation=DecimationOptions{}
+	);
+
+	/// Outputs the number of triangles of the mesh.
+	inline size_t NbTriangles() const {
+		return triangles_.size();
+	}
+
+	/// Outputs the number of distinct vertices of the mesh.
+	inline size_t NbVertices() const {
+		return vertices_.size();
+	}
+
+	/// Outputs the memory used by the mesh, in bytes, textures excluded.
+	size_t MemoryUsage() const;
+
+	/**
+	 * \fn Intersection Intersect(const Ray &r) const
+	 * \brief Traverses the BVH of the mesh; the primitive identifier of the
+	 *        Intersection is the index of the hit triangle.
+	 */
+	Intersection Intersect(const Ray &r) const;
+
+	/// \warning Does not return the normal of the object. Normals to individual
+	///          triangles are computed by Interact.
+	Vector Normal(const Point &p) const;
+
+	AABB BoundingBox() const;
+
+	/// Decodes the hit triangle and interpolates its normals.
+	SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const;
+
+	Vector DiffuseColor(const SurfaceInteraction &s) const;
+
+	Vector SpecularColor(const SurfaceInteraction &s) const;
+};
@@ -0,0 +1,498 @@
+/**
+ * \file decimation.cpp
+ * \brief Implements the simplification of triangle meshes by quadric error
+ *        metrics.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include "decimation.hpp"
+
+
+/// Minimal cosine between the normals of a face before and after a collapse.
+static const double kMinNormalCosine = 0.5;
+
+
+/**
+ * \fn static bool AreUVsDifferent(const std::vector<float> &uvs, unsigned int v, unsigned int w)
+ * \brief Indicates if two vertices have different UV coordinates, both of
+ *        them being given.
+ */
+static bool AreUVsDifferent(
+	const std::vector<float> &uvs, unsigned int v, unsigned int w
+) {
+	if (uvs.empty()) {
+		return false;
+	}
+	const float *a = &uvs[2*v];
+	const float *b = &uvs[2*w];
+	if (std::isnan(a[0]) || std::isnan(b[0])) {
+		return false;
+	}
+	return a[0] != b[0] || a[1] != b[1];
+}
+
+
+/**
+ * \fn static double NormalCosine(const std::vector<float> &normals, unsigned int v, unsigned int w)
+ * \brief Outputs the cosine between the normals of two vertices, or 1 if one
+ *        of them is missing.
+ */
+static double NormalCosine(
+	const std::vector<float> &normals, unsigned int v, unsigned int w
+) {
+	if (normals.empty()) {
+		return 1;
+	}
+	Vector a{normals[3*v], normals[3*v+1], normals[3*v+2]};
+	Vector b{normals[3*w], normals[3*w+1], normals[3*w+2]};
+	double norms = a.NormSquared() * b.NormSquared();
+	return norms == 0 ? 1 : (a | b) / std::sqrt(norms);
+}
+
+
+/**
+ * \struct Quadric
+ * \brief Symmetric 4x4 matrix measuring the sum of squared distances of a
+ *        point to a set of planes.
+ */
+struct Quadric {
+	/// Upper triangle of the matrix: xx, xy, xz, xw, yy, yz, yw, zz, zw, ww.
+	double q[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	/// Adds the plane of normalized normal n at signed distance d.
+	inline void AddPlane(const Vector &n, double d) {
+		const double a = n.x(), b = n.y(), c = n.z();
+		q[0] += a*a; q[1] += a*b; q[2] += a*c; q[3] += a*d;
+		q[4] += b*b; q[5] += b*c; q[6] += b*d;
+		q[7] += c*c; q[8] += c*d;
+		q[9] += d*d;
+	}
+
+	/// Adds the input quadric.
+	inline Quadric& operator+=(const Quadric &other) {
+		for (int i=0; i<10; i++) {
+			q[i] += other.q[i];
+		}
+		return *this;
+	}
+
+	/// Outputs the sum of squared distances of p to the planes.
+	inline double Evaluate(const Point &p) const {
+		const double x = p.x(), y = p.y(), z = p.z();
+		return x*x*q[0] + 2*x*y*q[1] + 2*x*z*q[2] + 2*x*q[3]
+			+ y*y*q[4] + 2*y*z*q[5] + 2*y*q[6]
+			+ z*z*q[7] + 2*z*q[8]
+			+ q[9];
+	}
+};
+
+
+/**
+ * \struct Collapse
+ * \brief Candidate collapse of a position into another, with the versions of
+ *        their quadrics when its error was computed.
+ */
+struct Collapse {
+	double error;              //!< Quadric error of the collapse.
+	unsigned int from;         //!< Position removed by the collapse.
+	unsigned int to;           //!< Position kept by the collapse.
+	unsigned int version_from; //!< Version of the quadric of from.
+	unsigned int version_to;   //!< Version of the quadric of to.
+
+	/// Orders the collapses by decreasing error, for a min-heap.
+	inline bool operator<(const Collapse &other) const {
+		return error > other.error;
+	}
+};
+
+
+std::vector<unsigned int> Decimate(
+	const std::vector<float> &positions,
+	const std::vector<float> &normals,
+	const std::vector<float> &uvs,
+	std::vector<unsigned int> &triangles,
+	const std::vector<unsigned int> &groups,
+	const DecimationOptions &options
+) {
+	const size_t nb_vertices = positions.size() / 3;
+	const size_t nb_triangles = triangles.size() / 3;
+	std::vector<unsigned int> origins(nb_triangles);
+	std::iota(origins.begin(), origins.end(), 0);
+	if (!options.IsEnabled() || nb_triangles <= options.target_triangles) {
+		return origins;
+	}
+
+	// Welds the vertices sharing a position
+	std::vector<unsigned int> sorted(nb_vertices);
+	std::iota(sorted.begin(), sorted.end(), 0);
+	std::sort(sorted.begin(), sorted.end(),
+		[&](unsigned int i, unsigned int j) {
+			return std::lexicographical_compare(
+				&positions[3*i], &positions[3*i+3],
+				&positions[3*j], &positions[3*j+3]
+			);
+		}
+	);
+	std::vector<unsigned int> position_of(nb_vertices);
+	std::vector<Point> points;
+	for (size_t i=0; i<nb_vertices; i++) {
+		const float *p = &positions[3*sorted[i]];
+		if (i == 0 || !std::equal(p, p+3, &positions[3*sorted[i-1]])) {
+			points.push_back(Point{p[0], p[1], p[2]});
+		}
+		position_of[sorted[i]] = points.size() - 1;
+	}
+	std::vector<unsigned int>().swap(sorted);
+	const size_t nb_positions = points.size();
+
+	// Triangles over positions, their incident lists, and the vertices of
+	// each position; positions with several vertices lie on a seam
+	std::vector<unsigned int> corners(3*nb_triangles);
+	std::vector<char> is_removed(nb_triangles, false);
+	std::vector<std::vector<unsigned int>> incident(nb_positions);
+	std::vector<std::vector<unsigned int>> vertices_at(nb_positions);
+	std::vector<char> is_locked(nb_positions, false);
+	size_t nb_alive = 0;
+	for (size_t t=0; t<nb_triangles; t++) {
+		for (int k=0; k<3; k++) {
+			unsigned int v = triangles[3*t+k];
+			unsigned int p = position_of[v];
+			corners[3*t+k] = p;
+			std::vector<unsigned int> &list = vertices_at[p];
+			if (std::find(list.begin(), list.end(), v) == list.end()) {
+				list.push_back(v);
+			}
+		}
+		const unsigned int *c = &corners[3*t];
+		if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) {
+			is_removed[t] = true;
+			continue;
+		}
+		for (int k=0; k<3; k++) {
+			incident[c[k]].push_back(t);
+		}
+		nb_alive++;
+	}
+
+	// Locks the positions on UV seams and on normal creases; the vertices of
+	// the other seams are moved together
+	const double crease_cosine = std::cos(options.crease_angle);
+	for (size_t p=0; p<nb_positions; p++) {
+		const std::vector<unsigned int> &list = vertices_at[p];
+		for (size_t i=0; i<list.size() && !is_locked[p]; i++) {
+			for (size_t j=i+1; j<list.size(); j++) {
+				if (AreUVsDifferent(uvs, list[i], list[j])
+					|| NormalCosine(normals, list[i], list[j]) < crease_cosine)
+				{
+					is_locked[p] = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// Outputs the vertex of position p whose attributes best match those of
+	// vertex v: same UV coordinates, then closest normal
+	auto match = [&](unsigned int v, unsigned int p) {
+		unsigned int best = vertices_at[p][0];
+		double best_score = -std::numeric_limits<double>::infinity();
+		for (unsigned int w : vertices_at[p]) {
+			double score = NormalCosine(normals, v, w)
+				- (AreUVsDifferent(uvs, v, w) ? 4 : 0);
+			if (score > best_score) {
+				best = w;
+				best_score = score;
+			}
+		}
+		return best;
+	};
+
+	// Locks the ends of the edges which are not shared by exactly two
+	// triangles of the same group
+	{
+		std::vector<std::array<unsigned int, 3>> edges;
+		edges.reserve(3*nb_alive);
+		for (size_t t=0; t<nb_triangles; t++) {
+			if (is_removed[t]) {
+				continue;
+			}
+			for (int k=0; k<3; k++) {
+				unsigned int a = corners[3*t+k];
+				unsigned int b = corners[3*t+(k+1)%3];
+				edges.push_back({
+					std::min(a, b), std::max(a, b),
+					groups.empty() ? 0 : groups[t]
+				});
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i=0; i<edges.size();) {
+			size_t j = i;
+			while (j < edges.size() && edges[j][0] == edges[i][0]
+				&& edges[j][1] == edges[i][1])
+			{
+				j++;
+			}
+			if (j-i != 2 || edges[i][2] != edges[i+1][2]) {
+				is_locked[edges[i][0]] = true;
+				is_locked[edges[i][1]] = true;
+			}
+			i = j;
+		}
+	}
+
+	// Quadrics of the planes of the faces around each position
+	std::vector<Quadric> quadrics(nb_positions);
+	for (size_t t=0; t<nb_triangles; t++) {
+		if (is_removed[t]) {
+			continue;
+		}
+		const unsigned int *c = &corners[3*t];
+		Vector n =
+			(points[c[1]] - points[c[0]]) ^ (points[c[2]] - points[c[0]]);
+		if (n.NormSquared() == 0) {
+			continue;
+		}
+		n.Normalize();
+		double d = -(n | points[c[0]]);
+		for (int k=0; k<3; k++) {
+			quadrics[c[k]].AddPlane(n, d);
+		}
+	}
+
+	// Outputs the positions adjacent to p, sorted
+	auto neighbors = [&](unsigned int p) {
+		std::vector<unsigned int> result;
+		for (unsigned int t : incident[p]) {
+			for (int k=0; k<3; k++) {
+				if (corners[3*t+k] != p) {
+					result.push_back(corners[3*t+k]);
+				}
+			}
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+		return result;
+	};
+
+	// Candidate collapses along all free edges, in both directions
+	std::vector<unsigned int> versions(nb_positions, 0);
+	std::priority_queue<Collapse> candidates;
+	auto push = [&](unsigned int from, unsigned int to) {
+		if (is_locked[from] || is_locked[to]) {
+			return;
+		}
+		Quadric q = quadrics[from];
+		q += quadrics[to];
+		candidates.push(Collapse{
+			q.Evaluate(points[to]), from, to, versions[from], versions[to]
+		});
+	};
+	for (size_t t=0; t<nb_triangles; t++) {
+		if (is_removed[t]) {
+			continue;
+		}
+		for (int k=0; k<3; k++) {
+			unsigned int a = corners[3*t+k];
+			unsigned int b = corners[3*t+(k+1)%3];
+			if (a < b) {
+				push(a, b);
+				push(b, a);
+			}
+		}
+	}
+
+	std::vector<char> is_dead(nb_positions, false);
+	const double max_error = options.max_error * options.max_error;
+	while (!candidates.empty() && (options.target_triangles == 0
+		|| nb_alive > options.target_triangles))
+	{
+		Collapse collapse = candidates.top();
+		candidates.pop();
+		if (options.max_error > 0 && collapse.error > max_error) {
+			break;
+		}
+		const unsigned int a = collapse.from;
+		const unsigned int b = collapse.to;
+		if (is_dead[a] || is_dead[b] || collapse.version_from != versions[a]
+			|| collapse.version_to != versions[b])
+		{
+			continue;
+		}
+
+		// The edge must still exist, and its ends may only share the two
+		// opposite positions of its faces, so that the surface stays manifold
+		std::vector<unsigned int> neighbors_a = neighbors(a);
+		std::vector<unsigned int> neighbors_b = neighbors(b);
+		if (!std::binary_search(neighbors_a.begin(), neighbors_a.end(), b)) {
+			continue;
+		}
+		std::vector<unsigned int> shared;
+		std::set_intersection(
+			neighbors_a.begin(), neighbors_a.end(),
+			neighbors_b.begin(), neighbors_b.end(),
+			std::back_inserter(shared)
+		);
+		if (shared.size() != 2) {
+			continue;
+		}
+
+		// Rejects the collapse if a remaining face would degenerate, flip or
+		// tilt too much
+		bool is_valid = true;
+		for (unsigned int t : incident[a]) {
+			const unsigned int *c = &corners[3*t];
+			if (c[0] == b || c[1] == b || c[2] == b) {
+				continue;
+			}
+			Point p[3], q[3];
+			for (int k=0; k<3; k++) {
+				p[k] = points[c[k]];
+				q[k] = c[k] == a ? points[b] : p[k];
+			}
+			Vector before = (p[1]-p[0]) ^ (p[2]-p[0]);
+			Vector after = (q[1]-q[0]) ^ (q[2]-q[0]);
+			double norms = before.NormSquared() * after.NormSquared();
+			if (norms == 0
+				|| (before | after) < kMinNormalCosine*std::sqrt(norms))
+			{
+				is_valid = false;
+				break;
+			}
+		}
+		if (!is_valid) {
+			continue;
+		}
+
+		// Collapses a into b: the faces of the edge disappear, the others
+		// take the matching vertex of b
+		for (unsigned int t : incident[a]) {
+			unsigned int *c = &corners[3*t];
+			if (c[0] == b || c[1] == b || c[2] == b) {
+				is_removed[t] = true;
+				nb_alive--;
+				for (int k=0; k<3; k++) {
+					if (c[k] != a) {
+						std::vector<unsigned int> &list = incident[c[k]];
+						list.erase(std::find(list.begin(), list.end(), t));
+					}
+				}
+				continue;
+			}
+			for (int k=0; k<3; k++) {
+				if (c[k] == a) {
+					c[k] = b;
+					triangles[3*t+k] = match(triangles[3*t+k], b);
+				}
+			}
+			incident[b].push_back(t);
+		}
+		std::vector<unsigned int>().swap(incident[a]);
+		is_dead[a] = true;
+		quadrics[b] += quadrics[a];
+		versions[b]++;
+
+		// Updates the errors of the collapses around b
+		for (unsigned int c : neighbors(b)) {
+			push(b, c);
+			push(c, b);
+		}
+	}
+
+	// Keeps the remaining triangles
+	size_t nb_kept = 0;
+	for (size_t t=0; t<nb_triangles; t++) {
+		if (!is_removed[t]) {
+			std::copy(
+				triangles.begin() + 3*t, triangles.begin() + 3*t+3,
+				triangles.begin() + 3*nb_kept
+			);
+			origins[nb_kept] = t;
+			nb_kept++;
+		}
+	}
+	triangles.resize(3*nb_kept);
+	origins.resize(nb_kept);
+	return origins;
+}
+
+
+void DecimateOBJ(ObjData &data, const DecimationOptions &options) {
+	if (!options.IsEnabled()) {
+		return;
+	}
+
+	// Numbers the distinct (position, UV, normal) corners as vertices, and
+	// removes the triangles with a missing position
+	std::vector<std::array<unsigned int, 3>> tuples;
+	std::vector<unsigned int> sources;
+	for (size_t j=0; j<data.NbTriangles(); j++) {
+		const unsigned int *c = &data.triangles[9*j];
+		if (c[0] == ObjData::kNone || c[3] == ObjData::kNone
+			|| c[6] == ObjData::kNone)
+		{
+			continue;
+		}
+		for (int k=0; k<3; k++) {
+			tuples.push_back({c[3*k], c[3*k+1], c[3*k+2]});
+		}
+		sources.push_back(j);
+	}
+	std::vector<unsigned int> order(tuples.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(),
+		[&](unsigned int i, unsigned int j) {
+			return tuples[i] < tuples[j];
+		}
+	);
+	std::vector<unsigned int> triangles(tuples.size());
+	std::vector<std::array<unsigned int, 3>> vertices;
+	std::vector<float> positions, normals, uvs;
+	for (size_t i=0; i<order.size(); i++) {
+		if (i == 0 || tuples[order[i]] != tuples[order[i-1]]) {
+			vertices.push_back(tuples[order[i]]);
+			const std::array<unsigned int, 3> &v = vertices.back();
+			const float *p = &data.positions[3*v[0]];
+			positions.insert(positions.end(), p, p+3);
+			if (v[1] == ObjData::kNone) {
+				const float nan = std::numeric_limits<float>::quiet_NaN();
+				uvs.insert(uvs.end(), 2, nan);
+			} else {
+				const float *uv = &data.uvs[2*v[1]];
+				uvs.insert(uvs.end(), uv, uv+2);
+			}
+			if (v[2] == ObjData::kNone) {
+				normals.insert(normals.end(), 3, 0.f);
+			} else {
+				const float *n = &data.normals[3*v[2]];
+				normals.insert(normals.end(), n, n+3);
+			}
+		}
+		triangles[order[i]] = vertices.size() - 1;
+	}
+	std::vector<std::array<unsigned int, 3>>().swap(tuples);
+	std::vector<unsigned int>().swap(order);
+
+	std::vector<unsigned int> groups(sources.size());
+	for (size_t i=0; i<sources.size(); i++) {
+		groups[i] = data.triangle_materials[sources[i]];
+	}
+	std::vector<unsigned int> origins =
+		Decimate(positions, normals, uvs, triangles, groups, options);
+
+	// Writes back the remaining triangles
+	data.triangles.resize(9*origins.size());
+	data.triangle_materials.resize(origins.size());
+	for (size_t i=0; i<origins.size(); i++) {
+		for (int k=0; k<3; k++) {
+			const std::array<unsigned int, 3> &v = vertices[triangles[3*i+k]];
+			std::copy(v.begin(), v.end(), &data.triangles[9*i+3*k]);
+		}
+		data.triangle_materials[i] = groups[origins[i]];
+	}
+}
@@ -0,0 +1,87 @@
+/**
+ * \file decimation.hpp
+ * \brief Defines the simplification of triangle meshes by quadric error
+ *        metrics.
+ */
+
+#pragma once
+
+#include <vector>
+#include "obj_loader.hpp"
+
+
+/**
+ * \struct DecimationOptions
+ * \brief Options controlling the simplification of a mesh at import.
+ *
+ * The simplification is disabled when neither a target nor an error bound is
+ * given.
+ */
+struct DecimationOptions {
+	/// Number of triangles to reach, or 0 for no target.
+	size_t target_triangles = 0;
+
+	/// Maximal quadric error of a collapse, in units of the normalized mesh,
+	/// or 0 for no bound.
+	double max_error = 0;
+
+	/// Angle between the normals of a position above which it is kept as a
+	/// crease, in radians. Softer normal seams (e.g. the faceted normals of a
+	/// curved surface) are simplified.
+	double crease_angle = PI/4;
+
+	/// Indicates if the simplification is enabled.
+	inline bool IsEnabled() const {
+		return target_triangles > 0 || max_error > 0;
+	}
+};
+
+
+/**
+ * \fn std::vector<unsigned int> Decimate(const std::vector<float> &positions, const std::vector<float> &normals, const std::vector<float> &uvs, std::vector<unsigned int> &triangles, const std::vector<unsigned int> &groups, const DecimationOptions &options)
+ * \brief Simplifies an indexed triangle mesh by successive edge collapses.
+ * \param positions Coordinates of the vertices (3 per vertex). Vertices are
+ *        unique attribute tuples: vertices with different attributes (UV
+ *        coordinates, normal) may share a position.
+ * \param normals Normals of the vertices (3 per vertex, null if missing), or
+ *        empty if the vertices have none.
+ * \param uvs UV coordinates of the vertices (2 per vertex, NaN if missing),
+ *        or empty if the vertices have none.
+ * \param triangles Vertex indices of the triangles (3 per triangle), replaced
+ *        by those of the remaining triangles.
+ * \param groups Group (e.g. material) of each triangle, or empty if all
+ *        triangles belong to the same group.
+ * \return The index of the input triangle from which each remaining triangle
+ *         comes, so that the caller can transfer per-triangle data.
+ *
+ * Each vertex accumulates the quadric of the planes of its faces (Garland
+ * and Heckbert); the edge collapse of least error is applied first, merging
+ * one position into the other, so that the attributes of the remaining
+ * vertices are kept as is. Each corner of the removed position takes the
+ * vertex of the kept position with matching UV coordinates and the closest
+ * normal. Positions on UV seams, on normal creases sharper than the crease
+ * angle, on open boundaries and on the borders between groups are never
+ * moved, and collapses that would fold the surface or tilt a face by more
+ * than 60 degrees are rejected.
+ *
+ * Collapses stop when the target is reached, or when the least error exceeds
+ * the square of the error bound.
+ */
+std::vector<unsigned int> Decimate(
+	const std::vector<float> &positions,
+	const std::vector<float> &normals,
+	const std::vector<float> &uvs,
+	std::vector<unsigned int> &triangles,
+	const std::vector<unsigned int> &groups,
+	const DecimationOptions &options
+);
+
+
+/**
+ * \fn void DecimateOBJ(ObjData &data, const DecimationOptions &options)
+ * \brief Simplifies the triangles of an OBJ file in place (see Decimate).
+ *
+ * Materials are used as groups, so that their borders are preserved.
+ * Triangles with a missing position are removed.
+ */
+void DecimateOBJ(ObjData &data, const DecimationOptions &options);
@@ -0,0 +1,340 @@
+/**
+ * \file light.cpp
+ * \brief Implements classes of light.hpp.
+ */
+
+#include <algorithm>
+#include "light.hpp"
+#include "mesh.hpp"
+
+
+LightTree::LightTree(const std::vector<Light> &lights) {
+	if (lights.empty()) {
+		return;
+	}
+	std::vector<size_t> indices(lights.size());
+	for (size_t i=0; i<lights.size(); i++) {
+		indices[i] = i;
+	}
+	nodes_.reserve(2*lights.size()-1);
+	Build(lights, indices.begin(), indices.end());
+}
+
+
+void LightTree::Build(
+	const std::vector<Light> &lights, std::vector<size_t>::iterator begin,
+	std::vector<size_t>::iterator end
+) {
+	size_t current = nodes_.size();
+	nodes_.emplace_back();
+	Node node;
+	node.min = lights[*begin].Source();
+	node.max = node.min;
+	for (auto it=begin; it!=end; ++it) {
+		const Point &source = lights[*it].Source();
+		const Vector &intensity = lights[*it].Intensity();
+		node.min = Point{std::min(node.min.x(), source.x()),
+			std::min(node.min.y(), source.y()),
+			std::min(node.min.z(), source.z())};
+		node.max = Point{std::max(node.max.x(), source.x()),
+			std::max(node.max.y(), source.y()),
+			std::max(node.max.z(), source.z())};
+		node.power += (intensity.x() + intensity.y() + intensity.z()) / 3;
+	}
+
+	if (end - begin == 1) {
+		node.is_leaf = true;
+		node.index = *begin;
+		nodes_[current] = node;
+		return;
+	}
+
+	// Splits at the median of the largest axis of the box
+	Vector extent = node.max - node.min;
+	int axis = extent.x() >= extent.y() && extent.x() >= extent.z() ? 0
+		: (extent.y() >= extent.z() ? 1 : 2);
+	auto coordinate = [&lights, axis](size_t i) {
+		const Point &source = lights[i].Source();
+		return axis == 0 ? source.x() : (axis == 1 ? source.y() : source.z());
+	};
+	auto middle = begin + (end - begin)/2;
+	std::nth_element(begin, middle, end, [&coordinate](size_t a, size_t b) {
+		return coordinate(a) < coordinate(b);
+	});
+	Build(lights, begin, middle);
+	node.index = nodes_.size();
+	Build(lights, middle, end);
+	nodes_[current] = node;
+}
+
+
+double LightTree::Importance(
+	const Node &node, const Point &p, const Vector &normal, bool two_sided
+) const {
+	// Lights entirely behind the surface, if they cannot contribute
+	if (!two_sided) {
+		double farthest =
+			std::max(normal.x()*(node.min.x()-p.x()),
+				normal.x()*(node.max.x()-p.x()))
+			+ std::max(normal.y()*(node.min.y()-p.y()),
+				normal.y()*(node.max.y()-p.y()))
+			+ std::max(normal.z()*(node.min.z()-p.z()),
+				normal.z()*(node.max.z()-p.z()));
+		if (farthest <= 0) {
+			return 0;
+		}
+	}
+
+	// The squared distance is bounded by the size of the box, so that points
+	// close to or inside a cluster do not favor it without limit
+	Vector extent = node.max - node.min;
+	double dd = ((node.min + node.max)/2 - p).NormSquared();
+	return node.power / std::max(dd, extent.NormSquared()/4);
+}
+
+
+bool LightTree::Sample(
+	const Point &p, const Vector &normal, bool two_sided, double u,
+	size_t &light, double &probability
+) const {
+	if (nodes_.empty()) {
+		return false;
+	}
+	probability = 1;
+	size_t current = 0;
+	while (!nodes_[current].is_leaf) {
+		size_t left = current+1;
+		size_t right = nodes_[current].index;
+		double importance_left = Importance(nodes_[left], p, normal, two_sided);
+		double importance_right =
+			Importance(nodes_[right], p, normal, two_sided);
+		if (importance_left + importance_right <= 0) {
+			return false;
+		}
+
+		// Rescales u at each level so that it stays uniform in [0,1)
+		double p_left = importance_left / (importance_left + importance_right);
+		if (u < p_left) {
+			u = u / p_left;
+			probability *= p_left;
+			current = left;
+		} else {
+			u = std::min((u - p_left) / (1 - p_left), 1-1e-12);
+			probability *= 1 - p_left;
+			current = right;
+		}
+	}
+	light = nodes_[current].index;
+	return true;
+}
+
+
+void Reservoir::Update(
+	size_t light, double weight, double target, double count, double &u
+) {
+	count_ += count;
+	if (weight <= 0) {
+		return;
+	}
+	weight_sum_ += weight;
+
+	// Keeps the candidate with probability weight / weight_sum_, and rescales u
+	// as in LightTree::Sample
+	double probability = weight / weight_sum_;
+	if (u < probability) {
+		u = u / probability;
+		light_ = light;
+		target_ = target;
+	} else {
+		u = std::min((u - probability) / (1 - probability), 1-1e-12);
+	}
+}
+
+
+void Reservoir::Finalize(
+	const Point &point, const Vector &normal, bool mis_weighted
+) {
+	double normalization = mis_weighted ? 1 : count_;
+	contribution_weight_ = target_ > 0 && normalization > 0 ?
+		weight_sum_ / (normalization * target_) : 0;
+	point_ = point;
+	normal_ = normal;
+}
+
+
+Emitter::Emitter(const Sphere &sphere) :
+	object_{&sphere},
+	is_sphere_{true},
+	origin_{sphere.Center()},
+	radius_{sphere.Radius()},
+	area_{4*PI*sphere.Radius()*sphere.Radius()},
+	radiance_{sphere.ObjectMaterial().Emission()}
+{
+}
+
+
+Emitter::Emitter(const Triangle &triangle) :
+	object_{&triangle},
+	is_sphere_{false},
+	origin_{triangle.Vertex(0)},
+	edge1_{triangle.Vertex(1) - triangle.Vertex(0)},
+	edge2_{triangle.Vertex(2) - triangle.Vertex(0)},
+	radius_{0},
+	area_{triangle.Area()},
+	radiance_{triangle.ObjectMaterial().Emission()}
+{
+	normal_ = edge1_^edge2_;
+	normal_.Normalize();
+}
+
+
+bool Emitter::Sample(
+	const Point &p, double u, double v, LightSample &sample
+) const {
+	sample.radiance = radiance_;
+	sample.object = object_;
+
+	Vector to_center = origin_ - p;
+	double dd_center = to_center.NormSquared();
+	if (is_sphere_ && dd_center > radius_*radius_) {
+		// Uniform direction in the cone subtended by the sphere
+		double d_center = sqrt(dd_center);
+		double sin2_max = radius_*radius_ / dd_center;
+		double cos_max = sqrt(std::max(0., 1-sin2_max));
+		// 1-cos_max, without cancellation for small spheres
+		double solid_angle = 2*PI * sin2_max / (1+cos_max);
+		double cos_theta = 1 - u*sin2_max/(1+cos_max);
+		double sin_theta = sqrt(std::max(0., 1-cos_theta*cos_theta));
+		Vector axis = to_center / d_center;
+		Vector ortho1 = axis.Orthogonal();
+		Vector ortho2 = axis^ortho1;
+		sample.direction = cos(2*PI*v)*sin_theta*ortho1
+			+ sin(2*PI*v)*sin_theta*ortho2 + cos_theta*axis;
+
+		// First intersection of the direction with the sphere
+		double delta = radius_*radius_ - dd_center*sin_theta*sin_theta;
+		sample.distance =
+			std::max(0., d_center*cos_theta - sqrt(std::max(0., delta)));
+		sample.pdf = 1/solid_angle;
+		return true;
+	}
+
+	// Uniform point on the surface, whose density is converted to solid angle
+	Point q;
+	Vector normal;
+	if (is_sphere_) {
+		double z = 1 - 2*u;
+		double r = sqrt(std::max(0., 1-z*z));
+		normal = Vector{r*cos(2*PI*v), r*sin(2*PI*v), z};
+		q = origin_ + radius_*normal;
+	} else {
+		double root = sqrt(u);
+		q = origin_ + root*(1-v)*edge1_ + root*v*edge2_;
+		normal = normal_;
+	}
+	Vector direction = q - p;
+	double dd = direction.NormSquared();
+	if (dd == 0) {
+		return false;
+	}
+	sample.distance = sqrt(dd);
+	sample.direction = direction / sample.distance;
+	double cosine = std::abs(normal|sample.direction);
+	if (cosine < 1e-8) {
+		return false;
+	}
+	sample.pdf = dd / (cosine*area_);
+	return true;
+}
+
+
+double Emitter::Pdf(const Point &p, const Point &q) const {
+	double dd_center = (origin_ - p).NormSquared();
+	if (is_sphere_ && dd_center > radius_*radius_) {
+		double sin2_max = radius_*radius_ / dd_center;
+		double cos_max = sqrt(std::max(0., 1-sin2_max));
+		return (1+cos_max) / (2*PI * sin2_max);
+	}
+
+	Vector normal = is_sphere_ ? (q - origin_) / radius_ : normal_;
+	Vector direction = q - p;
+	double dd = direction.NormSquared();
+	double cosine = std::abs(normal|direction) / sqrt(dd);
+	if (dd == 0 || cosine < 1e-8) {
+		return 0;
+	}
+	return dd / (cosine*area_);
+}
+
+
+void AreaLights::Add(const Emitter &emitter) {
+	double power = emitter.Power();
+	if (power <= 0) {
+		return;
+	}
+	indices_[&emitter.Object()] = emitters_.size();
+	emitters_.push_back(emitter);
+	cumulated_power_.push_back(
+		(cumulated_power_.empty() ? 0 : cumulated_power_.back()) + power
+	);
+}
+
+
+AreaLights::AreaLights(const PrimitiveArrays &primitives) {
+	for (const auto &sphere : primitives.Spheres()) {
+		if (sphere.ObjectMaterial().IsEmissive() && sphere.Radius() > 0) {
+			Add(Emitter{sphere});
+		}
+	}
+	for (const auto &triangle : primitives.Triangles()) {
+		if (triangle.ObjectMaterial().IsEmissive()) {
+			Add(Emitter{triangle});
+		}
+	}
+	for (const auto &object : primitives.Others()) {
+		const Mesh *mesh = dynamic_cast<const Mesh*>(&object.Raw());
+		if (mesh == nullptr) {
+			continue;
+		}
+		for (size_t i=0; i<mesh->NbTriangles(); i++) {
+			const Triangle &triangle = mesh->TriangleAt(i);
+			if (triangle.ObjectMaterial().IsEmissive()) {
+				Add(Emitter{triangle});
+			}
+		}
+	}
+}
+
+
+bool AreaLights::Sample(
+	const Point &p, double u_emitter, double u, double v,
+	LightSample &sample
+) const {
+	if (emitters_.empty()) {
+		return false;
+	}
+	double total = cumulated_power_.back();
+	size_t i = std::upper_bound(
+		cumulated_power_.begin(), cumulated_power_.end(), u_emitter*total
+	) - cumulated_power_.begin();
+	i = std::min(i, emitters_.size()-1);
+	if (!emitters_[i].Sample(p, u, v, sample)) {
+		return false;
+	}
+	double power = cumulated_power_[i] - (i == 0 ? 0 : cumulated_power_[i-1]);
+	sample.pdf *= power / total;
+	return true;
+}
+
+
+double AreaLights::Pdf(
+	const Point &p, const RawObject &object, const Point &q
+) const {
+	auto it = indices_.find(&object);
+	if (it == indices_.end()) {
+		return 0;
+	}
+	size_t i = it->second;
+	double power = cumulated_power_[i] - (i == 0 ? 0 : cumulated_power_[i-1]);
+	return emitters_[i].Pdf(p, q) * power / cumulated_power_.back();
+}
@@ -0,0 +1,337 @@
+/**
+ * \file light.hpp
+ * \brief Defines the light sources of a scene: punctual lights with the
+ *        structures choosing among them, and area lights made of the
+ *        emissive spheres and triangles of the scene.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "object_container.hpp"
+
+
+/**
+ * \class Light
+ * \brief Represents a punctual light source.
+ */
+class Light {
+private:
+	const Point source_;      //!< Point which light comes from.
+	const Vector intensity_ ; //!< Colored intensity of the light.
+
+public:
+	/// Builds a Light from its punctual source and an intensity.
+	Light(
+		const Point &source,
+		const Vector &intensity
+	) :
+		source_{source},
+		intensity_{intensity}
+	{
+	}
+
+	/// Outputs the source point of the Light.
+	inline const Point& Source() const {
+		return source_;
+	}
+
+	/// Outputs the (R,G,B) intensity of the Light.
+	inline const Vector& Intensity() const {
+		return intensity_;
+	}
+};
+
+
+/**
+ * \class LightTree
+ * \brief Hierarchy of punctual lights, clustered by position, choosing one
+ *        light with a probability that estimates its contribution to a point.
+ *
+ * The tree is a binary BVH over the sources of the lights, split at the median
+ * of the largest axis. Each node stores the box bounding its lights and their
+ * total power. A light is chosen by descending from the root, following each
+ * child with a probability proportional to its power divided by its squared
+ * distance to the point, and zero if it lies entirely behind the surface. The
+ * cost of a choice is thus logarithmic in the number of lights.
+ */
+class LightTree {
+private:
+	/**
+	 * \struct Node
+	 * \brief Node of the tree, stored in depth-first order: the left child of
+	 *        an inner node follows it.
+	 */
+	struct Node {
+		Point min;  //!< Lower corner of the box bounding the lights.
+		Point max;  //!< Upper corner of the box bounding the lights.
+		double power = 0; //!< Total power of the lights, averaged on channels.
+		bool is_leaf = false; //!< Indicates if the node contains one light.
+
+		/// Index of the light of a leaf, or of the right child of an inner
+		/// node.
+		size_t index = 0;
+	};
+
+	std::vector<Node> nodes_; //!< Nodes of the tree, the root first.
+
+	/// Builds the subtree of the input lights, given by their indices.
+	void Build(
+		const std::vector<Light> &lights, std::vector<size_t>::iterator begin,
+		std::vector<size_t>::iterator end
+	);
+
+	/**
+	 * \fn double Importance(const Node &node, const Point &p, const Vector &normal, bool two_sided) const
+	 * \brief Estimates the contribution of the lights of a node to the input
+	 *        point.
+	 */
+	double Importance(
+		const Node &node, const Point &p, const Vector &normal, bool two_sided
+	) const;
+
+public:
+	/// Builds an empty tree.
+	LightTree() {}
+
+	/// Builds the tree of the input lights.
+	explicit LightTree(const std::vector<Light> &lights);
+
+	/// Indicates if the tree contains no light.
+	inline bool IsEmpty() const {
+		return nodes_.empty();
+	}
+
+	/**
+	 * \fn bool Sample(const Point &p, const Vector &normal, bool two_sided, double u, size_t &light, double &probability) const
+	 * \brief Chooses a light for the input point and normal.
+	 * \param two_sided If set to false, lights behind the surface are never
+	 *        chosen.
+	 * \param u Value of the sample, in [0,1).
+	 * \param light Index of the chosen light, in the input vector of the tree.
+	 * \param probability Probability with which the light was chosen.
+	 * \return false if no light can contribute to the point.
+	 */
+	bool Sample(
+		const Point &p, const Vector &normal, bool two_sided, double u,
+		size_t &light, double &probability
+	) const;
+};
+
+
+/**
+ * \class Reservoir
+ * \brief Weighted reservoir keeping one light out of a stream of candidates,
+ *        for resampled importance sampling.
+ *
+ * Each candidate comes with a weight, usually its target density (e.g. its
+ * unshadowed contribution) divided by the probability with which it was
+ * drawn, and the number of candidates it stands for. The reservoir keeps each
+ * candidate with a probability proportional to its weight, so that the kept
+ * light is distributed approximately according to the target density, and
+ * its contribution weighted by ContributionWeight is an estimate of the sum
+ * of the contributions of all lights. Lights kept by reservoirs of other
+ * shading points can be streamed as candidates too, with their contribution
+ * weight times their target density as weight, times a multiple importance
+ * sampling weight.
+ */
+class Reservoir {
+private:
+	size_t light_ = 0;       //!< Index of the kept light.
+	double target_ = 0;      //!< Target density of the kept light.
+	double weight_sum_ = 0;  //!< Sum of the weights of the candidates.
+	double count_ = 0;       //!< Number of candidates seen so far.
+
+	/// Weight of the contribution of the kept light, set by Finalize.
+	double contribution_weight_ = 0;
+
+	Point point_;   //!< Shading point of the reservoir, set by Finalize.
+	Vector normal_; //!< Normal at the shading point, set by Finalize.
+
+public:
+	/**
+	 * \fn void Update(size_t light, double weight, double target, double count, double &u)
+	 * \brief Streams a candidate into the reservoir.
+	 * \param target Target density of the light at the shading point.
+	 * \param count Number of candidates the light stands for.
+	 * \param u Value of the sample, in [0,1), rescaled after the decision so
+	 *        that it can be used for the next candidates.
+	 */
+	void Update(
+		size_t light, double weight, double target, double count, double &u
+	);
+
+	/**
+	 * \fn void Finalize(const Point &point, const Vector &normal, bool mis_weighted=false)
+	 * \brief Computes the weight of the contribution of the kept light, and
+	 *        records the shading point the reservoir was built for.
+	 * \param mis_weighted Indicates if the weights of the candidates include
+	 *        multiple importance sampling weights; otherwise, each candidate
+	 *        is given the same weight, the inverse of the count.
+	 */
+	void Finalize(
+		const Point &point, const Vector &normal, bool mis_weighted=false
+	);
+
+	/// Outputs the index of the kept light.
+	inline size_t Light() const {
+		return light_;
+	}
+
+	/// Outputs the number of candidates seen by the reservoir.
+	inline double Count() const {
+		return count_;
+	}
+
+	/// Outputs the weight by which the contribution of the kept light must be
+	/// multiplied.
+	inline double ContributionWeight() const {
+		return contribution_weight_;
+	}
+
+	/// Outputs the shading point the reservoir was built for.
+	inline const Point& ShadingPoint() const {
+		return point_;
+	}
+
+	/// Outputs the normal at the shading point of the reservoir.
+	inline const Vector& ShadingNormal() const {
+		return normal_;
+	}
+};
+
+
+/**
+ * \struct LightSample
+ * \brief Point sampled on an area light, as seen from a shading point.
+ */
+struct LightSample {
+	Vector direction;    //!< Normalized direction towards the sampled point.
+	double distance = 0; //!< Distance to the sampled point.
+	Vector radiance;     //!< Radiance emitted towards the shading point.
+
+	/// Density of the direction with respect to solid angle, including the
+	/// choice of the emitter.
+	double pdf = 0;
+
+	/// Object of the scene containing the sampled point.
+	const RawObject *object = nullptr;
+};
+
+
+/**
+ * \class Emitter
+ * \brief Emissive sphere or triangle, emitting the radiance of its material
+ *        on both sides.
+ *
+ * Triangles are sampled uniformly by area. Spheres are sampled uniformly in
+ * the cone of directions they subtend from the shading point, so that no
+ * sample falls on their hidden side, or uniformly by area from inside.
+ */
+class Emitter {
+private:
+	const RawObject *object_; //!< Object of the scene emitting the light.
+	bool is_sphere_;          //!< Indicates if the emitter is a sphere.
+	Point origin_;   //!< Center of the sphere, or first vertex of the triangle.
+	Vector edge1_;   //!< First edge of the triangle.
+	Vector edge2_;   //!< Second edge of the triangle.
+	Vector normal_;  //!< Normalized normal of the triangle.
+	double radius_;  //!< Radius of the sphere.
+	double area_;    //!< Area of the surface.
+	Vector radiance_; //!< Emitted radiance.
+
+public:
+	/// Builds the emitter of an emissive Sphere of the scene.
+	explicit Emitter(const Sphere &sphere);
+
+	/// Builds the emitter of an emissive Triangle of the scene.
+	explicit Emitter(const Triangle &triangle);
+
+	/// Outputs the object of the scene emitting the light.
+	inline const RawObject& Object() const {
+		return *object_;
+	}
+
+	/// Outputs the power emitted by one side of the surface, averaged on the
+	/// channels, which weights the choice of the emitter.
+	inline double Power() const {
+		return PI * area_ * (radiance_.x() + radiance_.y() + radiance_.z()) / 3;
+	}
+
+	/**
+	 * \fn bool Sample(const Point &p, double u, double v, LightSample &sample) const
+	 * \brief Samples a point of the emitter seen from the input point.
+	 * \param u, v Values of the sample, in (0,1).
+	 * \param sample Output sample, whose pdf only accounts for the choice of
+	 *        the point.
+	 * \return false if no point could be sampled (e.g. degenerate geometry).
+	 */
+	bool Sample(const Point &p, double u, double v, LightSample &sample) const;
+
+	/**
+	 * \fn double Pdf(const Point &p, const Point &q) const
+	 * \brief Outputs the density, with respect to solid angle at p, with which
+	 *        Sample chooses the point q of the emitter.
+	 */
+	double Pdf(const Point &p, const Point &q) const;
+};
+
+
+/**
+ * \class AreaLights
+ * \brief Emitters of a scene, chosen with a probability proportional to their
+ *        power.
+ */
+class AreaLights {
+private:
+	std::vector<Emitter> emitters_; //!< Emissive surfaces of the scene.
+
+	/// Cumulated power of the emitters, up to each of them included.
+	std::vector<double> cumulated_power_;
+
+	/// Index of the emitter of each emissive object of the scene.
+	std::unordered_map<const RawObject*, size_t> indices_;
+
+	/// Adds an emitter.
+	void Add(const Emitter &emitter);
+
+public:
+	/// Builds an empty set of area lights.
+	AreaLights() {}
+
+	/**
+	 * \fn AreaLights(const PrimitiveArrays &primitives)
+	 * \brief Gathers the emissive spheres and triangles of the input objects,
+	 *        including the triangles of meshes.
+	 *
+	 * Other objects (planes, instances of meshes, compressed meshes...) can
+	 * still emit light, but are only found by the rays that hit them.
+	 */
+	explicit AreaLights(const PrimitiveArrays &primitives);
+
+	/// Indicates if the scene contains no area light.
+	inline bool IsEmpty() const {
+		return emitters_.empty();
+	}
+
+	/**
+	 * \fn bool Sample(const Point &p, double u_emitter, double u, double v, LightSample &sample) const
+	 * \brief Chooses an emitter according to its power, then a point on it.
+	 * \param u_emitter, u, v Values of the sample, in (0,1).
+	 * \return false if no point was sampled.
+	 */
+	bool Sample(
+		const Point &p, double u_emitter, double u, double v,
+		LightSample &sample
+	) const;
+
+	/**
+	 * \fn double Pdf(const Point &p, const RawObject &object, const Point &q) const
+	 * \brief Outputs the density with which Sample chooses the point q of the
+	 *        input object from p, with respect to solid angle, or 0 if the
+	 *        object is not an emitter.
+	 */
+	double Pdf(const Point &p, const RawObject &object, const Point &q) const;
+};
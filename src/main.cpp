@@ -1,5 +1,59 @@
+#include <chrono>
+#include <limits>
+#include <string>
 #include "scene.hpp"
 #include "mesh.hpp"
+#include "streamed_mesh.hpp"
+
+
+/**
+ * \fn static double RenderTwice(Scene &scene, unsigned int nb_samples, double &noise)
+ * \brief Renders the scene twice with the selected integrator and different
+ *        seeds, and estimates the noise of one render from the difference
+ *        between both.
+ * \param noise Output root mean square error of one render, in [0,1].
+ * \return The mean duration of one render, in seconds.
+ */
+static double RenderTwice(Scene &scene, unsigned int nb_samples, double &noise) {
+	std::vector<unsigned char> images[2];
+	double duration = 0;
+	for (int k=0; k<2; k++) {
+		scene.SetSeed(k);
+		auto start = std::chrono::steady_clock::now();
+		scene.Render(10, nb_samples, true, false);
+		duration += std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		images[k] = scene.Image();
+	}
+	// Both renders are independent, so that their difference has twice the
+	// variance of one render
+	double squares = 0;
+	for (size_t i=0; i<images[0].size(); i++) {
+		double difference = images[0][i] - images[1][i];
+		squares += difference*difference;
+	}
+	noise = sqrt(squares / (2*images[0].size())) / 255;
+	return duration / 2;
+}
+
+
+/**
+ * \fn static Scene SceneFromAbove(const std::shared_ptr<const ObjectContainer> &objects, const AABB &box)
+ * \brief Builds a Scene of the input objects, seen from above their bounding
+ *        box and lit by a Light next to the Camera.
+ */
+static Scene SceneFromAbove(
+	const std::shared_ptr<const ObjectContainer> &objects, const AABB &box
+) {
+	double size = std::max(box.XMinMax().second - box.XMinMax().first,
+		box.YMinMax().second - box.YMinMax().first);
+	Point eye = box.Centroid() + Vector(0, 0, size);
+	Scene scene(Camera(eye, Vector(0,0,-1), Vector(0,1,0), 60*PI/180, 500,
+		500), objects);
+	scene.AddLight(Light(eye + Vector(size, 0, 0),
+		Vector(1, 1, 1)*size*size*10));
+	return scene;
+}
 
 
 int main(int argc, char **argv) {
@@ -59,6 +113,171 @@ int main(int argc, char **argv) {
 	Camera camera(Point(-1,0,0), Vector(1,0,0), Vector(0,0,1), 60*PI/180, 1000, 1000);
 	Scene scene(camera, objects);
 	scene.AddLight(Light(Point(-2, -1, 2), Vector(50, 50, 50)));
+
+	if (argc > 1 && std::string(argv[1]) == "compare") {
+		// Equal-time comparison of the integrators: the iterative one gets as
+		// many samples as fit in the time of the recursive one
+		double noise;
+		scene.SetIntegrator(Integrator::kRecursive);
+		double budget = RenderTwice(scene, 50, noise);
+		std::cout << "Recursive: 50 samples, " << budget << " s, noise "
+			<< noise << std::endl;
+
+		scene.SetIntegrator(Integrator::kIterative);
+		auto start = std::chrono::steady_clock::now();
+		scene.Render(10, 4, true, false);
+		double duration = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		unsigned int nb_samples =
+			std::max(1u, static_cast<unsigned int>(4*budget/duration));
+		duration = RenderTwice(scene, nb_samples, noise);
+		std::cout << "Iterative: " << nb_samples << " samples, " << duration
+			<< " s, noise " << noise << std::endl;
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "samplers") {
+		// Noise of each sampler at equal number of samples
+		typedef std::shared_ptr<const Sampler> SamplerPtr;
+		const std::pair<std::string, SamplerPtr> samplers[] = {
+			{"Independent", std::make_shared<IndependentSampler>()},
+			{"Sobol", std::make_shared<SobolSampler>()},
+			{"Halton", std::make_shared<HaltonSampler>()},
+			{"Blue noise", std::make_shared<BlueNoiseSampler>()}
+		};
+		scene.SetIntegrator(Integrator::kIterative);
+		for (const auto &sampler : samplers) {
+			double noise;
+			scene.SetSampler(sampler.second);
+			RenderTwice(scene, 16, noise);
+			std::cout << sampler.first << ": 16 samples, noise " << noise
+				<< std::endl;
+		}
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "adaptive") {
+		// Adaptive sampling, with the map of the samples of each pixel
+		scene.SetIntegrator(Integrator::kIterative);
+		scene.RenderAdaptive(10, AdaptiveOptions{}, true, true);
+		scene.Save("test.bmp");
+		scene.SaveSampleCounts("samples.bmp");
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "progressive") {
+		// Progressive render for at most a minute, saved every five seconds
+		ProgressiveOptions options;
+		options.max_samples = 1024;
+		options.time_limit = 60;
+		options.flush_interval = 5;
+		options.flush_filename = "test.bmp";
+		scene.SetIntegrator(Integrator::kIterative);
+		unsigned int nb_passes = scene.RenderProgressive(10, options, true, true);
+		std::cout << nb_passes << " samples per pixel" << std::endl;
+		return 0;
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "import") {
+		// Parsing speed of an .obj file with Assimp and with the native loader
+		std::string filename = argv[2];
+		std::string folder =
+			filename.substr(0, filename.find_last_of('/') + 1);
+		for (bool native : {false, true}) {
+			MeshOptions options;
+			options.native_obj = native;
+			std::cout << (native ? "Native: " : "Assimp: ");
+			try {
+				Mesh mesh(filename, folder, white, options);
+				std::cout << mesh.NbTriangles() << " triangles, "
+					<< mesh.ImportThroughput() << " MB/s" << std::endl;
+			} catch (const std::runtime_error &error) {
+				std::cout << error.what() << std::endl;
+			}
+		}
+		return 0;
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "wavefront") {
+		// Render time of the iterative and wavefront integrators on the BVH of
+		// the triangles of an .obj file, seen from above; both follow the same
+		// paths, so that their images must be identical
+		std::string filename = argv[2];
+		MeshOptions options;
+		options.native_obj = true;
+		Material grey = Material(Vector(0.8,0.8,0.8), Vector(1,1,1),
+			Vector(1,1,1), 1, 1);
+		Mesh mesh(filename, filename.substr(0, filename.find_last_of('/') + 1),
+			grey, options);
+		std::vector<Triangle> triangles;
+		for (size_t i=0; i<mesh.NbTriangles(); i++) {
+			triangles.push_back(mesh.TriangleAt(i));
+		}
+		Scene mesh_scene = SceneFromAbove(
+			std::make_shared<BVH>(std::move(triangles)), mesh.BoundingBox()
+		);
+
+		// Best of three interleaved renders of each integrator
+		const Integrator integrators[2] = {
+			Integrator::kIterative, Integrator::kWavefront
+		};
+		double durations[2] = {
+			std::numeric_limits<double>::infinity(),
+			std::numeric_limits<double>::infinity()
+		};
+		std::vector<unsigned char> images[2];
+		for (int k=0; k<6; k++) {
+			mesh_scene.SetIntegrator(integrators[k%2]);
+			auto start = std::chrono::steady_clock::now();
+			mesh_scene.Render(10, 4, true, false);
+			durations[k%2] = std::min(durations[k%2],
+				std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count());
+			images[k%2] = mesh_scene.Image();
+		}
+		std::cout << "Iterative: " << durations[0] << " s" << std::endl;
+		std::cout << "Wavefront: " << durations[1] << " s, "
+			<< (images[0] == images[1] ? "same" : "different") << " image"
+			<< std::endl;
+		return 0;
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "streamed") {
+		// StreamedMesh of an .obj file rendered under a cache budget (in MB,
+		// 16 by default) by both integrators, with the clusters they read
+		std::string filename = argv[2];
+		size_t budget = argc > 3 ? std::stoul(argv[3]) : 16;
+		Material grey = Material(Vector(0.8,0.8,0.8), Vector(1,1,1),
+			Vector(1,1,1), 1, 1);
+		std::shared_ptr<const StreamedMesh> mesh =
+			std::make_shared<StreamedMesh>(filename,
+				filename.substr(0, filename.find_last_of('/') + 1), grey);
+		Scene mesh_scene = SceneFromAbove(mesh, mesh->BoundingBox());
+		GeometryCache &cache = GeometryCache::Instance();
+		cache.SetMemoryBudget(budget << 20);
+		std::cout << mesh->NbTriangles() << " triangles in "
+			<< mesh->NbClusters() << " clusters, budget " << budget << " MB"
+			<< std::endl;
+
+		std::vector<unsigned char> images[2];
+		for (int k=0; k<2; k++) {
+			mesh_scene.SetIntegrator(
+				k == 0 ? Integrator::kIterative : Integrator::kWavefront);
+			cache.Clear();
+			auto start = std::chrono::steady_clock::now();
+			mesh_scene.Render(10, 1, true, false);
+			double duration = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+			images[k] = mesh_scene.Image();
+			std::cout << (k == 0 ? "Iterative: " : "Wavefront: ") << duration
+				<< " s, " << cache.Misses() << " clusters read, "
+				<< cache.Hits() << " hits" << std::endl;
+		}
+		std::cout << (images[0] == images[1] ? "Same" : "Different")
+			<< " image" << std::endl;
+		return 0;
+	}
+
 	scene.Render(10, 50, true, false);
 	scene.Save("test.bmp");
 	return 0;
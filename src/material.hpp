@@ -43,6 +43,9 @@ private:
 	/// Refractive index of the Material.
 	double index_ = 1;
 
+	/// Radiance emitted by the Material, on both sides of the surface.
+	Vector emission_ = Vector{0, 0, 0};
+
 public:
 	/// Constructs a Material from the set of its defining fields.
 	Material(
@@ -54,7 +57,8 @@ public:
 		double specular_coefficient=30,
 		double fraction_specular=0,
 		bool refractive=true,
-		double refractive_index=1
+		double refractive_index=1,
+		const Vector &emission=Vector{0, 0, 0}
 	) :
 		color_diffuse_{color_diffuse},
 		color_specular_{color_specular},
@@ -64,7 +68,8 @@ public:
 		specular_coefficient_{specular_coefficient},
 		fraction_specular_{fraction_specular},
 		refractive_{refractive},
-		index_{refractive_index}
+		index_{refractive_index},
+		emission_{emission}
 	{
 	}
 
@@ -113,4 +118,14 @@ public:
 	inline double RefractiveIndex() const {
 		return index_;
 	}
+
+	/// Outputs the radiance emitted by the Material.
+	inline const Vector& Emission() const {
+		return emission_;
+	}
+
+	/// Indicates if the Material emits light.
+	inline bool IsEmissive() const {
+		return emission_.x() > 0 || emission_.y() > 0 || emission_.z() > 0;
+	}
 };
@@ -3,23 +3,125 @@
  * \brief Implements methods of class Mesh.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/config.h>
 #include <assimp/material.h>
 #include "mesh.hpp"
+#include "obj_loader.hpp"
+#include "scene.hpp"
+#include "texture_cache.hpp"
 
 
 Object::Object(Mesh &mesh) :
-	raw_object_{new Mesh{mesh}}
+	raw_object_{new Mesh{mesh}},
+	type_{PrimitiveType::kOther}
 {
 }
 
 
+ObjSurfaces::ObjSurfaces(
+	const std::vector<ObjMaterial> &obj_materials,
+	const std::string &folder,
+	const Material &material
+) {
+	for (const auto &m : obj_materials) {
+		materials.emplace_back(
+			m.has_diffuse ? m.diffuse : material.DiffuseColor(),
+			m.has_specular ? m.specular : material.SpecularColor(),
+			m.has_transparent ? m.transparent : material.TransparentColor(),
+			m.has_opacity ? m.opacity : material.Opacity(),
+			material.FractionDiffuseBRDF(),
+			m.has_shininess ? m.shininess : material.SpecularCoefficient(),
+			material.FractionSpecular(),
+			material.Refraction(),
+			m.has_index ? m.index : material.RefractiveIndex(),
+			m.has_emission ? m.emission : material.Emission()
+		);
+		diffuse_textures.emplace_back();
+		if (!m.diffuse_map.empty()) {
+			std::string fullpath = folder + m.diffuse_map;
+			diffuse_textures.back() =
+				TextureCache::Instance().Load(fullpath, true);
+		}
+		specular_textures.emplace_back();
+		if (!m.specular_map.empty()) {
+			std::string fullpath = folder + m.specular_map;
+			specular_textures.back() = TextureCache::Instance().Load(fullpath);
+		}
+	}
+
+	// Triangles without material use the default one, without texture
+	materials.push_back(material);
+	diffuse_textures.emplace_back();
+	specular_textures.emplace_back();
+}
+
+
+Triangle ObjSurfaces::MakeTriangle(const ObjTriangle &triangle) const {
+	const float *p = triangle.positions;
+	const float *n = triangle.normals;
+	const float *uv = triangle.uvs;
+	size_t m = triangle.material == ObjData::kNone ?
+		materials.size()-1 : triangle.material;
+	return Triangle(
+		Point{p[0], p[1], p[2]}, Point{p[3], p[4], p[5]},
+		Point{p[6], p[7], p[8]}, Vector{n[0], n[1], n[2]},
+		Vector{n[3], n[4], n[5]}, Vector{n[6], n[7], n[8]},
+		diffuse_textures[m], specular_textures[m],
+		triangle.material != ObjData::kNone && triangle.has_uv,
+		uv[0], uv[1], uv[2], uv[3], uv[4], uv[5], materials[m]
+	);
+}
+
+
+/**
+ * \fn static double Throughput(const std::string &filename, std::chrono::steady_clock::time_point start)
+ * \brief Outputs the speed at which the input file was parsed since start, in
+ *        MB/s, or 0 if it cannot be measured.
+ */
+static double Throughput(
+	const std::string &filename, std::chrono::steady_clock::time_point start
+) {
+	std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	double megabytes = static_cast<double>(file.tellg()) / (1 << 20);
+	if (duration.count() > 0 && megabytes > 0) {
+		return megabytes / duration.count();
+	}
+	return 0;
+}
+
+
+Mesh::Mesh(
+	const std::string &filename,
+	const std::string &folder,
+	const Material &material,
+	const MeshOptions &options
+) :
+	RawObject{material, false}
+{
+	std::string extension = filename.substr(filename.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+		::tolower);
+	if (options.native_obj && extension == "obj") {
+		ImportOBJ(filename, folder, material, options);
+	} else {
+		Import(filename, folder, material, options);
+	}
+}
+
+
 void Mesh::Import(
 	const std::string &filename, const std::string &folder,
-	const Material &material
+	const Material &material, const MeshOptions &options
 ) {
 	Assimp::Importer importer;
 
@@ -66,37 +168,37 @@ void Mesh::Import(
 	;
 
 	// Finally imports the mesh
+	auto start = std::chrono::steady_clock::now();
 	const aiScene *scene = importer.ReadFile(filename, post_processing);
 	if (!scene) {
 		throw std::runtime_error(importer.GetErrorString());
 	}
+	import_throughput_ = Throughput(filename, start);
 
-	std::vector<Object> triangles;
-	// Inspects all faces of all meshes
+	// Builds the materials of all meshes
+	std::vector<Material> materials;
+	std::vector<std::shared_ptr<const Texture>>
+		diffuse_textures, specular_textures;
 	for (unsigned int i=0; i<scene->mNumMeshes; i++) {
 		const aiMesh *mesh = scene->mMeshes[i];
 		const aiMaterial *ai_material = scene->mMaterials[mesh->mMaterialIndex];
 
 		// Loads diffuse texture (only the main texture)
-		std::shared_ptr<cimg_library::CImg<unsigned char>> diffuse_texture;
+		std::shared_ptr<const Texture> diffuse_texture;
 		if (ai_material->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
             aiString filename;
 			ai_material->GetTexture(aiTextureType_DIFFUSE, 0, &filename);
 			std::string fullpath = folder + std::string(filename.C_Str());
-			diffuse_texture.reset(
-				new cimg_library::CImg<unsigned char>(fullpath.c_str())
-			);
+			diffuse_texture = TextureCache::Instance().Load(fullpath, true);
 		}
 
 		// Loads specular texture (only the main texture)
-		std::shared_ptr<cimg_library::CImg<unsigned char>> specular_texture;
+		std::shared_ptr<const Texture> specular_texture;
 		if (ai_material->GetTextureCount(aiTextureType_SPECULAR) > 0) {
             aiString filename;
 			ai_material->GetTexture(aiTextureType_SPECULAR, 0, &filename);
 			std::string fullpath = folder + std::string(filename.C_Str());
-			specular_texture.reset(
-				new cimg_library::CImg<unsigned char>(fullpath.c_str())
-			);
+			specular_texture = TextureCache::Instance().Load(fullpath);
 		}
 
 		// Builds the material of the imported model
@@ -136,7 +238,16 @@ void Mesh::Import(
 		ai_material->Get(AI_MATKEY_SHININESS_STRENGTH, fraction_specular);
 		float index = material.RefractiveIndex();
 		ai_material->Get(AI_MATKEY_REFRACTI, index);
-		Material imported_material{
+		aiColor3D ai_color_emission{
+			static_cast<float>(material.Emission().x()),
+			static_cast<float>(material.Emission().y()),
+			static_cast<float>(material.Emission().z())
+		};
+		ai_material->Get(AI_MATKEY_COLOR_EMISSIVE, ai_color_emission);
+		Vector color_emission{
+			ai_color_emission.r, ai_color_emission.g, ai_color_emission.b
+		};
+		materials.push_back(Material{
 			color_diffuse,
 			color_specular,
 			color_transparent,
@@ -145,84 +256,407 @@ void Mesh::Import(
 			specular_coefficient,
 			fraction_specular,
 			material.Refraction(),
-			index
-		};
+			index,
+			color_emission
+		});
+		diffuse_textures.push_back(diffuse_texture);
+		specular_textures.push_back(specular_texture);
+	}
 
-		// Adds all faces of the mesh in the set of triangles
+	// Gathers the vertex indices of the faces of all meshes
+	size_t nb_faces = 0;
+	std::vector<std::vector<unsigned int>> faces(scene->mNumMeshes);
+	for (unsigned int i=0; i<scene->mNumMeshes; i++) {
+		const aiMesh *mesh = scene->mMeshes[i];
+		faces[i].resize(3*mesh->mNumFaces);
 		for (unsigned int j=0; j<mesh->mNumFaces; j++) {
-			// The considered face is a triangle
-			const unsigned int id_p1 = mesh->mFaces[j].mIndices[0];
-			const unsigned int id_p2 = mesh->mFaces[j].mIndices[1];
-			const unsigned int id_p3 = mesh->mFaces[j].mIndices[2];
-
-			// Points
-			Point p1{
-				mesh->mVertices[id_p1][0],
-				mesh->mVertices[id_p1][1],
-				mesh->mVertices[id_p1][2]
-			};
-			Point p2{
-				mesh->mVertices[id_p2][0],
-				mesh->mVertices[id_p2][1],
-				mesh->mVertices[id_p2][2]
-			};
-			Point p3{
-				mesh->mVertices[id_p3][0],
-				mesh->mVertices[id_p3][1],
-				mesh->mVertices[id_p3][2]
-			};
-
-			// Normals
-			Vector n1{
-				mesh->mNormals[id_p1][0],
-				mesh->mNormals[id_p1][1],
-				mesh->mNormals[id_p1][2]
-			};
-			Vector n2{
-				mesh->mNormals[id_p2][0],
-				mesh->mNormals[id_p2][1],
-				mesh->mNormals[id_p2][2]
-			};
-			Vector n3{
-				mesh->mNormals[id_p3][0],
-				mesh->mNormals[id_p3][1],
-				mesh->mNormals[id_p3][2]
-			};
-
-			// Face textures
-			float u1, v1, u2, v2, u3, v3;
-			double has_uv_coordinates = false;
-			if (mesh->HasTextureCoords(0)) {
-				u1 = mesh->mTextureCoords[0][id_p1].x;
-				v1 = mesh->mTextureCoords[0][id_p1].y;
-				u2 = mesh->mTextureCoords[0][id_p2].x;
-				v2 = mesh->mTextureCoords[0][id_p2].y;
-				u3 = mesh->mTextureCoords[0][id_p3].x;
-				v3 = mesh->mTextureCoords[0][id_p3].y;
-				if (!(u1 < 0 || u2 < 0 || u3 < 0 || v1 < 0 || v2 < 0 || v3 < 0))
-				has_uv_coordinates = true;
+			for (int k=0; k<3; k++) {
+				faces[i][3*j+k] = mesh->mFaces[j].mIndices[k];
 			}
+		}
+		nb_faces += mesh->mNumFaces;
+	}
 
-			triangles.emplace_back(
-				Triangle(p1, p2, p3, n1, n2, n3, diffuse_texture,
-					specular_texture, has_uv_coordinates, u1, v1, u2, v2, u3,
-					v3, imported_material)
-			);
+	// Simplifies the faces of each mesh, with a share of the target
+	// proportional to its number of faces
+	auto decimate = [&](const DecimationOptions &decimation) {
+		size_t nb_decimated = 0;
+		for (unsigned int i=0; i<scene->mNumMeshes; i++) {
+			const aiMesh *mesh = scene->mMeshes[i];
+			DecimationOptions share = decimation;
+			if (decimation.target_triangles > 0) {
+				share.target_triangles = std::max<size_t>(
+					1, decimation.target_triangles * (faces[i].size()/3)
+						/ nb_faces
+				);
+			}
+			std::vector<float> positions(3*mesh->mNumVertices);
+			std::vector<float> normals, uvs;
+			for (unsigned int v=0; v<mesh->mNumVertices; v++) {
+				for (int k=0; k<3; k++) {
+					positions[3*v+k] = mesh->mVertices[v][k];
+				}
+				if (mesh->HasNormals()) {
+					for (int k=0; k<3; k++) {
+						normals.push_back(mesh->mNormals[v][k]);
+					}
+				}
+				if (mesh->HasTextureCoords(0)) {
+					uvs.push_back(mesh->mTextureCoords[0][v].x);
+					uvs.push_back(mesh->mTextureCoords[0][v].y);
+				}
+			}
+			Decimate(positions, normals, uvs, faces[i], {}, share);
+			nb_decimated += faces[i].size()/3;
 		}
+		nb_faces = nb_decimated;
+	};
+	if (options.decimation.IsEnabled()) {
+		decimate(options.decimation);
 	}
 
-	// Builds the corresponding BVH
-	triangles_.reset(new BVH(triangles.begin(), triangles.end()));
+	for (unsigned int level=0; level<std::max(options.nb_levels, 1u); level++) {
+		if (level > 0) {
+			DecimationOptions coarser;
+			coarser.target_triangles = std::max<size_t>(
+				1, nb_faces * options.level_ratio
+			);
+			decimate(coarser);
+		}
+
+		// Position of the first triangle of each mesh in the output array
+		std::vector<size_t> offsets{0};
+		for (unsigned int i=0; i<scene->mNumMeshes; i++) {
+			offsets.push_back(offsets.back() + faces[i].size()/3);
+		}
+
+		// Splits the faces of all meshes into ranges of bounded size
+		const unsigned int range_size = 4096;
+		std::vector<std::pair<unsigned int, unsigned int>> ranges;
+		for (unsigned int i=0; i<scene->mNumMeshes; i++) {
+			for (unsigned int j=0; j<faces[i].size()/3; j+=range_size) {
+				ranges.push_back({i, j});
+			}
+		}
+
+		// Builds the triangles of all ranges in parallel, in preallocated
+		// storage
+		std::vector<Triangle> triangles(offsets.back());
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (size_t r=0; r<ranges.size(); r++) {
+			const unsigned int i = ranges[r].first;
+			const aiMesh *mesh = scene->mMeshes[i];
+			const unsigned int last = std::min<unsigned int>(
+				ranges[r].second + range_size, faces[i].size()/3
+			);
+			for (unsigned int j=ranges[r].second; j<last; j++) {
+				// The considered face is a triangle
+				const unsigned int id_p1 = faces[i][3*j];
+				const unsigned int id_p2 = faces[i][3*j+1];
+				const unsigned int id_p3 = faces[i][3*j+2];
+
+				// Points
+				Point p1{
+					mesh->mVertices[id_p1][0],
+					mesh->mVertices[id_p1][1],
+					mesh->mVertices[id_p1][2]
+				};
+				Point p2{
+					mesh->mVertices[id_p2][0],
+					mesh->mVertices[id_p2][1],
+					mesh->mVertices[id_p2][2]
+				};
+				Point p3{
+					mesh->mVertices[id_p3][0],
+					mesh->mVertices[id_p3][1],
+					mesh->mVertices[id_p3][2]
+				};
+
+				// Normals
+				Vector n1{
+					mesh->mNormals[id_p1][0],
+					mesh->mNormals[id_p1][1],
+					mesh->mNormals[id_p1][2]
+				};
+				Vector n2{
+					mesh->mNormals[id_p2][0],
+					mesh->mNormals[id_p2][1],
+					mesh->mNormals[id_p2][2]
+				};
+				Vector n3{
+					mesh->mNormals[id_p3][0],
+					mesh->mNormals[id_p3][1],
+					mesh->mNormals[id_p3][2]
+				};
+
+				// Face textures
+				float u1, v1, u2, v2, u3, v3;
+				double has_uv_coordinates = false;
+				if (mesh->HasTextureCoords(0)) {
+					u1 = mesh->mTextureCoords[0][id_p1].x;
+					v1 = mesh->mTextureCoords[0][id_p1].y;
+					u2 = mesh->mTextureCoords[0][id_p2].x;
+					v2 = mesh->mTextureCoords[0][id_p2].y;
+					u3 = mesh->mTextureCoords[0][id_p3].x;
+					v3 = mesh->mTextureCoords[0][id_p3].y;
+					if (!(u1 < 0 || u2 < 0 || u3 < 0 || v1 < 0 || v2 < 0 || v3 < 0))
+					has_uv_coordinates = true;
+				}
+
+				triangles[offsets[i] + j] = Triangle(
+					p1, p2, p3, n1, n2, n3, diffuse_textures[i],
+					specular_textures[i], has_uv_coordinates, u1, v1, u2, v2, u3,
+					v3, materials[i]
+				);
+			}
+		}
+
+		// Builds the BVH of the level
+		AddLevel(std::move(triangles));
+	}
 
 	// The generated aiScene is deleted by the library
 }
 
 
+void Mesh::ImportOBJ(
+	const std::string &filename, const std::string &folder,
+	const Material &material, const MeshOptions &options
+) {
+	auto start = std::chrono::steady_clock::now();
+	ObjData data = LoadOBJ(filename, true, true);
+	import_throughput_ = Throughput(filename, start);
+	DecimateOBJ(data, options.decimation);
+	ObjSurfaces surfaces{data.materials, folder, material};
+
+	for (unsigned int level=0; level<std::max(options.nb_levels, 1u); level++) {
+		if (level > 0) {
+			DecimationOptions coarser;
+			coarser.target_triangles = std::max<size_t>(
+				1, data.NbTriangles() * options.level_ratio
+			);
+			DecimateOBJ(data, coarser);
+		}
+
+		// Builds the triangles in parallel, in preallocated storage, marking
+		// the invalid ones
+		std::vector<Triangle> triangles(data.NbTriangles());
+		std::vector<char> is_valid(data.NbTriangles(), false);
+		#pragma omp parallel for schedule(dynamic, 4096)
+		for (size_t j=0; j<data.NbTriangles(); j++) {
+			ObjTriangle triangle;
+			if (data.ExtractTriangle(j, triangle)) {
+				triangles[j] = surfaces.MakeTriangle(triangle);
+				is_valid[j] = true;
+			}
+		}
+
+		// Removes the invalid triangles
+		size_t nb_valid = 0;
+		for (size_t j=0; j<triangles.size(); j++) {
+			if (is_valid[j]) {
+				if (nb_valid != j) {
+					triangles[nb_valid] = std::move(triangles[j]);
+				}
+				nb_valid++;
+			}
+		}
+		triangles.resize(nb_valid);
+
+		// Builds the BVH of the level
+		AddLevel(std::move(triangles));
+	}
+}
+
+
+void Mesh::AddLevel(std::vector<Triangle> &&triangles) {
+	// Typical edge length: side of a right isosceles triangle of mean area
+	double area = 0;
+	#pragma omp parallel for reduction(+:area)
+	for (size_t i=0; i<triangles.size(); i++) {
+		area += triangles[i].Area();
+	}
+	feature_sizes_.push_back(
+		triangles.empty() ? 0 : std::sqrt(2*area/triangles.size())
+	);
+	levels_.emplace_back(new BVH(std::move(triangles)));
+}
+
+
+unsigned int Mesh::SelectLevel(double footprint) const {
+	unsigned int level = 0;
+	while (level+1 < levels_.size() && feature_sizes_[level+1] <= footprint) {
+		level++;
+	}
+	return level;
+}
+
+
 Vector Mesh::Normal(const Point &p) const {
 	return Vector{0, 0, 1};
 }
 
 
 AABB Mesh::BoundingBox() const {
-	return triangles_->BoundingBox();
+	return levels_[0]->BoundingBox();
+}
+
+
+Ray MeshInstance::ToMesh(const Ray &r, double &scale) const {
+	Vector direction = world_to_mesh_.ApplyToVector(r.Direction());
+	scale = direction.Norm();
+	return Ray{world_to_mesh_.ApplyToPoint(r.Origin()), direction};
+}
+
+
+unsigned int MeshInstance::RayLevel(
+	const Ray &r,
+	const Ray &mesh_ray,
+	double scale
+) const {
+	// Rays leaving the instance intersect the level of the surface they leave,
+	// which keeps them from hitting another level right at their origin
+	if (r.Source() == this) {
+		return r.SourcePrimitive() >> kLevelShift;
+	}
+	if (!r.HasDifferentials()) {
+		return level_;
+	}
+	double entry = mesh_->BoundingBox().EntryDistance(mesh_ray);
+	if (entry == std::numeric_limits<double>::infinity()) {
+		return level_;
+	}
+
+	// Footprint of the Ray at the entry point, along the sharper image axis
+	double t = entry / scale;
+	double footprint = std::min(
+		(r.OriginDx() + t*r.DirectionDx()).Norm(),
+		(r.OriginDy() + t*r.DirectionDy()).Norm()
+	);
+	return mesh_->SelectLevel(footprint * scale);
+}
+
+
+void MeshInstance::SelectLevel(const Camera &camera) {
+	// Distance from the Camera to the closest point of the bounding box
+	AABB box = BoundingBox();
+	const Point &eye = camera.Origin();
+	std::pair<double, double> x = box.XMinMax();
+	std::pair<double, double> y = box.YMinMax();
+	std::pair<double, double> z = box.ZMinMax();
+	Vector gap{
+		std::max({x.first - eye.x(), 0., eye.x() - x.second}),
+		std::max({y.first - eye.y(), 0., eye.y() - y.second}),
+		std::max({z.first - eye.z(), 0., eye.z() - z.second})
+	};
+
+	// Lengths in the scene are scaled by the mean scale of the Transform in
+	// the space of the Mesh
+	double scale = (
+		world_to_mesh_.ApplyToVector(Vector{1, 0, 0}).Norm()
+		+ world_to_mesh_.ApplyToVector(Vector{0, 1, 0}).Norm()
+		+ world_to_mesh_.ApplyToVector(Vector{0, 0, 1}).Norm()
+	) / 3;
+	level_ = mesh_->SelectLevel(gap.Norm() * camera.PixelAngle() * scale);
+}
+
+
+Intersection MeshInstance::Intersect(const Ray &r) const {
+	double scale;
+	Ray mesh_ray = ToMesh(r, scale);
+	unsigned int level = per_ray_level_ ?
+		RayLevel(r, mesh_ray, scale) : level_;
+	Intersection inter = mesh_->Intersect(mesh_ray, level);
+	if (inter.IsEmpty()) {
+		return Intersection{*this};
+	}
+	// Distances along the transformed ray are scaled by the Transform
+	return Intersection{
+		inter.Distance() / scale, inter.IsOut(), inter.U(), inter.V(), *this,
+		(static_cast<size_t>(level) << kLevelShift)
+			| mesh_->TriangleIndex(inter.Object(), level)
+	};
+}
+
+
+Vector MeshInstance::Normal(const Point &p) const {
+	return Vector{0, 0, 1};
+}
+
+
+AABB MeshInstance::BoundingBox() const {
+	// Bounding box of the transformed corners of the box of the Mesh
+	AABB box = mesh_->BoundingBox();
+	Transform mesh_to_world = world_to_mesh_.Inverse();
+	std::pair<double, double> x = box.XMinMax();
+	std::pair<double, double> y = box.YMinMax();
+	std::pair<double, double> z = box.ZMinMax();
+	Point corner = mesh_to_world.ApplyToPoint(Point{x.first, y.first, z.first});
+	AABB result{corner, corner};
+	for (int i=1; i<8; i++) {
+		corner = mesh_to_world.ApplyToPoint(Point{
+			i & 1 ? x.second : x.first,
+			i & 2 ? y.second : y.first,
+			i & 4 ? z.second : z.first
+		});
+		result = result || AABB{corner, corner};
+	}
+	return result;
+}
+
+
+SurfaceInteraction MeshInstance::Interact(
+	const Ray &r,
+	const Intersection &inter
+) const {
+	double scale;
+	Ray mesh_ray = ToMesh(r, scale);
+	if (r.HasDifferentials()) {
+		// Differentials of the transformed origin, and of the transformed
+		// direction once normalized
+		const Vector &d = mesh_ray.Direction();
+		Vector direction_dx =
+			world_to_mesh_.ApplyToVector(r.DirectionDx()) / scale;
+		Vector direction_dy =
+			world_to_mesh_.ApplyToVector(r.DirectionDy()) / scale;
+		mesh_ray.SetDifferentials(
+			world_to_mesh_.ApplyToVector(r.OriginDx()),
+			world_to_mesh_.ApplyToVector(r.OriginDy()),
+			direction_dx - (direction_dx|d)*d,
+			direction_dy - (direction_dy|d)*d
+		);
+	}
+	const unsigned int level = inter.Primitive() >> kLevelShift;
+	const size_t index =
+		inter.Primitive() & ((static_cast<size_t>(1) << kLevelShift) - 1);
+	const Triangle &triangle = mesh_->TriangleAt(index, level);
+	SurfaceInteraction local = triangle.Interact(
+		mesh_ray,
+		Intersection{
+			inter.Distance() * scale, inter.IsOut(), inter.U(), inter.V(),
+			triangle
+		}
+	);
+
+	// Normals are transformed by the transpose of the inverse Transform
+	Vector normal = world_to_mesh_.ApplyTransposedToVector(local.Normal());
+	normal.Normalize();
+	SurfaceInteraction s = override_material_ ?
+		SurfaceInteraction{
+			r(inter.Distance()), normal, local.BarycentricCoordinates(),
+			material_, *this, inter.Primitive()
+		} :
+		SurfaceInteraction{
+			r(inter.Distance()), normal, local.BarycentricCoordinates(),
+			local.SurfaceMaterial(), triangle, inter.Primitive()
+		};
+	s.SetSource(*this);
+
+	// UV derivatives do not depend on the frame; the derivatives of the
+	// point are computed again in world space
+	s.ComputeDifferentials(r, inter.Distance());
+	s.SetUVDifferentials(
+		local.DuDx(), local.DvDx(), local.DuDy(), local.DvDy()
+	);
+	return s;
 }
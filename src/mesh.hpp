@@ -5,19 +5,100 @@
 
 #pragma once
 
+#include "decimation.hpp"
+#include "obj_loader.hpp"
 #include "object_container.hpp"
 
 
+/**
+ * \struct MeshOptions
+ * \brief Options controlling how a Mesh is imported.
+ */
+struct MeshOptions {
+	/// If set to true, .obj files are loaded with the native parallel loader
+	/// instead of Assimp. The native loader neither welds identical vertices
+	/// nor fixes infacing normals, so that its triangles can differ from the
+	/// ones of Assimp.
+	bool native_obj = false;
+
+	/// Simplification applied to the triangles before the BVH is built.
+	DecimationOptions decimation;
+
+	/// Number of levels of detail of the Mesh, including the finest one.
+	unsigned int nb_levels = 1;
+
+	/// Fraction of the triangles of a level kept by the next coarser level.
+	double level_ratio = 0.25;
+};
+
+
+/**
+ * \struct ObjSurfaces
+ * \brief Materials and textures of the triangles of an OBJ file.
+ *
+ * Stores one Material per material of the file, completed by the default
+ * Material, followed by the default Material itself for triangles without
+ * material.
+ */
+struct ObjSurfaces {
+	std::vector<Material> materials; //!< Materials, the default one last.
+
+	/// Diffuse textures of the materials (null if none).
+	std::vector<std::shared_ptr<const Texture>> diffuse_textures;
+
+	/// Specular textures of the materials (null if none).
+	std::vector<std::shared_ptr<const Texture>> specular_textures;
+
+	/**
+	 * \fn ObjSurfaces(const std::vector<ObjMaterial> &obj_materials, const std::string &folder, const Material &material)
+	 * \brief Builds the materials of an OBJ file and loads their textures.
+	 * \param folder Folder of the texture files (with separator at the end).
+	 * \param material Default material, used when some parameter is missing.
+	 */
+	ObjSurfaces(
+		const std::vector<ObjMaterial> &obj_materials,
+		const std::string &folder,
+		const Material &material
+	);
+
+	/// Outputs the Material of the input triangle.
+	inline const Material& MaterialOf(const ObjTriangle &triangle) const {
+		return triangle.material == ObjData::kNone ?
+			materials.back() : materials[triangle.material];
+	}
+
+	/// Builds the Triangle corresponding to the input triangle.
+	Triangle MakeTriangle(const ObjTriangle &triangle) const;
+};
+
+
 /**
  * \class Mesh
  * \brief Defines a set of triangles using a BVH.
+ *
+ * A Mesh may store several levels of detail, each one a simplification of the
+ * previous one (see DecimationOptions), so that distant copies can be
+ * intersected with fewer triangles. Level 0 is the imported model.
  */
 class Mesh : public RawObject {
 private:
-	std::unique_ptr<BVH> triangles_; //!< BVH representing the Mesh.
+	/// BVH of each level of detail, finest first.
+	std::vector<std::unique_ptr<BVH>> levels_;
+
+	/// Typical edge length of the triangles of each level.
+	std::vector<double> feature_sizes_;
+
+	double import_throughput_ = 0; //!< Import speed of the file, in MB/s.
+
+	/**
+	 * \fn void AddLevel(std::vector<Triangle> &&triangles)
+	 * \brief Builds the BVH of the input triangles as the next coarser level,
+	 *        and computes its feature size.
+	 */
+	void AddLevel(std::vector<Triangle> &&triangles);
 
 	/*
-	 * \fn void Import(const std::string &filename, const std::string &folder, const Material &material)
+	 * \fn void Import(const std::string &filename, const std::string &folder, const Material &material, const MeshOptions &options)
 	 * \brief Loads into the Mesh the model given in the input path.
      * \param filename Path to the object file.
      * \param folder Folder of the texture files (with separator at the end).
@@ -39,34 +120,53 @@ private:
 	 *  - opacity;
 	 *  - specular coefficient;
 	 *  - specular fraction;
-	 *  - refractive index.
+	 *  - refractive index;
+	 *  - emission.
 	 * Other parameters are taken in the input material of this method.
 	 *
+	 * If decimation is enabled, or for coarser levels of detail, each mesh of
+	 * the file is simplified with a share of the target proportional to its
+	 * number of faces.
+	 *
 	 * Credits to Maverick Chardet for half of the code of this function.
 	 */
 	void Import(
 		const std::string &filename, const std::string &folder,
-		const Material &material
+		const Material &material, const MeshOptions &options
+	);
+
+	/*
+	 * \fn void ImportOBJ(const std::string &filename, const std::string &folder, const Material &material, const MeshOptions &options)
+	 * \brief Loads into the Mesh the .obj model given in the input path, using
+	 *        the native parallel loader (see LoadOBJ).
+	 *
+	 * Reads the same material parameters as Import, and produces the same
+	 * normalization and UV convention. Missing normals are replaced by the
+	 * normal of the face, and degenerate triangles are removed. The
+	 * triangles are simplified if decimation is enabled, then again for each
+	 * coarser level of detail.
+	 */
+	void ImportOBJ(
+		const std::string &filename, const std::string &folder,
+		const Material &material, const MeshOptions &options
 	);
 
 public:
     /**
-     * \fn Mesh(const std::string &filename, const std::string &folder, const Material &material=Material{}
+     * \fn Mesh(const std::string &filename, const std::string &folder, const Material &material=Material{}, const MeshOptions &options=MeshOptions{})
      * \brief Builds a mesh from a respresentation stored in a file.
      * \param filename Path to the object file.
      * \param folder Folder of the texture files (with separator at the end).
 	 * \param material Default material of the object, used when some parameter
 	 *        is missing in the input file.
+	 * \param options Import options.
      */
     Mesh(
 		const std::string &filename,
 		const std::string &folder,
-		const Material &material=Material{}
-	) :
-        RawObject{material, false}
-    {
-        Import(filename, folder, material);
-    }
+		const Material &material=Material{},
+		const MeshOptions &options=MeshOptions{}
+	);
 
 	/**
 	 * \fn Mesh(Mesh &mesh)
@@ -77,12 +177,65 @@ public:
         RawObject{mesh.material_, false}
 	{
 		std::vector<Object> dummy;
-		triangles_ = std::make_unique<BVH>(dummy.begin(), dummy.end());
-		triangles_.swap(mesh.triangles_);
+		levels_.push_back(std::make_unique<BVH>(dummy.begin(), dummy.end()));
+		feature_sizes_.push_back(0);
+		levels_.swap(mesh.levels_);
+		feature_sizes_.swap(mesh.feature_sizes_);
+		import_throughput_ = mesh.import_throughput_;
 	}
 
 	inline Intersection Intersect(const Ray &r) const {
-		return triangles_->Intersect(r);
+		return levels_[0]->Intersect(r);
+	}
+
+	/// Computes the Intersection between the input Ray and the given level of
+	/// detail.
+	inline Intersection Intersect(const Ray &r, unsigned int level) const {
+		return levels_[level]->Intersect(r);
+	}
+
+	/// Outputs the number of levels of detail.
+	inline unsigned int NbLevels() const {
+		return levels_.size();
+	}
+
+	/// Outputs the typical edge length of the triangles of the given level.
+	inline double FeatureSize(unsigned int level) const {
+		return feature_sizes_[level];
+	}
+
+	/**
+	 * \fn unsigned int SelectLevel(double footprint) const
+	 * \brief Outputs the coarsest level of detail whose triangles are not
+	 *        larger than the input footprint (e.g. the size of a pixel at the
+	 *        distance of the Mesh), both in the space of the Mesh.
+	 */
+	unsigned int SelectLevel(double footprint) const;
+
+	/// Outputs the number of triangles of the given level.
+	inline size_t NbTriangles(unsigned int level=0) const {
+		return levels_[level]->Primitives().Triangles().size();
+	}
+
+	/// Outputs the i-th triangle of the given level.
+	inline const Triangle& TriangleAt(size_t i, unsigned int level=0) const {
+		return levels_[level]->Primitives().Triangles()[i];
+	}
+
+	/// Outputs the index of the input triangle of the given level, as returned
+	/// by Intersect.
+	inline size_t TriangleIndex(
+		const RawObject &triangle,
+		unsigned int level=0
+	) const {
+		return static_cast<const Triangle*>(&triangle) - &TriangleAt(0, level);
+	}
+
+	/// Outputs the speed at which the file of the Mesh was parsed by Assimp
+	/// or by the native loader, in MB/s; decimation and the construction of
+	/// the BVH are not included.
+	inline double ImportThroughput() const {
+		return import_throughput_;
 	}
 
 	/// \warning Does not return the normal of the object. Normals to individual
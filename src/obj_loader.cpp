@@ -0,0 +1,597 @@
+/**
+ * \file obj_loader.cpp
+ * \brief Implements the native OBJ / MTL loader.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "obj_loader.hpp"
+
+
+const unsigned int ObjData::kNone;
+
+
+bool ObjData::ExtractTriangle(size_t j, ObjTriangle &triangle) const {
+	const unsigned int *corners = &triangles[9*j];
+	if (corners[0] == kNone || corners[3] == kNone || corners[6] == kNone) {
+		return false;
+	}
+
+	// Points
+	for (int k=0; k<3; k++) {
+		const float *position = &positions[3*corners[3*k]];
+		std::copy(position, position+3, &triangle.positions[3*k]);
+	}
+
+	// Removes degenerate triangles
+	const float *p = triangle.positions;
+	Vector face_normal = Vector{p[3]-p[0], p[4]-p[1], p[5]-p[2]}
+		^ Vector{p[6]-p[0], p[7]-p[1], p[8]-p[2]};
+	if (face_normal.NormSquared() == 0) {
+		return false;
+	}
+	face_normal.Normalize();
+
+	// Normals, using the normal of the face when some is missing
+	for (int k=0; k<3; k++) {
+		if (corners[3*k+2] == kNone) {
+			triangle.normals[3*k] = face_normal.x();
+			triangle.normals[3*k+1] = face_normal.y();
+			triangle.normals[3*k+2] = face_normal.z();
+		} else {
+			const float *normal = &normals[3*corners[3*k+2]];
+			std::copy(normal, normal+3, &triangle.normals[3*k]);
+		}
+	}
+
+	// Face textures
+	triangle.has_uv = true;
+	for (int k=0; k<3; k++) {
+		if (corners[3*k+1] == kNone) {
+			triangle.uvs[2*k] = 0;
+			triangle.uvs[2*k+1] = 0;
+			triangle.has_uv = false;
+		} else {
+			triangle.uvs[2*k] = uvs[2*corners[3*k+1]];
+			triangle.uvs[2*k+1] = uvs[2*corners[3*k+1]+1];
+			if (triangle.uvs[2*k] < 0 || triangle.uvs[2*k+1] < 0) {
+				triangle.has_uv = false;
+			}
+		}
+	}
+
+	triangle.material = triangle_materials[j];
+	return true;
+}
+
+
+/**
+ * \struct ObjChunk
+ * \brief Range of lines of an OBJ file parsed by one task, with the number of
+ *        entries of each kind it contains and their offset in the output.
+ */
+struct ObjChunk {
+	const char *first; //!< First character of the chunk.
+	const char *last;  //!< Character after the end of the chunk.
+
+	size_t nb_positions = 0; //!< Number of v lines.
+	size_t nb_uvs = 0;       //!< Number of vt lines.
+	size_t nb_normals = 0;   //!< Number of vn lines.
+	size_t nb_triangles = 0; //!< Number of triangles of the f lines.
+
+	size_t positions_offset = 0; //!< Number of v lines in previous chunks.
+	size_t uvs_offset = 0;       //!< Number of vt lines in previous chunks.
+	size_t normals_offset = 0;   //!< Number of vn lines in previous chunks.
+	size_t triangles_offset = 0; //!< Number of triangles in previous chunks.
+
+	/// usemtl lines: index of the next triangle, and name of the material.
+	std::vector<std::pair<size_t, std::string>> material_switches;
+
+	std::vector<std::string> libraries; //!< MTL files referenced by mtllib.
+};
+
+
+/// Indicates if the input character separates tokens in a line.
+static inline bool IsBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+/// Skips blank characters.
+static inline const char* SkipBlanks(const char *p, const char *end) {
+	while (p < end && IsBlank(*p)) {
+		p++;
+	}
+	return p;
+}
+
+
+/// Outputs the end of the line starting at p (position of '\n' or end).
+static inline const char* EndOfLine(const char *p, const char *end) {
+	const char *eol = static_cast<const char*>(
+		std::memchr(p, '\n', end - p)
+	);
+	return eol ? eol : end;
+}
+
+
+/// Outputs the input range without leading and trailing blanks.
+static std::string Trim(const char *p, const char *end) {
+	p = SkipBlanks(p, end);
+	while (end > p && IsBlank(*(end-1))) {
+		end--;
+	}
+	return std::string(p, end);
+}
+
+
+/**
+ * \fn static const char* ParseFloat(const char *p, const char *end, float &value)
+ * \brief Parses a decimal number (with optional sign, fraction and exponent)
+ *        and returns the position after it.
+ *
+ * Falls back to strtod for unusual notations (inf, nan, hexadecimal).
+ */
+static const char* ParseFloat(const char *p, const char *end, float &value) {
+	static const double powers_of_ten[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+		1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	p = SkipBlanks(p, end);
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	unsigned long long mantissa = 0;
+	int exponent = 0;
+	int nb_digits = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (nb_digits < 19) {
+			mantissa = 10*mantissa + (*p - '0');
+			nb_digits += (mantissa != 0);
+		} else {
+			exponent++;
+		}
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (nb_digits < 19) {
+				mantissa = 10*mantissa + (*p - '0');
+				nb_digits += (mantissa != 0);
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negative_exponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative_exponent = (*p == '-');
+			p++;
+		}
+		int e = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			e = std::min(10*e + (*p - '0'), 10000);
+			p++;
+		}
+		exponent += negative_exponent ? -e : e;
+	}
+	if (p == start || (p < end && !IsBlank(*p) && *p != '\n' && *p != '/')) {
+		// Unusual notation
+		char *parsed_end;
+		std::string token = Trim(start, EndOfLine(start, end));
+		value = std::strtod(token.c_str(), &parsed_end);
+		p = start;
+		while (p < end && !IsBlank(*p) && *p != '\n') {
+			p++;
+		}
+		return p;
+	}
+	double result = mantissa;
+	if (exponent < 0) {
+		result /= exponent >= -22 ? powers_of_ten[-exponent]
+			: std::pow(10., -exponent);
+	} else if (exponent > 0) {
+		result *= exponent <= 22 ? powers_of_ten[exponent]
+			: std::pow(10., exponent);
+	}
+	value = negative ? -result : result;
+	return p;
+}
+
+
+/// Parses an integer and returns the position after it; value is 0 if there
+/// is no integer.
+static inline const char* ParseInt(const char *p, const char *end, long &value) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = 10*value + (*p - '0');
+		p++;
+	}
+	if (negative) {
+		value = -value;
+	}
+	return p;
+}
+
+
+/// Counts the number of corners of an f line.
+static size_t CountCorners(const char *p, const char *end) {
+	size_t nb_corners = 0;
+	while (true) {
+		p = SkipBlanks(p, end);
+		if (p >= end) {
+			return nb_corners;
+		}
+		nb_corners++;
+		while (p < end && !IsBlank(*p)) {
+			p++;
+		}
+	}
+}
+
+
+/// Resolves an OBJ index (1-based, or negative for relative indices) given
+/// the number of entries seen before it.
+static inline unsigned int ResolveIndex(long index, size_t nb_before) {
+	if (index > 0) {
+		return index - 1;
+	} else if (index < 0) {
+		return nb_before + index;
+	} else {
+		return ObjData::kNone;
+	}
+}
+
+
+/// Outputs the keyword of an OBJ line and sets p after it.
+static inline std::string Keyword(const char *&p, const char *end) {
+	p = SkipBlanks(p, end);
+	const char *start = p;
+	while (p < end && !IsBlank(*p)) {
+		p++;
+	}
+	return std::string(start, p);
+}
+
+
+/// First parallel pass: counts the entries of a chunk. Lines are recognized
+/// by the same Keyword test as in ParseChunk, so that both passes agree.
+static void CountChunk(ObjChunk &chunk) {
+	const char *p = chunk.first;
+	while (p < chunk.last) {
+		const char *eol = EndOfLine(p, chunk.last);
+		const char *q = p;
+		std::string keyword = Keyword(q, eol);
+		if (keyword == "v") {
+			chunk.nb_positions++;
+		} else if (keyword == "vt") {
+			chunk.nb_uvs++;
+		} else if (keyword == "vn") {
+			chunk.nb_normals++;
+		} else if (keyword == "f") {
+			size_t nb_corners = CountCorners(q, eol);
+			if (nb_corners >= 3) {
+				chunk.nb_triangles += nb_corners - 2;
+			}
+		}
+		p = eol + 1;
+	}
+}
+
+
+/// Second parallel pass: parses a chunk into its place in the output.
+static void ParseChunk(ObjChunk &chunk, ObjData &data) {
+	float *positions = data.positions.data() + 3*chunk.positions_offset;
+	float *uvs = data.uvs.data() + 2*chunk.uvs_offset;
+	float *normals = data.normals.data() + 3*chunk.normals_offset;
+	unsigned int *triangles = data.triangles.data() + 9*chunk.triangles_offset;
+	size_t nb_positions = chunk.positions_offset;
+	size_t nb_uvs = chunk.uvs_offset;
+	size_t nb_normals = chunk.normals_offset;
+	size_t nb_triangles = chunk.triangles_offset;
+	std::vector<unsigned int> corners;
+
+	const char *p = chunk.first;
+	while (p < chunk.last) {
+		const char *eol = EndOfLine(p, chunk.last);
+		const char *q = p;
+		std::string keyword = Keyword(q, eol);
+		if (keyword == "v") {
+			for (int k=0; k<3; k++) {
+				q = ParseFloat(q, eol, *positions++);
+			}
+			nb_positions++;
+		} else if (keyword == "vt") {
+			q = ParseFloat(q, eol, uvs[0]);
+			q = SkipBlanks(q, eol);
+			if (q < eol) {
+				q = ParseFloat(q, eol, uvs[1]);
+			} else {
+				uvs[1] = 0;
+			}
+			uvs += 2;
+			nb_uvs++;
+		} else if (keyword == "vn") {
+			for (int k=0; k<3; k++) {
+				q = ParseFloat(q, eol, *normals++);
+			}
+			nb_normals++;
+		} else if (keyword == "f") {
+			// Reads all corners (v, v/vt, v//vn or v/vt/vn)
+			corners.clear();
+			while (true) {
+				q = SkipBlanks(q, eol);
+				if (q >= eol) {
+					break;
+				}
+				long v = 0, vt = 0, vn = 0;
+				q = ParseInt(q, eol, v);
+				if (q < eol && *q == '/') {
+					q = ParseInt(q+1, eol, vt);
+					if (q < eol && *q == '/') {
+						q = ParseInt(q+1, eol, vn);
+					}
+				}
+				while (q < eol && !IsBlank(*q)) {
+					q++;
+				}
+				corners.push_back(ResolveIndex(v, nb_positions));
+				corners.push_back(ResolveIndex(vt, nb_uvs));
+				corners.push_back(ResolveIndex(vn, nb_normals));
+			}
+			// Triangulates the polygon as a fan
+			for (size_t k=2; 3*k<corners.size(); k++) {
+				std::copy(corners.begin(), corners.begin()+3, triangles);
+				std::copy(corners.begin()+3*(k-1), corners.begin()+3*(k+1),
+					triangles+3);
+				triangles += 9;
+				nb_triangles++;
+			}
+		} else if (keyword == "usemtl") {
+			chunk.material_switches.push_back({nb_triangles, Trim(q, eol)});
+		} else if (keyword == "mtllib") {
+			chunk.libraries.push_back(Trim(q, eol));
+		}
+		p = eol + 1;
+	}
+}
+
+
+/// Reads three numbers of an MTL line as a color.
+static Vector ParseColor(const char *p, const char *end) {
+	float r = 0, g = 0, b = 0;
+	p = ParseFloat(p, end, r);
+	if (SkipBlanks(p, end) >= end) {
+		// A single value is used for the three channels
+		return Vector{r, r, r};
+	}
+	p = ParseFloat(p, end, g);
+	p = ParseFloat(p, end, b);
+	return Vector{r, g, b};
+}
+
+
+/// Parses an MTL file and appends its materials; missing files are ignored.
+static void LoadMTL(const std::string &filename, std::vector<ObjMaterial> &materials) {
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line)) {
+		const char *p = line.data();
+		const char *end = line.data() + line.size();
+		std::string keyword = Keyword(p, end);
+		if (keyword == "newmtl") {
+			materials.emplace_back();
+			materials.back().name = Trim(p, end);
+		} else if (materials.empty()) {
+			continue;
+		}
+		ObjMaterial &m = materials.back();
+		float value = 0;
+		if (keyword == "Kd") {
+			m.has_diffuse = true;
+			m.diffuse = ParseColor(p, end);
+		} else if (keyword == "Ks") {
+			m.has_specular = true;
+			m.specular = ParseColor(p, end);
+		} else if (keyword == "Ke") {
+			m.has_emission = true;
+			m.emission = ParseColor(p, end);
+		} else if (keyword == "Tf") {
+			m.has_transparent = true;
+			m.transparent = ParseColor(p, end);
+		} else if (keyword == "d") {
+			ParseFloat(p, end, value);
+			m.has_opacity = true;
+			m.opacity = value;
+		} else if (keyword == "Tr") {
+			ParseFloat(p, end, value);
+			m.has_opacity = true;
+			m.opacity = 1 - value;
+		} else if (keyword == "Ns") {
+			ParseFloat(p, end, value);
+			m.has_shininess = true;
+			m.shininess = value;
+		} else if (keyword == "Ni") {
+			ParseFloat(p, end, value);
+			m.has_index = true;
+			m.index = value;
+		} else if (keyword == "map_Kd") {
+			// The file name is the last token (options may precede it)
+			std::string rest = Trim(p, end);
+			m.diffuse_map = rest.substr(rest.find_last_of(" \t") + 1);
+		} else if (keyword == "map_Ks") {
+			std::string rest = Trim(p, end);
+			m.specular_map = rest.substr(rest.find_last_of(" \t") + 1);
+		}
+	}
+}
+
+
+ObjData LoadOBJ(const std::string &filename, bool normalize, bool flip_uvs) {
+	// Reads the whole file
+	std::FILE *file = std::fopen(filename.c_str(), "rb");
+	if (!file) {
+		throw std::runtime_error("Cannot open " + filename);
+	}
+	std::fseek(file, 0, SEEK_END);
+	long size = std::ftell(file);
+	std::fseek(file, 0, SEEK_SET);
+	std::vector<char> content(std::max(size, 0L));
+	size_t nb_read = std::fread(content.data(), 1, content.size(), file);
+	std::fclose(file);
+	if (size < 0 || nb_read != content.size()) {
+		throw std::runtime_error("Cannot read " + filename);
+	}
+
+	// Splits the file into chunks ending at line boundaries
+	int nb_threads = 1;
+	#ifdef _OPENMP
+	nb_threads = omp_get_max_threads();
+	#endif
+	const char *begin = content.data();
+	const char *end = content.data() + content.size();
+	size_t nb_chunks = std::max<size_t>(1,
+		std::min<size_t>(4*nb_threads, content.size() / (1 << 16)));
+	std::vector<ObjChunk> chunks(nb_chunks);
+	const char *previous = begin;
+	for (size_t i=0; i<nb_chunks; i++) {
+		const char *last = (i+1 == nb_chunks) ? end
+			: EndOfLine(std::max(previous, begin + (i+1)*content.size()/nb_chunks), end);
+		if (last < end) {
+			last++;
+		}
+		chunks[i].first = previous;
+		chunks[i].last = last;
+		previous = last;
+	}
+
+	// First pass: counts the entries of each chunk
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t i=0; i<nb_chunks; i++) {
+		CountChunk(chunks[i]);
+	}
+	ObjData data;
+	size_t nb_positions = 0, nb_uvs = 0, nb_normals = 0, nb_triangles = 0;
+	for (auto &chunk : chunks) {
+		chunk.positions_offset = nb_positions;
+		chunk.uvs_offset = nb_uvs;
+		chunk.normals_offset = nb_normals;
+		chunk.triangles_offset = nb_triangles;
+		nb_positions += chunk.nb_positions;
+		nb_uvs += chunk.nb_uvs;
+		nb_normals += chunk.nb_normals;
+		nb_triangles += chunk.nb_triangles;
+	}
+	data.positions.resize(3*nb_positions);
+	data.uvs.resize(2*nb_uvs);
+	data.normals.resize(3*nb_normals);
+	data.triangles.resize(9*nb_triangles);
+
+	// Second pass: parses the chunks in place
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t i=0; i<nb_chunks; i++) {
+		ParseChunk(chunks[i], data);
+	}
+
+	// Validates the indices, marking invalid ones as missing
+	#pragma omp parallel for
+	for (size_t t=0; t<nb_triangles; t++) {
+		for (int k=0; k<3; k++) {
+			unsigned int *corner = &data.triangles[9*t + 3*k];
+			if (corner[0] >= nb_positions) {
+				corner[0] = ObjData::kNone;
+			}
+			if (corner[1] != ObjData::kNone && corner[1] >= nb_uvs) {
+				corner[1] = ObjData::kNone;
+			}
+			if (corner[2] != ObjData::kNone && corner[2] >= nb_normals) {
+				corner[2] = ObjData::kNone;
+			}
+		}
+	}
+
+	// Loads the materials, relatively to the folder of the OBJ file
+	std::string folder = filename.substr(0, filename.find_last_of("/\\") + 1);
+	for (const auto &chunk : chunks) {
+		for (const auto &library : chunk.libraries) {
+			LoadMTL(folder + library, data.materials);
+		}
+	}
+	std::map<std::string, unsigned int> material_indices;
+	for (unsigned int i=0; i<data.materials.size(); i++) {
+		material_indices.insert({data.materials[i].name, i});
+	}
+
+	// Assigns the materials, a usemtl line applying to all following triangles
+	data.triangle_materials.assign(nb_triangles, ObjData::kNone);
+	unsigned int current = ObjData::kNone;
+	size_t next_triangle = 0;
+	for (const auto &chunk : chunks) {
+		for (const auto &material_switch : chunk.material_switches) {
+			std::fill(
+				data.triangle_materials.begin() + next_triangle,
+				data.triangle_materials.begin() + material_switch.first, current
+			);
+			next_triangle = material_switch.first;
+			auto it = material_indices.find(material_switch.second);
+			current = (it == material_indices.end()) ? ObjData::kNone : it->second;
+		}
+	}
+	std::fill(data.triangle_materials.begin() + next_triangle,
+		data.triangle_materials.end(), current);
+
+	// Normalizes the positions into [-1,1], keeping proportions
+	if (normalize && nb_positions > 0) {
+		float p_min[3], p_max[3];
+		for (int k=0; k<3; k++) {
+			p_min[k] = p_max[k] = data.positions[k];
+		}
+		for (size_t i=0; i<nb_positions; i++) {
+			for (int k=0; k<3; k++) {
+				p_min[k] = std::min(p_min[k], data.positions[3*i+k]);
+				p_max[k] = std::max(p_max[k], data.positions[3*i+k]);
+			}
+		}
+		float half_extent = std::max(p_max[0]-p_min[0],
+			std::max(p_max[1]-p_min[1], p_max[2]-p_min[2])) / 2;
+		if (half_extent > 0) {
+			#pragma omp parallel for
+			for (size_t i=0; i<nb_positions; i++) {
+				for (int k=0; k<3; k++) {
+					float center = (p_min[k] + p_max[k]) / 2;
+					data.positions[3*i+k] =
+						(data.positions[3*i+k] - center) / half_extent;
+				}
+			}
+		}
+	}
+
+	if (flip_uvs) {
+		for (size_t i=0; i<nb_uvs; i++) {
+			data.uvs[2*i+1] = 1 - data.uvs[2*i+1];
+		}
+	}
+
+	return data;
+}
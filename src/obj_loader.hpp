@@ -0,0 +1,116 @@
+/**
+ * \file obj_loader.hpp
+ * \brief Defines a native parallel loader for Wavefront OBJ / MTL files.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+
+/**
+ * \struct ObjMaterial
+ * \brief Material described in an MTL file. Only the fields supported by
+ *        Material are read; the others are ignored.
+ */
+struct ObjMaterial {
+	std::string name; //!< Name of the material, referenced by usemtl.
+
+	bool has_diffuse = false;       //!< Indicates if diffuse is given (Kd).
+	Vector diffuse;                 //!< Diffuse color.
+	bool has_specular = false;      //!< Indicates if specular is given (Ks).
+	Vector specular;                //!< Specular color.
+	bool has_transparent = false;   //!< Indicates if transparent is given (Tf).
+	Vector transparent;             //!< Transparent color.
+	bool has_opacity = false;       //!< Indicates if opacity is given (d, Tr).
+	double opacity = 1;             //!< Opacity.
+	bool has_shininess = false;     //!< Indicates if shininess is given (Ns).
+	double shininess = 0;           //!< Specular coefficient.
+	bool has_index = false;         //!< Indicates if the index is given (Ni).
+	double index = 1;               //!< Refractive index.
+	bool has_emission = false;      //!< Indicates if emission is given (Ke).
+	Vector emission;                //!< Emitted radiance.
+	std::string diffuse_map;        //!< Diffuse texture file (map_Kd), if any.
+	std::string specular_map;       //!< Specular texture file (map_Ks), if any.
+};
+
+
+/**
+ * \struct ObjTriangle
+ * \brief Self-contained triangle of an OBJ file, with the attributes of its
+ *        three corners. Plain data, so that it can be written to a file as is.
+ */
+struct ObjTriangle {
+	float positions[9]; //!< Positions of the three corners.
+	float normals[9];   //!< Normals of the three corners.
+	float uvs[6];       //!< UV coordinates of the three corners.
+
+	/// Index of the material of the triangle in ObjData::materials, or
+	/// ObjData::kNone.
+	unsigned int material;
+
+	/// Non-zero if all corners have valid UV coordinates.
+	unsigned int has_uv;
+};
+
+
+/**
+ * \struct ObjData
+ * \brief Content of an OBJ file, as flat arrays ready to build triangles.
+ *
+ * Polygonal faces are triangulated as fans, and all indices are resolved to
+ * 0-based absolute indices.
+ */
+struct ObjData {
+	/// Index used when a corner has no UV coordinates or normal, or when a
+	/// triangle has no material.
+	static const unsigned int kNone = static_cast<unsigned int>(-1);
+
+	std::vector<float> positions; //!< Coordinates of the vertices (3 per vertex).
+	std::vector<float> uvs;       //!< UV coordinates (2 per entry).
+	std::vector<float> normals;   //!< Normals (3 per entry).
+
+	/// Corners of the triangles, 9 indices per triangle: position, UV and
+	/// normal indices of the first corner, then of the second and third ones.
+	std::vector<unsigned int> triangles;
+
+	/// Index in materials of the material of each triangle, or kNone.
+	std::vector<unsigned int> triangle_materials;
+
+	std::vector<ObjMaterial> materials; //!< Materials of all MTL libraries.
+
+	/// Outputs the number of triangles.
+	inline size_t NbTriangles() const {
+		return triangle_materials.size();
+	}
+
+	/**
+	 * \fn bool ExtractTriangle(size_t j, ObjTriangle &triangle) const
+	 * \brief Gathers the attributes of the j-th triangle.
+	 * \return false if the triangle is invalid (missing position or null
+	 *         area), in which case it should be skipped.
+	 *
+	 * Missing normals are replaced by the normal of the face. UV coordinates
+	 * are only valid if every corner has non-negative ones.
+	 */
+	bool ExtractTriangle(size_t j, ObjTriangle &triangle) const;
+};
+
+
+/**
+ * \fn ObjData LoadOBJ(const std::string &filename, bool normalize, bool flip_uvs)
+ * \brief Loads an OBJ file and its MTL libraries.
+ * \param normalize If set to true, centers and scales the positions so that
+ *        they lie in [-1,1], as Assimp's PP_PTV_NORMALIZE.
+ * \param flip_uvs If set to true, replaces each v coordinate by 1-v, as
+ *        Assimp's aiProcess_FlipUVs.
+ * \throw std::runtime_error If the file cannot be read.
+ *
+ * The file is read at once and split into chunks at line boundaries. A first
+ * parallel pass counts the vertex entries of each chunk, so that relative
+ * (negative) indices can be resolved while parsing; a second parallel pass
+ * parses the chunks into their final place in the output arrays.
+ */
+ObjData LoadOBJ(const std::string &filename, bool normalize, bool flip_uvs);
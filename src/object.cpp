@@ -6,6 +6,85 @@
 #include "object.hpp"
 
 
+constexpr double SurfaceInteraction::kDiffuseSpread;
+
+
+void SurfaceInteraction::ComputeDifferentials(
+	const Ray &r, double t, const Vector &plane_normal
+) {
+	const Vector &d = r.Direction();
+	double d_dot_n = (d|plane_normal);
+	if (!r.HasDifferentials() || std::abs(d_dot_n) < 1e-8) {
+		return;
+	}
+	// Intersects the offset rays with the plane of the intersection
+	Vector dx = r.OriginDx() + t*r.DirectionDx();
+	Vector dy = r.OriginDy() + t*r.DirectionDy();
+	point_dx_ = dx - ((dx|plane_normal)/d_dot_n)*d;
+	point_dy_ = dy - ((dy|plane_normal)/d_dot_n)*d;
+	has_differentials_ = true;
+}
+
+
+Ray SurfaceInteraction::Spawn(
+	const Point &origin, const Vector &direction
+) const {
+	Ray spawned{origin, direction};
+	spawned.SetSource(*source_, primitive_);
+	return spawned;
+}
+
+
+Ray SurfaceInteraction::SpawnReflected(
+	const Ray &r, const Point &origin, const Vector &direction
+) const {
+	Ray reflected = Spawn(origin, direction);
+	if (has_differentials_) {
+		const Vector &n = normal_;
+		reflected.SetDifferentials(
+			point_dx_, point_dy_,
+			r.DirectionDx() - 2*(r.DirectionDx()|n)*n,
+			r.DirectionDy() - 2*(r.DirectionDy()|n)*n
+		);
+	}
+	return reflected;
+}
+
+
+Ray SurfaceInteraction::SpawnRefracted(
+	const Ray &r, const Point &origin, const Vector &direction, double eta
+) const {
+	Ray refracted = Spawn(origin, direction);
+	const Vector &n = normal_;
+	double cos_transmitted = -(refracted.Direction()|n);
+	if (has_differentials_ && std::abs(cos_transmitted) > 1e-8) {
+		// Derivative of the coefficient of the normal in the refracted
+		// direction, eta*d - mu*n
+		double mu_factor =
+			eta + eta*eta*(r.Direction()|n) / cos_transmitted;
+		refracted.SetDifferentials(
+			point_dx_, point_dy_,
+			eta*r.DirectionDx() - mu_factor*(r.DirectionDx()|n)*n,
+			eta*r.DirectionDy() - mu_factor*(r.DirectionDy()|n)*n
+		);
+	}
+	return refracted;
+}
+
+
+Ray SurfaceInteraction::SpawnDiffuse(
+	const Vector &direction, const Vector &ortho1, const Vector &ortho2
+) const {
+	Ray diffuse = Spawn(point_, direction);
+	if (has_differentials_) {
+		diffuse.SetDifferentials(
+			point_dx_, point_dy_, kDiffuseSpread*ortho1, kDiffuseSpread*ortho2
+		);
+	}
+	return diffuse;
+}
+
+
 Intersection Sphere::Intersect(const Ray &r) const {
 	// Equivalent to find the roots of degree 2 polynomial
 	const Point &origin = r.Origin();
@@ -102,28 +181,37 @@ Vector Triangle::BarycenticCoordinates(const Point &p) const {
 Intersection Triangle::Intersect(const Ray &r) const {
 	const Vector &direction = r.Direction();
 
-	// Plane intersection
-	double dot_prod = (direction | normal_plane_);
-	if (dot_prod == 0) {
+	// Moller-Trumbore algorithm: solves for the distance and the barycentric
+	// coordinates of the second and third vertices at the same time
+	Vector edge1 = p2_ - p1_;
+	Vector edge2 = p3_ - p1_;
+	Vector p_vec = direction ^ edge2;
+	double det = (edge1 | p_vec);
+	if (det == 0) {
 		// The ray and the plane are parallel
 		return Intersection{*this};
-	} else {
-		// Possible intersection
-		double t = -((r.Origin()-p1_) | normal_plane_) / dot_prod;
-		Vector barycentric = BarycenticCoordinates(r(t));
-		if (barycentric.x() > 0 && barycentric.y() > 0 && barycentric.z() > 0) {
-			return Intersection{
-				t, (direction|normal_plane_) < 0, barycentric, *this
-			};
-		} else {
-			return Intersection{*this};
-		}
 	}
+	double inv_det = 1 / det;
+	Vector t_vec = r.Origin() - p1_;
+	double v = (t_vec | p_vec) * inv_det;
+	if (v <= 0 || v >= 1) {
+		return Intersection{*this};
+	}
+	Vector q_vec = t_vec ^ edge1;
+	double u = (direction | q_vec) * inv_det;
+	if (u <= 0 || u + v >= 1) {
+		return Intersection{*this};
+	}
+	return Intersection{
+		(edge2 | q_vec) * inv_det, (direction|normal_plane_) < 0, u, v, *this
+	};
 }
 
 
 Vector Triangle::Normal(const Point &p) const {
-	Vector normal = p.b1()*normal1_ + p.b2()*normal2_ + p.b3()*normal3_;
+	Vector barycentric = BarycenticCoordinates(p);
+	Vector normal = barycentric.x()*normal1_ + barycentric.y()*normal2_
+		+ barycentric.z()*normal3_;
 	normal.Normalize();
 	// Outputs a well-oriented normal
 	if (((p1_-p)|normal_plane_) < 0) {
@@ -134,6 +222,38 @@ Vector Triangle::Normal(const Point &p) const {
 }
 
 
+SurfaceInteraction Triangle::Interact(
+	const Ray &r,
+	const Intersection &inter
+) const {
+	Point p = r(inter.Distance());
+	Vector barycentric{1-inter.U()-inter.V(), inter.V(), inter.U()};
+	Vector normal = barycentric.x()*normal1_ + barycentric.y()*normal2_
+		+ barycentric.z()*normal3_;
+	normal.Normalize();
+	// Outputs a well-oriented normal
+	if (((p1_-p)|normal_plane_) >= 0) {
+		normal = -normal;
+	}
+	SurfaceInteraction s{p, normal, barycentric, material_, *this};
+
+	// Derivatives of the UV coordinates, from the variations of the
+	// barycentric coordinates along the footprint
+	s.ComputeDifferentials(r, inter.Distance(), normal_plane_);
+	if (s.HasDifferentials() && has_uv_coordinates_) {
+		Vector bx = BarycenticCoordinates(p1_ + s.PointDx()) - Vector{1, 0, 0};
+		Vector by = BarycenticCoordinates(p1_ + s.PointDy()) - Vector{1, 0, 0};
+		s.SetUVDifferentials(
+			bx.x()*u1_ + bx.y()*u2_ + bx.z()*u3_,
+			bx.x()*v1_ + bx.y()*v2_ + bx.z()*v3_,
+			by.x()*u1_ + by.y()*u2_ + by.z()*u3_,
+			by.x()*v1_ + by.y()*v2_ + by.z()*v3_
+		);
+	}
+	return s;
+}
+
+
 AABB Triangle::BoundingBox() const {
 	double x_min = std::min(p1_.x(), std::min(p2_.x(), p3_.x()));
 	double x_max = std::max(p1_.x(), std::max(p2_.x(), p3_.x()));
@@ -145,38 +265,42 @@ AABB Triangle::BoundingBox() const {
 }
 
 
-Vector Triangle::DiffuseColor(const Point &p) const {
+Vector Triangle::DiffuseColor(const SurfaceInteraction &s) const {
 	if (!HasDiffuseTexture() || !has_uv_coordinates_) {
 		// If no texture can be accessed, uses the material color
-		return material_.DiffuseColor();
+		return s.SurfaceMaterial().DiffuseColor();
 	} else {
 		// Computes the color using UV coordinates
-		float u = p.b1()*u1_ + p.b2()*u2_ + p.b3()*u3_;
-		float v = p.b1()*v1_ + p.b2()*v2_ + p.b3()*v3_;
-		u *= diffuse_texture_->height();
-		v *= diffuse_texture_->width();
-		double r = (*diffuse_texture_)(u, v, 0, 0) / 256.;
-		double g = (*diffuse_texture_)(u, v, 0, 1) / 256.;
-		double b = (*diffuse_texture_)(u, v, 0, 2) / 256.;
-		return Vector{r, g, b};
+		const Vector &bary = s.BarycentricCoordinates();
+		float u = bary.x()*u1_ + bary.y()*u2_ + bary.z()*u3_;
+		float v = bary.x()*v1_ + bary.y()*v2_ + bary.z()*v3_;
+		if (s.HasDifferentials()) {
+			// Mip level matching the footprint of the Ray
+			return diffuse_texture_->Trilinear(u, v, diffuse_texture_->LevelOfDetail(
+				s.DuDx(), s.DvDx(), s.DuDy(), s.DvDy()
+			));
+		}
+		return diffuse_texture_->Bilinear(u, v);
 	}
 }
 
 
-Vector Triangle::SpecularColor(const Point &p) const {
+Vector Triangle::SpecularColor(const SurfaceInteraction &s) const {
 	if (!HasSpecularTexture() || !has_uv_coordinates_) {
 		// If no texture can be accessed, uses the material color
-		return material_.SpecularColor();
+		return s.SurfaceMaterial().SpecularColor();
 	} else {
 		// Computes the color using UV coordinates
-		float u = p.b1()*u1_ + p.b2()*u2_ + p.b3()*u3_;
-		float v = p.b1()*v1_ + p.b2()*v2_ + p.b3()*v3_;
-		u *= specular_texture_->height();
-		v *= specular_texture_->width();
-		double r = (*specular_texture_)(u, v, 0, 0) / 256.;
-		double g = (*specular_texture_)(u, v, 0, 1) / 256.;
-		double b = (*specular_texture_)(u, v, 0, 2) / 256.;
-		return Vector{r, g, b};
+		const Vector &bary = s.BarycentricCoordinates();
+		float u = bary.x()*u1_ + bary.y()*u2_ + bary.z()*u3_;
+		float v = bary.x()*v1_ + bary.y()*v2_ + bary.z()*v3_;
+		if (s.HasDifferentials()) {
+			// Mip level matching the footprint of the Ray
+			return specular_texture_->Trilinear(u, v, specular_texture_->LevelOfDetail(
+				s.DuDx(), s.DvDx(), s.DuDy(), s.DvDy()
+			));
+		}
+		return specular_texture_->Bilinear(u, v);
 	}
 }
 
@@ -204,6 +328,15 @@ Intersection AABB::Intersect(const Ray &r) const {
 }
 
 
+double AABB::EntryDistance(const Ray &r) const {
+	const double origin[3] = {r.Origin().x(), r.Origin().y(), r.Origin().z()};
+	const double inv_direction[3] = {
+		1/r.Direction().x(), 1/r.Direction().y(), 1/r.Direction().z()
+	};
+	return EntryDistance(origin, inv_direction);
+}
+
+
 Vector AABB::Normal(const Point &p) const {
 	return Vector{1, 0, 0};
 }
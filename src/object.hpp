@@ -9,13 +9,242 @@
 #include <memory>
 #include <random>
 #include <chrono>
-#include "CImg.h"
+#include <algorithm>
+#include <limits>
 #include "utils.hpp"
 #include "material.hpp"
+#include "texture_cache.hpp"
 
 
 class AABB;
+class Camera;
+class CompressedMesh;
 class Mesh;
+class SphereCloud;
+
+
+/**
+ * \enum PrimitiveType
+ * \brief Type of the RawObject contained in an Object, used to store
+ *        primitives in typed arrays without virtual dispatch.
+ */
+enum class PrimitiveType {
+	kSphere,   //!< Sphere.
+	kPlane,    //!< Plane.
+	kTriangle, //!< Triangle.
+	kMeshInstance, //!< MeshInstance.
+	kOther     //!< Any other RawObject (Mesh, AABB...).
+};
+
+
+class RawObject;
+
+
+/**
+ * \class SurfaceInteraction
+ * \brief Shading data at the closest intersection point of a Ray, computed
+ *        once by RawObject::Interact after traversal.
+ */
+class SurfaceInteraction {
+private:
+	Point point_;   //!< Intersection point, slightly before the surface.
+	Vector normal_; //!< Well-oriented normalized normal at point_.
+
+	/// Barycentric coordinates of point_ in the hit triangle, if relevant.
+	Vector barycentric_;
+
+	const Material *material_; //!< Material of the surface at point_.
+	const RawObject *object_;  //!< Object responsible for the colors.
+	size_t primitive_; //!< Identifier of the hit primitive inside source_.
+
+	/// Object hit by the Ray, left by the rays spawned from the surface; it
+	/// differs from object_ for instances of meshes.
+	const RawObject *source_;
+
+	/// Indicates if the differentials below are set.
+	bool has_differentials_ = false;
+	Vector point_dx_; //!< Derivative of point_ along the image width.
+	Vector point_dy_; //!< Derivative of point_ along the image height.
+	double uv_dx_[2] = {0, 0}; //!< Derivatives of (u, v) along the width.
+	double uv_dy_[2] = {0, 0}; //!< Derivatives of (u, v) along the height.
+
+public:
+	/// Angular spread, in radians, given to the direction differentials of
+	/// diffuse rays, whose directions are not derived from the incoming Ray.
+	static constexpr double kDiffuseSpread = 0.1;
+
+	/// Constructs a SurfaceInteraction from all its defining fields.
+	SurfaceInteraction(
+		const Point &point,
+		const Vector &normal,
+		const Vector &barycentric,
+		const Material &material,
+		const RawObject &object,
+		size_t primitive=0
+	) :
+		point_{point},
+		normal_{normal},
+		barycentric_{barycentric},
+		material_{&material},
+		object_{&object},
+		primitive_{primitive},
+		source_{&object}
+	{
+	}
+
+	/// Outputs the intersection point.
+	inline const Point& HitPoint() const {
+		return point_;
+	}
+
+	/// Outputs the normal at the intersection point.
+	inline const Vector& Normal() const {
+		return normal_;
+	}
+
+	/// Outputs the barycentric coordinates of the intersection point.
+	inline const Vector& BarycentricCoordinates() const {
+		return barycentric_;
+	}
+
+	/// Outputs the Material of the surface at the intersection point.
+	inline const Material& SurfaceMaterial() const {
+		return *material_;
+	}
+
+	/// Outputs the object responsible for the colors of the surface.
+	inline const RawObject& Object() const {
+		return *object_;
+	}
+
+	/// Outputs the identifier of the hit primitive inside the object hit by
+	/// the Ray.
+	inline size_t Primitive() const {
+		return primitive_;
+	}
+
+	/// Sets the object hit by the Ray, when it is not the one responsible for
+	/// the colors.
+	inline void SetSource(const RawObject &object) {
+		source_ = &object;
+	}
+
+	/// Outputs the diffuse color of the surface at the intersection point.
+	inline Vector DiffuseColor() const;
+
+	/// Outputs the specular color of the surface at the intersection point.
+	inline Vector SpecularColor() const;
+
+	/**
+	 * \fn void ComputeDifferentials(const Ray &r, double t, const Vector &plane_normal)
+	 * \brief Computes the derivatives of the intersection point by
+	 *        transferring the differentials of the input Ray, if any, to the
+	 *        plane of normal plane_normal hit at distance t.
+	 */
+	void ComputeDifferentials(
+		const Ray &r, double t, const Vector &plane_normal
+	);
+
+	/// Computes the derivatives of the intersection point, using the plane
+	/// tangent to the surface at the intersection point.
+	inline void ComputeDifferentials(const Ray &r, double t) {
+		ComputeDifferentials(r, t, normal_);
+	}
+
+	/// Sets the derivatives of the UV coordinates along the image width and
+	/// height.
+	inline void SetUVDifferentials(
+		double du_dx, double dv_dx, double du_dy, double dv_dy
+	) {
+		uv_dx_[0] = du_dx;
+		uv_dx_[1] = dv_dx;
+		uv_dy_[0] = du_dy;
+		uv_dy_[1] = dv_dy;
+	}
+
+	/// Indicates if the differentials of the intersection point are set.
+	inline bool HasDifferentials() const {
+		return has_differentials_;
+	}
+
+	/// Outputs the derivative of the intersection point along the width.
+	inline const Vector& PointDx() const {
+		return point_dx_;
+	}
+
+	/// Outputs the derivative of the intersection point along the height.
+	inline const Vector& PointDy() const {
+		return point_dy_;
+	}
+
+	/// Outputs the derivative of the u coordinate along the width.
+	inline double DuDx() const {
+		return uv_dx_[0];
+	}
+
+	/// Outputs the derivative of the v coordinate along the width.
+	inline double DvDx() const {
+		return uv_dx_[1];
+	}
+
+	/// Outputs the derivative of the u coordinate along the height.
+	inline double DuDy() const {
+		return uv_dy_[0];
+	}
+
+	/// Outputs the derivative of the v coordinate along the height.
+	inline double DvDy() const {
+		return uv_dy_[1];
+	}
+
+	/**
+	 * \fn Ray Spawn(const Point &origin, const Vector &direction) const
+	 * \brief Outputs the Ray leaving the surface from origin in the input
+	 *        direction, without differentials (e.g. a shadow ray).
+	 *
+	 * As the Rays given by the methods below, it records the surface it
+	 * leaves (see Ray::SetSource).
+	 */
+	Ray Spawn(const Point &origin, const Vector &direction) const;
+
+	/**
+	 * \fn Ray SpawnReflected(const Ray &r, const Point &origin, const Vector &direction) const
+	 * \brief Outputs the Ray leaving origin in the input direction, mirror of
+	 *        the direction of r, with propagated differentials.
+	 *
+	 * The surface is assumed to be locally flat (the derivatives of the
+	 * normal are neglected).
+	 */
+	Ray SpawnReflected(
+		const Ray &r, const Point &origin, const Vector &direction
+	) const;
+
+	/**
+	 * \fn Ray SpawnRefracted(const Ray &r, const Point &origin, const Vector &direction, double eta) const
+	 * \brief Outputs the Ray leaving origin in the input direction,
+	 *        refraction of r with relative index eta, with propagated
+	 *        differentials.
+	 *
+	 * The surface is assumed to be locally flat.
+	 */
+	Ray SpawnRefracted(
+		const Ray &r, const Point &origin, const Vector &direction,
+		double eta
+	) const;
+
+	/**
+	 * \fn Ray SpawnDiffuse(const Vector &direction, const Vector &ortho1, const Vector &ortho2) const
+	 * \brief Outputs the Ray leaving the intersection point in the input
+	 *        direction, sampled around the normal; ortho1 and ortho2 complete
+	 *        the normal into an orthonormal basis.
+	 *
+	 * The direction differentials are set to kDiffuseSpread along ortho1 and
+	 * ortho2.
+	 */
+	Ray SpawnDiffuse(
+		const Vector &direction, const Vector &ortho1, const Vector &ortho2
+	) const;
+};
 
 
 /**
@@ -48,23 +277,45 @@ public:
 	virtual AABB BoundingBox() const = 0;
 
 	/**
-	 * \fn virtual Vector DiffuseColor(const Point &p) const
+	 * \fn virtual SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const
+	 * \brief Computes the shading data at the closest Intersection found for
+	 *        the input Ray.
+	 * \param inter Non-empty Intersection of r whose object is this one.
+	 *
+	 * By default, uses the point of the Ray at the intersection distance, the
+	 * normal given by Normal and the Material of the object, and transfers
+	 * the differentials of the Ray to the tangent plane.
+	 */
+	virtual SurfaceInteraction Interact(
+		const Ray &r,
+		const Intersection &inter
+	) const {
+		Point p = r(inter.Distance());
+		SurfaceInteraction s{
+			p, Normal(p), Vector{1, 0, 0}, material_, *this, inter.Primitive()
+		};
+		s.ComputeDifferentials(r, inter.Distance());
+		return s;
+	}
+
+	/**
+	 * \fn virtual Vector DiffuseColor(const SurfaceInteraction &s) const
 	 * \brief Outputs the diffuse color of the object at the input point.
 	 *
-	 * By default, corresponds to the material's diffuse color.
+	 * By default, corresponds to the surface material's diffuse color.
 	 */
-	virtual Vector DiffuseColor(const Point &p) const {
-		return material_.DiffuseColor();
+	virtual Vector DiffuseColor(const SurfaceInteraction &s) const {
+		return s.SurfaceMaterial().DiffuseColor();
 	}
 
 	/**
-	 * \fn virtual Vector SpecularColor(const Point &p) const
+	 * \fn virtual Vector SpecularColor(const SurfaceInteraction &s) const
 	 * \brief Outputs the specular color of the object at the input point.
 	 *
-	 * By default, corresponds to the material's specular color.
+	 * By default, corresponds to the surface material's specular color.
 	 */
-	virtual Vector SpecularColor(const Point &p) const {
-		return material_.SpecularColor();
+	virtual Vector SpecularColor(const SurfaceInteraction &s) const {
+		return s.SurfaceMaterial().SpecularColor();
 	}
 
 	/// Outputs the Material of the object.
@@ -79,11 +330,21 @@ public:
 };
 
 
+Vector SurfaceInteraction::DiffuseColor() const {
+	return object_->DiffuseColor(*this);
+}
+
+
+Vector SurfaceInteraction::SpecularColor() const {
+	return object_->SpecularColor(*this);
+}
+
+
 /**
  * \class Sphere
  * \brief Sphere object, defined by a center and a radius.
  */
-class Sphere : public RawObject {
+class Sphere final : public RawObject {
 private:
 	const double radius_; //!< Radius of the Sphere.
 	const Point center_;  //!< Center point of the Sphere.
@@ -101,6 +362,16 @@ public:
 	{
 	}
 
+	/// Outputs the radius of the Sphere.
+	inline double Radius() const {
+		return radius_;
+	}
+
+	/// Outputs the center of the Sphere.
+	inline const Point& Center() const {
+		return center_;
+	}
+
 	Intersection Intersect(const Ray &r) const;
 
 	Vector Normal(const Point &p) const;
@@ -113,7 +384,7 @@ public:
  * \class Plane
  * \brief Plane object, defined by a point and a normal.
  */
-class Plane : public RawObject {
+class Plane final : public RawObject {
 private:
 	const Point point_;   //!< Point of the Plane.
 	const Vector normal_; //!< Normal of the Plane, assumed to be normalized.
@@ -144,11 +415,11 @@ public:
  * \brief Triangle object, defines by three points, possibly associated to a
  *        texture.
  */
-class Triangle : public RawObject {
+class Triangle final : public RawObject {
 private:
-	const Point p1_; //!< First point defining the Triangle.
-	const Point p2_; //!< Second point defining the Triangle.
-	const Point p3_; //!< Third point defining the Triangle.
+	Point p1_; //!< First point defining the Triangle.
+	Point p2_; //!< Second point defining the Triangle.
+	Point p3_; //!< Third point defining the Triangle.
 
 	/**
 	 * \brief Normal of the embedding plane of the Triangle.
@@ -161,18 +432,18 @@ private:
 	Vector normal3_; //!< Normal of the triangle at the third vertex.
 
 	/// Diffuse texture associated to this triangle.
-	const std::shared_ptr<cimg_library::CImg<unsigned char>> diffuse_texture_;
+	std::shared_ptr<const Texture> diffuse_texture_;
 
 	/// Specular texture associated to this triangle.
-	const std::shared_ptr<cimg_library::CImg<unsigned char>> specular_texture_;
+	std::shared_ptr<const Texture> specular_texture_;
 
-	const bool has_uv_coordinates_; //!< Shows the validity of UV coordinates.
-	const float u1_; //!< First UV coordinate associated to p1_.
-	const float v1_; //!< Second UV coordinate associated to p1_.
-	const float u2_; //!< First UV coordinate associated to p2_.
-	const float v2_; //!< Second UV coordinate associated to p2_.
-	const float u3_; //!< First UV coordinate associated to p3_.
-	const float v3_; //!< Second UV coordinate associated to p3_.
+	bool has_uv_coordinates_; //!< Shows the validity of UV coordinates.
+	float u1_; //!< First UV coordinate associated to p1_.
+	float v1_; //!< Second UV coordinate associated to p1_.
+	float u2_; //!< First UV coordinate associated to p2_.
+	float v2_; //!< Second UV coordinate associated to p2_.
+	float u3_; //!< First UV coordinate associated to p3_.
+	float v3_; //!< Second UV coordinate associated to p3_.
 
 	/**
 	 * \fn Vector BarycenticCoordinates(const Point &p) const
@@ -185,8 +456,17 @@ private:
 	Vector BarycenticCoordinates(const Point &p) const;
 
 public:
+	/// Default constructor, building a degenerate Triangle. Used to preallocate
+	/// arrays of triangles that are filled afterwards.
+	Triangle() :
+		RawObject{Material{}, true},
+		has_uv_coordinates_{false},
+		u1_{0}, v1_{0}, u2_{0}, v2_{0}, u3_{0}, v3_{0}
+	{
+	}
+
 	/**
-	 * \fn Triangle(const Point &p1, const Point &p2, const Point &p3, const Vector &normal1, const Vector &normal2, const Vector &normal3, const std::shared_ptr<cimg_library::CImg<unsigned char>> &diffuse_texture, const std::shared_ptr<cimg_library::CImg<unsigned char>> &specular_texture, bool has_uv_coordinates, float u1, float v1, float u2, float v2, float u3, float v3, const Material &material=Material{})
+	 * \fn Triangle(const Point &p1, const Point &p2, const Point &p3, const Vector &normal1, const Vector &normal2, const Vector &normal3, const std::shared_ptr<const Texture> &diffuse_texture, const std::shared_ptr<const Texture> &specular_texture, bool has_uv_coordinates, float u1, float v1, float u2, float v2, float u3, float v3, const Material &material=Material{})
 	 * \brief Complete constructor of Triangle.
 	 * \param p1, p2, p3 Vertices of the triangle.
 	 * \param normal1, normal2, normal3 Normals corresponding to each vertex of
@@ -205,10 +485,8 @@ public:
 		const Vector &normal1,
 		const Vector &normal2,
 		const Vector &normal3,
-		const std::shared_ptr<cimg_library::CImg<unsigned char>> &
-			diffuse_texture,
-		const std::shared_ptr<cimg_library::CImg<unsigned char>> &
-			specular_texture,
+		const std::shared_ptr<const Texture> &diffuse_texture,
+		const std::shared_ptr<const Texture> &specular_texture,
 		bool has_uv_coordinates,
 		float u1,
 		float v1,
@@ -245,6 +523,16 @@ public:
 		}
 	}
 
+	/// Outputs the i-th vertex of the triangle, for i in {0, 1, 2}.
+	inline const Point& Vertex(unsigned int i) const {
+		return i == 0 ? p1_ : (i == 1 ? p2_ : p3_);
+	}
+
+	/// Outputs the area of the triangle.
+	inline double Area() const {
+		return ((p2_-p1_)^(p3_-p1_)).Norm() / 2;
+	}
+
 	/// Indicates if this triangle is associated to a diffuse texture.
 	inline bool HasDiffuseTexture() const {
 		return static_cast<bool>(diffuse_texture_);
@@ -261,8 +549,8 @@ public:
 	 * \fn Vector Normal(const Point &p) const
 	 * \brief Compute the normal at the given point using its barycentric
 	 *        coordinates.
-	 * \note The input point should contain the barycentric coordinates
- 	 *       corresponding to this Triangle.
+	 * \note The input point is assumed to lie in the embedding plane of the
+	 *       Triangle.
 	 *
 	 * Smooths the normals of the triangle by computing them using a combination
 	 * of the normals of the triangle's vertices, weighted by the barycentic
@@ -273,20 +561,27 @@ public:
 	AABB BoundingBox() const;
 
 	/**
-	 * \fn Vector DiffuseColor(const Point &p) const
+	 * \fn SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const
+	 * \brief Computes the shading data from the barycentric coordinates
+	 *        recorded in the Intersection, without projecting the point again.
+	 */
+	SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const;
+
+	/**
+	 * \fn Vector DiffuseColor(const SurfaceInteraction &s) const
 	 * \brief Computes the diffuse color of the triangle at a given point.
-	 * \note The input point should contain the barycentric coordinates
+	 * \note The input surface data should contain the barycentric coordinates
  	 *       corresponding to this Triangle.
 	 */
-	Vector DiffuseColor(const Point &p) const;
+	Vector DiffuseColor(const SurfaceInteraction &s) const;
 
 	/**
-	 * \fn Vector SpecularColor(const Point &p) const
+	 * \fn Vector SpecularColor(const SurfaceInteraction &s) const
 	 * \brief Computes the specular color of the triangle at a given point.
-	 * \note The input point should contain the barycentric coordinates
+	 * \note The input surface data should contain the barycentric coordinates
  	 *       corresponding to this Triangle.
 	 */
-	Vector SpecularColor(const Point &p) const;
+	Vector SpecularColor(const SurfaceInteraction &s) const;
 };
 
 
@@ -356,6 +651,39 @@ public:
 
 	Intersection Intersect(const Ray &r) const;
 
+	/**
+	 * \fn double EntryDistance(const Ray &r) const
+	 * \brief Outputs the distance at which the input Ray enters the box, 0 if
+	 *        its origin lies in the box, or infinity if it misses the box.
+	 */
+	double EntryDistance(const Ray &r) const;
+
+	/**
+	 * \fn double EntryDistance(const double origin[3], const double inv_direction[3]) const
+	 * \brief Same as EntryDistance(const Ray&), given the origin and the
+	 *        inverse of the direction of the Ray, which can thus be computed
+	 *        once for many boxes.
+	 */
+	inline double EntryDistance(
+		const double origin[3], const double inv_direction[3]
+	) const {
+		double t_x1 = (p1_.x() - origin[0])*inv_direction[0];
+		double t_x2 = (p2_.x() - origin[0])*inv_direction[0];
+		double t_y1 = (p1_.y() - origin[1])*inv_direction[1];
+		double t_y2 = (p2_.y() - origin[1])*inv_direction[1];
+		double t_z1 = (p1_.z() - origin[2])*inv_direction[2];
+		double t_z2 = (p2_.z() - origin[2])*inv_direction[2];
+		double t_min = std::max(std::max(
+			std::min(t_x1, t_x2), std::min(t_y1, t_y2)), std::min(t_z1, t_z2));
+		double t_max = std::min(std::min(
+			std::max(t_x1, t_x2), std::max(t_y1, t_y2)), std::max(t_z1, t_z2));
+		if (t_min > t_max || t_max <= 0) {
+			return std::numeric_limits<double>::infinity();
+		} else {
+			return std::max(t_min, 0.);
+		}
+	}
+
 	/// \warning Does not return the normal of the object. Should not be used.
 	Vector Normal(const Point &p) const;
 
@@ -368,6 +696,129 @@ public:
 };
 
 
+/**
+ * \class MeshInstance
+ * \brief Placed copy of a shared Mesh, defined by a Transform from the space
+ *        of the Mesh to the scene and an optional Material.
+ *
+ * Rays are transformed into the space of the Mesh during traversal, so that an
+ * instance only stores the inverse Transform and a pointer to the Mesh.
+ *
+ * If the Mesh has several levels of detail, an instance intersects the level
+ * chosen for it (see SelectLevel), or, if enabled, the level matching the
+ * footprint of each Ray carrying differentials.
+ */
+class MeshInstance final : public RawObject {
+private:
+	/// Position of the level of detail in the primitive identifiers of the
+	/// Intersections; the lower bits hold the index of the triangle.
+	static const int kLevelShift = 48;
+
+	std::shared_ptr<const Mesh> mesh_; //!< Instanced Mesh.
+
+	/// Transform from the scene to the space of the Mesh.
+	Transform world_to_mesh_;
+
+	/// Indicates if material_ replaces the materials of the Mesh (textures
+	/// included).
+	bool override_material_;
+
+	unsigned int level_ = 0;     //!< Level of detail of the instance.
+	bool per_ray_level_ = false; //!< Indicates if rays choose their level.
+
+	/// Transforms the input Ray into the space of the Mesh.
+	/// \param scale Output ratio between distances along the transformed Ray
+	///        and along the input one.
+	Ray ToMesh(const Ray &r, double &scale) const;
+
+	/**
+	 * \fn unsigned int RayLevel(const Ray &r, const Ray &mesh_ray, double scale) const
+	 * \brief Outputs the level of detail matching the footprint of the input
+	 *        Ray where it enters the Mesh, or level_ if it has no
+	 *        differentials. Rays leaving the instance keep the level of the
+	 *        surface they leave.
+	 */
+	unsigned int RayLevel(const Ray &r, const Ray &mesh_ray, double scale) const;
+
+public:
+	/**
+	 * \fn MeshInstance(const std::shared_ptr<const Mesh> &mesh, const Transform &mesh_to_world)
+	 * \brief Places the input Mesh in the scene, keeping its materials.
+	 * \param mesh_to_world Transform from the space of the Mesh to the scene.
+	 */
+	MeshInstance(
+		const std::shared_ptr<const Mesh> &mesh,
+		const Transform &mesh_to_world
+	) :
+		RawObject{Material{}, false},
+		mesh_{mesh},
+		world_to_mesh_{mesh_to_world.Inverse()},
+		override_material_{false}
+	{
+	}
+
+	/// Places the input Mesh in the scene, with the given Material for all its
+	/// triangles.
+	MeshInstance(
+		const std::shared_ptr<const Mesh> &mesh,
+		const Transform &mesh_to_world,
+		const Material &material
+	) :
+		RawObject{material, false},
+		mesh_{mesh},
+		world_to_mesh_{mesh_to_world.Inverse()},
+		override_material_{true}
+	{
+	}
+
+	/// Sets the level of detail of the instance.
+	inline void SetLevel(unsigned int level) {
+		level_ = level;
+	}
+
+	/// Outputs the level of detail of the instance.
+	inline unsigned int Level() const {
+		return level_;
+	}
+
+	/**
+	 * \fn void SelectLevel(const Camera &camera)
+	 * \brief Sets the level of detail of the instance from its projected
+	 *        size: the coarsest level whose triangles are not larger than a
+	 *        pixel at the distance between the Camera and the instance.
+	 * \note Scenes select the level of their instances when they are built,
+	 *       which overrides SetLevel.
+	 */
+	void SelectLevel(const Camera &camera);
+
+	/// Enables or disables the choice of the level of detail from the
+	/// footprint of each Ray. Rays spawned from the instance use the level of
+	/// the surface they leave; other rays without differentials use the level
+	/// of the instance.
+	inline void SetPerRayLevel(bool per_ray_level) {
+		per_ray_level_ = per_ray_level;
+	}
+
+	/**
+	 * \fn Intersection Intersect(const Ray &r) const
+	 * \brief Intersects the Mesh with the transformed Ray; the primitive
+	 *        identifier of the Intersection encodes the level of detail and
+	 *        the index of the hit triangle in this level.
+	 */
+	Intersection Intersect(const Ray &r) const;
+
+	/// \warning Does not return the normal of the object. Normals to individual
+	///          triangles are computed by Interact.
+	Vector Normal(const Point &p) const;
+
+	AABB BoundingBox() const;
+
+	/// Computes the shading data on the hit triangle and transforms it back
+	/// into the scene.
+	SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const;
+};
+
+
 /**
  * \class Object
  * \brief Class representing a wrapper of a RawObject
@@ -378,29 +829,34 @@ public:
 class Object {
 private:
 	std::shared_ptr<RawObject> raw_object_; //!< RawObject contained in the Object.
+	PrimitiveType type_; //!< Type of the contained RawObject.
 
 public:
 	/// Creates an empty / invisible object.
 	Object() :
-		raw_object_{new Sphere(Sphere(-1, Point(0, 0, 0), Material{}))}
+		raw_object_{new Sphere(Sphere(-1, Point(0, 0, 0), Material{}))},
+		type_{PrimitiveType::kSphere}
 	{
 	}
 
 	/// Creates an object from a Sphere.
 	Object(const Sphere &s) :
-		raw_object_{new Sphere{s}}
+		raw_object_{new Sphere{s}},
+		type_{PrimitiveType::kSphere}
 	{
 	}
 
 	/// Creates an object from a Plane.
 	Object(const Plane &plane) :
-		raw_object_{new Plane{plane}}
+		raw_object_{new Plane{plane}},
+		type_{PrimitiveType::kPlane}
 	{
 	}
 
 	/// Creates an object from a Triangle.
 	Object(const Triangle &triangle) :
-		raw_object_{new Triangle{triangle}}
+		raw_object_{new Triangle{triangle}},
+		type_{PrimitiveType::kTriangle}
 	{
 	}
 
@@ -411,12 +867,44 @@ public:
 	 */
 	Object(Mesh &mesh);
 
+	/**
+	 * \fn Object(SphereCloud &cloud)
+	 * \brief Creates an object from a SphereCloud.
+	 * \warning Empties the input cloud.
+	 */
+	Object(SphereCloud &cloud);
+
+	/**
+	 * \fn Object(CompressedMesh &mesh)
+	 * \brief Creates an object from a CompressedMesh.
+	 * \warning Empties the input mesh.
+	 */
+	Object(CompressedMesh &mesh);
+
+	/// Creates an object from a MeshInstance.
+	Object(const MeshInstance &instance) :
+		raw_object_{new MeshInstance{instance}},
+		type_{PrimitiveType::kMeshInstance}
+	{
+	}
+
 	/// Creates an object from an AABB.
 	Object(const AABB &aabb) :
-		raw_object_{new AABB{aabb}}
+		raw_object_{new AABB{aabb}},
+		type_{PrimitiveType::kOther}
 	{
 	}
 
+	/// Outputs the type of the contained RawObject.
+	inline PrimitiveType Type() const {
+		return type_;
+	}
+
+	/// Outputs the contained RawObject, whose dynamic type is given by Type().
+	inline const RawObject& Raw() const {
+		return *raw_object_;
+	}
+
 	/// Outputs the Material of the object.
 	inline const Material& ObjectMaterial() const {
 		return raw_object_->ObjectMaterial();
@@ -4,15 +4,117 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <limits>
 #include "object_container.hpp"
 
 
+void ObjectContainer::IntersectBatch(
+	const std::vector<Ray> &rays,
+	std::vector<Intersection> &intersections
+) const {
+	intersections.assign(rays.size(), Intersection{empty_object_});
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (size_t i=0; i<rays.size(); i++) {
+		intersections[i] = Intersect(rays[i]);
+	}
+}
+
+
+PrimitiveReference PrimitiveArrays::Add(const Object &o) {
+	switch (o.Type()) {
+		case PrimitiveType::kSphere : {
+			spheres_.push_back(static_cast<const Sphere&>(o.Raw()));
+			return {PrimitiveType::kSphere,
+				static_cast<unsigned int>(spheres_.size()-1)};
+		}
+		case PrimitiveType::kPlane : {
+			planes_.push_back(static_cast<const Plane&>(o.Raw()));
+			return {PrimitiveType::kPlane,
+				static_cast<unsigned int>(planes_.size()-1)};
+		}
+		case PrimitiveType::kTriangle : {
+			triangles_.push_back(static_cast<const Triangle&>(o.Raw()));
+			return {PrimitiveType::kTriangle,
+				static_cast<unsigned int>(triangles_.size()-1)};
+		}
+		case PrimitiveType::kMeshInstance : {
+			instances_.push_back(static_cast<const MeshInstance&>(o.Raw()));
+			return {PrimitiveType::kMeshInstance,
+				static_cast<unsigned int>(instances_.size()-1)};
+		}
+		default : {
+			others_.push_back(o);
+			return {PrimitiveType::kOther,
+				static_cast<unsigned int>(others_.size()-1)};
+		}
+	}
+}
+
+
+unsigned int PrimitiveArrays::AddTriangles(std::vector<Triangle> &&triangles) {
+	unsigned int first = triangles_.size();
+	if (triangles_.empty()) {
+		triangles_ = std::move(triangles);
+	} else {
+		triangles_.insert(
+			triangles_.end(),
+			std::make_move_iterator(triangles.begin()),
+			std::make_move_iterator(triangles.end())
+		);
+	}
+	return first;
+}
+
+
+void PrimitiveArrays::SelectLevels(const Camera &camera) {
+	for (auto &instance : instances_) {
+		instance.SelectLevel(camera);
+	}
+}
+
+
+void PrimitiveArrays::IntersectClosest(
+	const Ray &r, Intersection &closest
+) const {
+	// Find the nearest intersection by traversing each array of objects
+	for (const auto &o : spheres_) {
+		Intersection inter = o.Intersect(r);
+		if (inter < closest) {
+			closest = inter;
+		}
+	}
+	for (const auto &o : planes_) {
+		Intersection inter = o.Intersect(r);
+		if (inter < closest) {
+			closest = inter;
+		}
+	}
+	for (const auto &o : triangles_) {
+		Intersection inter = o.Intersect(r);
+		if (inter < closest) {
+			closest = inter;
+		}
+	}
+	for (const auto &o : instances_) {
+		Intersection inter = o.Intersect(r);
+		if (inter < closest) {
+			closest = inter;
+		}
+	}
+	for (const auto &o : others_) {
+		Intersection inter = o.Intersect(r);
+		if (inter < closest) {
+			closest = inter;
+		}
+	}
+}
+
+
 Intersection ObjectVector::Intersect(const Ray &r) const {
-	// Find the nearest intersection by traversing the vector of objects
 	Intersection inter{empty_object_};
-	for (const auto &o : objects_) {
-		inter = inter | o.Intersect(r);
-	}
+	objects_.IntersectClosest(r, inter);
 	return inter;
 }
 
@@ -37,40 +139,216 @@ bool BVH::CompareCentroids(int i, const AABB &o1, const AABB &o2) {
 
 
 Intersection BVH::Intersect(const Ray &r) const {
+	Intersection inter{empty_object_};
+	double entry = bounding_box_.EntryDistance(r);
+	if (primitives_ && entry < std::numeric_limits<double>::infinity()) {
+		IntersectClosest(r, entry, inter);
+	}
+	return inter;
+}
+
+
+void BVH::IntersectClosest(
+	const Ray &r, double entry, Intersection &closest
+) const {
+	// Nothing in this node can be closer than the current intersection
+	if (!closest.IsEmpty() && entry > closest.Distance()) {
+		return;
+	}
 	if (IsLeaf()) {
-		// First check bounding box
-		if (!bounding_box_.Intersect(r).IsEmpty()) {
-			return object_.Intersect(r);
-		} else {
-			return Intersection{empty_object_};
-		}
-	} else if (!bounding_box_.Intersect(r).IsEmpty()) {
-		Intersection inter_child1 = child1_->Intersect(r);
-		Intersection inter_aabb_child2 = child2_->bounding_box_.Intersect(r);
-		// If the intersection with the second child's bounding box arises
-		// after the intersection with the first child, then it is over
-		if (inter_child1 < inter_aabb_child2) {
-			return inter_child1;
-		} else {
-			// Otherwise, test also the second child
-			auto inter_child2 = child2_->Intersect(r);
-			return inter_child1 | inter_child2;
+		Intersection inter = primitives_->Intersect(primitive_, r);
+		if (inter < closest) {
+			closest = inter;
 		}
 	} else {
-		return Intersection{empty_object_};
+		// Visits the nearest child first, then the other one if it may still
+		// contain a closer intersection
+		double entry1 = child1_->bounding_box_.EntryDistance(r);
+		double entry2 = child2_->bounding_box_.EntryDistance(r);
+		const BVH *near = child1_.get();
+		const BVH *far = child2_.get();
+		if (entry2 < entry1) {
+			std::swap(near, far);
+			std::swap(entry1, entry2);
+		}
+		double inf = std::numeric_limits<double>::infinity();
+		if (entry1 < inf) {
+			near->IntersectClosest(r, entry1, closest);
+		}
+		if (entry2 < inf) {
+			far->IntersectClosest(r, entry2, closest);
+		}
 	}
 }
 
 
+void BVH::IntersectBatch(
+	const std::vector<Ray> &rays,
+	std::vector<Intersection> &intersections
+) const {
+	intersections.assign(rays.size(), Intersection{empty_object_});
+	if (!primitives_) {
+		return;
+	}
+	const double inf = std::numeric_limits<double>::infinity();
+	const size_t nb_chunks = (rays.size() + kPacketSize - 1) / kPacketSize;
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t chunk=0; chunk<nb_chunks; chunk++) {
+		size_t first = chunk*kPacketSize;
+		size_t last = std::min(rays.size(), first + kPacketSize);
+
+		// Rays of the chunk grouped by the signs of their direction, since
+		// only rays going the same way visit the children in the same order
+		size_t octants[8][kPacketSize];
+		unsigned int sizes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+		for (size_t r=first; r<last; r++) {
+			const Vector &direction = rays[r].Direction();
+			int octant = (direction.x() < 0) + 2*(direction.y() < 0)
+				+ 4*(direction.z() < 0);
+			octants[octant][sizes[octant]++] = r;
+		}
+
+		for (int octant=0; octant<8; octant++) {
+			if (sizes[octant] < kMinPacketSize) {
+				for (unsigned int i=0; i<sizes[octant]; i++) {
+					size_t r = octants[octant][i];
+					intersections[r] = Intersect(rays[r]);
+				}
+				continue;
+			}
+			Packet packet;
+			for (unsigned int i=0; i<sizes[octant]; i++) {
+				const Ray &ray = rays[octants[octant][i]];
+				const Point &origin = ray.Origin();
+				const Vector &direction = ray.Direction();
+				packet.rays[i] = &ray;
+				packet.closest[i] = &intersections[octants[octant][i]];
+				packet.origins[i][0] = origin.x();
+				packet.origins[i][1] = origin.y();
+				packet.origins[i][2] = origin.z();
+				packet.inv_directions[i][0] = 1/direction.x();
+				packet.inv_directions[i][1] = 1/direction.y();
+				packet.inv_directions[i][2] = 1/direction.z();
+				packet.t_max[i] = inf;
+			}
+			IntersectPacket(packet, 0, sizes[octant]);
+		}
+	}
+}
+
+
+void BVH::IntersectPacket(
+	Packet &packet, unsigned int first, unsigned int last
+) const {
+	const double inf = std::numeric_limits<double>::infinity();
+	auto enters = [&packet, inf](const BVH &node, unsigned int i) {
+		double entry = node.bounding_box_.EntryDistance(
+			packet.origins[i], packet.inv_directions[i]
+		);
+		return entry < inf && entry <= packet.t_max[i];
+	};
+
+	if (IsLeaf()) {
+		for (unsigned int i=first; i<last; i++) {
+			if (!enters(*this, i)) {
+				continue;
+			}
+			Intersection inter = primitives_->Intersect(
+				primitive_, *packet.rays[i]
+			);
+			if (inter < *packet.closest[i]) {
+				*packet.closest[i] = inter;
+				packet.t_max[i] = inter.Distance();
+			}
+		}
+		return;
+	}
+
+	// Range of the rays entering each child, from the first to the last one;
+	// rays in between are kept without being tested
+	auto range = [&](const BVH &node, unsigned int &begin, unsigned int &end) {
+		begin = first;
+		while (begin < last && !enters(node, begin)) {
+			begin++;
+		}
+		end = last;
+		while (end > begin && !enters(node, end-1)) {
+			end--;
+		}
+	};
+	unsigned int begin1, end1, begin2, end2;
+	range(*child1_, begin1, end1);
+	range(*child2_, begin2, end2);
+
+	// Visits first the child entered first by the first Ray entering both
+	const BVH *near = child1_.get();
+	const BVH *far = child2_.get();
+	unsigned int i = std::max(begin1, begin2);
+	if (begin1 < end1 && begin2 < end2 && i < std::min(end1, end2)
+		&& child2_->bounding_box_.EntryDistance(
+			packet.origins[i], packet.inv_directions[i])
+		< child1_->bounding_box_.EntryDistance(
+			packet.origins[i], packet.inv_directions[i]))
+	{
+		std::swap(near, far);
+		std::swap(begin1, begin2);
+		std::swap(end1, end2);
+	}
+	if (begin1 < end1) {
+		near->IntersectPacket(packet, begin1, end1);
+	}
+	// Rays brought closer by the near child are dropped by the slab tests of
+	// the far one, which compare entries with the updated t_max
+	if (begin2 < end2) {
+		far->IntersectPacket(packet, begin2, end2);
+	}
+}
+
+
+BVH::BVH(std::vector<Triangle> &&triangles) {
+	std::shared_ptr<PrimitiveArrays> primitives =
+		std::make_shared<PrimitiveArrays>();
+	unsigned int first = primitives->AddTriangles(std::move(triangles));
+	const std::vector<Triangle> &stored = primitives->Triangles();
+	std::vector<std::pair<PrimitiveReference, AABB>> objects(stored.size());
+	#pragma omp parallel for
+	for (size_t i=0; i<stored.size(); i++) {
+		objects[i] = {
+			{PrimitiveType::kTriangle, static_cast<unsigned int>(first + i)},
+			stored[i].BoundingBox()
+		};
+	}
+	primitives_ = primitives;
+	BuildRoot(objects);
+}
+
+
+void BVH::BuildRoot(std::vector<std::pair<PrimitiveReference, AABB>> &objects) {
+	if (objects.empty()) {
+		primitives_.reset();
+		return;
+	}
+
+	// Random initialization (uniform distribution over {0, 1, 2})
+	std::default_random_engine engine = std::default_random_engine(
+		std::chrono::high_resolution_clock::now().time_since_epoch().count()
+	);
+	std::uniform_int_distribution<int> distrib{0, 2};
+
+	// Builds the BVH
+	Build(objects.begin(), objects.end(), engine, distrib);
+}
+
+
 void BVH::Build(
-	std::vector<std::pair<Object, AABB>>::iterator first,
-	std::vector<std::pair<Object, AABB>>::iterator last,
+	std::vector<std::pair<PrimitiveReference, AABB>>::iterator first,
+	std::vector<std::pair<PrimitiveReference, AABB>>::iterator last,
 	std::default_random_engine &engine,
 	std::uniform_int_distribution<int> &distrib
 ) {
 	// If there is only one object, creates a leaf
 	if (last == first + 1) {
-		object_ = first->first;
+		primitive_ = first->first;
 		bounding_box_ = first->second;
 	} else if (last > first) {
 		// Otherwise, divide the set using a sort on a random coordinate and
@@ -81,14 +359,86 @@ void BVH::Build(
 		std::nth_element(
 			first, half, last,
 			[&coordinate](
-				const std::pair<Object, AABB> &o1,
-				const std::pair<Object, AABB> &o2
+				const std::pair<PrimitiveReference, AABB> &o1,
+				const std::pair<PrimitiveReference, AABB> &o2
 			) {
 				return CompareCentroids(coordinate, o1.second, o2.second);
 			}
 		);
-		child1_.reset(new BVH); child1_->Build(first, half, engine, distrib);
-		child2_.reset(new BVH); child2_->Build(half, last, engine, distrib);
+		child1_.reset(new BVH); child1_->primitives_ = primitives_;
+		child1_->Build(first, half, engine, distrib);
+		child2_.reset(new BVH); child2_->primitives_ = primitives_;
+		child2_->Build(half, last, engine, distrib);
 		bounding_box_ = child1_->bounding_box_ || child2_->bounding_box_;
 	}
 }
+
+
+std::vector<unsigned int> FlatBVH::Build(
+	const std::vector<Bounds> &items, unsigned int leaf_size,
+	unsigned int block
+) {
+	std::vector<unsigned int> order(items.size());
+	for (unsigned int i=0; i<order.size(); i++) {
+		order[i] = i;
+	}
+	nodes_.clear();
+	if (!items.empty()) {
+		// A balanced binary tree has less than 2n/leaf_size nodes
+		nodes_.reserve(2*(items.size()/block + 1));
+		BuildNode(order, items, 0, items.size(), leaf_size, block);
+		nodes_.shrink_to_fit();
+	}
+	return order;
+}
+
+
+void FlatBVH::BuildNode(
+	std::vector<unsigned int> &order, const std::vector<Bounds> &items,
+	unsigned int first, unsigned int last, unsigned int leaf_size,
+	unsigned int block
+) {
+	unsigned int index = nodes_.size();
+	nodes_.push_back(Node{});
+
+	// Bounding box of the items and of their centroids
+	Bounds bounds, centroids;
+	for (unsigned int i=first; i<last; i++) {
+		const Bounds &b = items[order[i]];
+		bounds.Grow(b);
+		for (int k=0; k<3; k++) {
+			centroids.min[k] = std::min(centroids.min[k], b.Centroid(k));
+			centroids.max[k] = std::max(centroids.max[k], b.Centroid(k));
+		}
+	}
+	nodes_[index].bounds = bounds;
+
+	// Creates a leaf if there are few enough items
+	if (last - first <= leaf_size) {
+		nodes_[index].first = first;
+		nodes_[index].count = last - first;
+		return;
+	}
+
+	// Otherwise, separates the items with a pivot on the median of the axis
+	// of largest extent, keeping the first half a multiple of block
+	int axis = 0;
+	for (int k=1; k<3; k++) {
+		if (centroids.max[k] - centroids.min[k]
+			> centroids.max[axis] - centroids.min[axis]) {
+			axis = k;
+		}
+	}
+	unsigned int nb_blocks = (last - first + block - 1) / block;
+	unsigned int middle = first + (nb_blocks/2)*block;
+	std::nth_element(
+		order.begin() + first, order.begin() + middle, order.begin() + last,
+		[&items, axis](unsigned int i1, unsigned int i2) {
+			return items[i1].Centroid(axis) < items[i2].Centroid(axis);
+		}
+	);
+	BuildNode(order, items, first, middle, leaf_size, block);
+	nodes_[index].first = nodes_.size();
+	nodes_[index].count = 0;
+	BuildNode(order, items, middle, last, leaf_size, block);
+}
@@ -6,9 +6,109 @@
 #pragma once
 
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include "object.hpp"
 
 
+/**
+ * \struct PrimitiveReference
+ * \brief Reference to a primitive stored in a PrimitiveArrays: the type of
+ *        the primitive and its index in the array of this type.
+ */
+struct PrimitiveReference {
+	PrimitiveType type; //!< Type of the primitive.
+	unsigned int index; //!< Index of the primitive in its typed array.
+};
+
+
+/**
+ * \class PrimitiveArrays
+ * \brief Stores objects in contiguous arrays, one per type of primitive.
+ *
+ * Spheres, planes and triangles are stored by value, so that they can be
+ * intersected without pointer chase nor virtual call; any other object (e.g.
+ * a Mesh) is kept in its Object wrapper.
+ */
+class PrimitiveArrays {
+private:
+	std::vector<Sphere> spheres_;     //!< Spheres of the set.
+	std::vector<Plane> planes_;       //!< Planes of the set.
+	std::vector<Triangle> triangles_; //!< Triangles of the set.
+	std::vector<MeshInstance> instances_; //!< Mesh instances of the set.
+	std::vector<Object> others_;      //!< Objects of any other type.
+
+public:
+	/**
+	 * \fn PrimitiveReference Add(const Object &o)
+	 * \brief Copies the RawObject contained in the input Object in the array
+	 *        of its type.
+	 * \warning Invalidates references to previously added primitives.
+	 */
+	PrimitiveReference Add(const Object &o);
+
+	/**
+	 * \fn unsigned int AddTriangles(std::vector<Triangle> &&triangles)
+	 * \brief Moves the input triangles at the end of the array of triangles,
+	 *        and outputs the index of the first one.
+	 * \warning Invalidates references to previously added primitives.
+	 */
+	unsigned int AddTriangles(std::vector<Triangle> &&triangles);
+
+	/// Selects the level of detail of each stored MeshInstance from the input
+	/// Camera (see MeshInstance::SelectLevel).
+	void SelectLevels(const Camera &camera);
+
+	/// Computes the Intersection between the referenced primitive and the
+	/// input Ray.
+	inline Intersection Intersect(
+		const PrimitiveReference &primitive,
+		const Ray &r
+	) const {
+		switch (primitive.type) {
+			case PrimitiveType::kSphere : {
+				return spheres_[primitive.index].Intersect(r);
+			}
+			case PrimitiveType::kPlane : {
+				return planes_[primitive.index].Intersect(r);
+			}
+			case PrimitiveType::kTriangle : {
+				return triangles_[primitive.index].Intersect(r);
+			}
+			case PrimitiveType::kMeshInstance : {
+				return instances_[primitive.index].Intersect(r);
+			}
+			default : {
+				return others_[primitive.index].Intersect(r);
+			}
+		}
+	}
+
+	/**
+	 * \fn void IntersectClosest(const Ray &r, Intersection &closest) const
+	 * \brief Replaces closest by the Intersection between the input Ray and
+	 *        the stored primitives, if one is closer, traversing each array in
+	 *        turn.
+	 */
+	void IntersectClosest(const Ray &r, Intersection &closest) const;
+
+	/// Outputs the stored spheres.
+	inline const std::vector<Sphere>& Spheres() const {
+		return spheres_;
+	}
+
+	/// Outputs the stored triangles.
+	inline const std::vector<Triangle>& Triangles() const {
+		return triangles_;
+	}
+
+	/// Outputs the stored objects of other types.
+	inline const std::vector<Object>& Others() const {
+		return others_;
+	}
+};
+
+
 /**
  * \class ObjectContainer
  * \brief Abstract class defining what methods a container of objects should
@@ -26,6 +126,21 @@ public:
 	 *        of this Ray.
 	 */
 	virtual Intersection Intersect(const Ray &r) const = 0;
+
+	/**
+	 * \fn virtual void IntersectBatch(const std::vector<Ray> &rays, std::vector<Intersection> &intersections) const
+	 * \brief Computes the closest Intersection of each Ray of a batch.
+	 * \param rays Rays to intersect, preferably sorted so that consecutive rays
+	 *        are coherent.
+	 * \param intersections Output vector, resized to the number of rays; its
+	 *        i-th element is the Intersection with the i-th Ray.
+	 *
+	 * The batch is processed in parallel, in the given order.
+	 */
+	virtual void IntersectBatch(
+		const std::vector<Ray> &rays,
+		std::vector<Intersection> &intersections
+	) const;
 };
 
 
@@ -35,7 +150,7 @@ public:
  */
 class ObjectVector : public ObjectContainer {
 private:
-	std::vector<Object> objects_; //!< vector used to store objects.
+	PrimitiveArrays objects_; //!< Typed arrays used to store objects.
 
 public:
 	/// Constructs an ObjectVector from an iterable containing objects.
@@ -43,9 +158,21 @@ public:
 	ObjectVector(
 		InputIterator first,
 		InputIterator last
-	) :
-		objects_{first, last}
-	{
+	) {
+		for (InputIterator it=first; it!=last; it++) {
+			objects_.Add(*it);
+		}
+	}
+
+	/// Outputs the stored objects.
+	inline const PrimitiveArrays& Primitives() const {
+		return objects_;
+	}
+
+	/// Selects the level of detail of each stored MeshInstance from the input
+	/// Camera.
+	inline void SelectLevels(const Camera &camera) {
+		objects_.SelectLevels(camera);
 	}
 
 	Intersection Intersect(const Ray &r) const;
@@ -61,12 +188,38 @@ public:
  */
 class BVH : public ObjectContainer {
 private:
+	/// Number of consecutive rays of a batch grouped into packets.
+	static const unsigned int kPacketSize = 64;
+
+	/// Minimal number of rays of a packet; rays with fewer companions going
+	/// the same way traverse the tree one by one.
+	static const unsigned int kMinPacketSize = 8;
+
+	/**
+	 * \struct Packet
+	 * \brief Rays of a batch traversing the tree together, with the data of
+	 *        their slab tests and their closest Intersections.
+	 */
+	struct Packet {
+		const Ray *rays[kPacketSize];         //!< Rays of the packet.
+		Intersection *closest[kPacketSize];  //!< Their closest Intersections.
+		double origins[kPacketSize][3];        //!< Origins of the rays.
+		double inv_directions[kPacketSize][3]; //!< Inverse directions.
+
+		/// Distance of the closest Intersection of each Ray, or infinity.
+		double t_max[kPacketSize];
+	};
+
 	std::unique_ptr<BVH> child1_; //!< First child of the node.
 	std::unique_ptr<BVH> child2_; //!< Second child of the node.
 	AABB bounding_box_;           //!< Bounding box of the BVH.
 
-	/// Object corresponding to the node. Only relevant if it is a leaf.
-	Object object_;
+	/// Primitives of the whole tree, shared by all its nodes. Null if the tree
+	/// is empty.
+	std::shared_ptr<const PrimitiveArrays> primitives_;
+
+	/// Primitive corresponding to the node. Only relevant if it is a leaf.
+	PrimitiveReference primitive_;
 
 	/**
 	 * \fn static bool CompareCentroids(int i, const AABB &o1, const AABB &o2)
@@ -78,6 +231,42 @@ private:
 	 */
 	static bool CompareCentroids(int i, const AABB &o1, const AABB &o2);
 
+	/**
+	 * \fn void IntersectClosest(const Ray &r, double entry, Intersection &closest) const
+	 * \brief Replaces closest by the Intersection between the input Ray and
+	 *        the objects of the BVH, if one is closer.
+	 * \param entry Distance at which r enters the bounding box of the node.
+	 *
+	 * Only the distance of the closest Intersection found so far is used to
+	 * prune the traversal: nodes whose bounding box is entered after it are
+	 * skipped, and the nearest child is always visited first.
+	 */
+	void IntersectClosest(
+		const Ray &r, double entry, Intersection &closest
+	) const;
+
+	/**
+	 * \fn void IntersectPacket(Packet &packet, unsigned int first, unsigned int last) const
+	 * \brief Replaces the closest Intersections of the rays [first, last) of
+	 *        the packet by the ones with the objects of the BVH, if closer.
+	 *
+	 * Each child is visited with the range from the first to the last Ray
+	 * entering its bounding box, near child first according to the first Ray
+	 * entering both, so that each node is fetched once per packet instead of
+	 * once per Ray. Rays in the middle of a range are only tested at the
+	 * leaves, which pays off if rays are coherent.
+	 */
+	void IntersectPacket(
+		Packet &packet, unsigned int first, unsigned int last
+	) const;
+
+	/**
+	 * \fn void BuildRoot(std::vector<std::pair<PrimitiveReference, AABB>> &objects)
+	 * \brief Builds the whole tree over the input references to primitives_,
+	 *        which is then shared by all nodes.
+	 */
+	void BuildRoot(std::vector<std::pair<PrimitiveReference, AABB>> &objects);
+
 public:
 	/// Default constructor.
 	BVH() {};
@@ -90,20 +279,29 @@ public:
 	) {
 		using namespace std;
 
-		// Temporary vector containing the objects to store and their AABB
-		vector<pair<Object, AABB>> objects;
-		for (vector<Object>::iterator it=first; it!=last; it++) {
-			objects.push_back({*it, it->BoundingBox()});
+		// Stores the objects in typed arrays, and builds a temporary vector
+		// containing references to them and their AABB
+		shared_ptr<PrimitiveArrays> primitives = make_shared<PrimitiveArrays>();
+		vector<pair<PrimitiveReference, AABB>> objects;
+		for (InputIterator it=first; it!=last; it++) {
+			objects.push_back({primitives->Add(*it), it->BoundingBox()});
 		}
+		primitives_ = primitives;
+		BuildRoot(objects);
+	}
 
-		// Random initialization (uniform distribution over {0, 1, 2})
-		default_random_engine engine = default_random_engine(
-			chrono::high_resolution_clock::now().time_since_epoch().count()
-		);
-		uniform_int_distribution<int> distrib{0, 2};
+	/**
+	 * \fn BVH(std::vector<Triangle> &&triangles)
+	 * \brief Constructs a BVH from triangles, moved directly into the typed
+	 *        array of the tree without being wrapped in Objects.
+	 *
+	 * The bounding boxes of the triangles are computed in parallel.
+	 */
+	explicit BVH(std::vector<Triangle> &&triangles);
 
-		// Builds the BVH
-		Build(objects.begin(), objects.end(), engine, distrib);
+	/// Indicates if the tree contains no object.
+	inline bool IsEmpty() const {
+		return !primitives_;
 	}
 
 	/// Indicates if the root node is a leaf.
@@ -116,6 +314,12 @@ public:
 		return bounding_box_;
 	}
 
+	/// Outputs the primitives of the tree. Should not be called on an empty
+	/// tree.
+	inline const PrimitiveArrays& Primitives() const {
+		return *primitives_;
+	}
+
 	/**
 	 * \fn Intersection Intersect(const Ray &r) const
 	 * \brief Tests the intersection of the input ray with the set of objects in
@@ -129,18 +333,36 @@ public:
 	 * associated object.
 	 *
 	 * Finally, if the BVH is not a leaf, this method computes the intersection
-	 * with its first child. If this intersection arises before the intersection
-	 * with its second child's bounding box, then it is the final intersection;
-	 * otherwise, it also tests the intersection with its second child and
-	 * outputs the closest one.
+	 * with the child whose bounding box is entered first. If this intersection
+	 * arises before the entry in the other child's bounding box, then it is the
+	 * final intersection; otherwise, it also tests the intersection with the
+	 * other child and keeps the closest one.
 	 */
 	Intersection Intersect(const Ray &r) const;
 
 	/**
-	 * \fn void Build(std::vector<std::pair<Object, AABB>>::iterator first, std::vector<std::pair<Object, AABB>>::iterator last, std::default_random_engine &engine, std::uniform_int_distribution<int> &distrib)
+	 * \fn void IntersectBatch(const std::vector<Ray> &rays, std::vector<Intersection> &intersections) const
+	 * \brief Computes the closest Intersection of each Ray of a batch, by
+	 *        packets of consecutive rays traversing the tree together (see
+	 *        IntersectPacket).
+	 *
+	 * Each group of kPacketSize consecutive rays is split by the signs of the
+	 * directions of its rays, and each part becomes a packet if it has at
+	 * least kMinPacketSize rays. Packets thus only form if consecutive rays
+	 * are coherent, i.e. if the batch is sorted (see Scene::RenderWavefront);
+	 * other rays are traced one by one as in Intersect.
+	 */
+	void IntersectBatch(
+		const std::vector<Ray> &rays,
+		std::vector<Intersection> &intersections
+	) const;
+
+	/**
+	 * \fn void Build(std::vector<std::pair<PrimitiveReference, AABB>>::iterator first, std::vector<std::pair<PrimitiveReference, AABB>>::iterator last, std::default_random_engine &engine, std::uniform_int_distribution<int> &distrib)
 	 * \brief Builds the BVH.
 	 * \param first, last Iterators delimiting the set of objects to store in
-	 *        the BVH (all objects in (first, last]).
+	 *        the BVH (all objects in (first, last]), referenced in
+	 *        primitives_.
 	 * \param engine, distrib Random-related parameters.
 	 *
 	 * If there is only one object, the method creates a leaf.
@@ -150,9 +372,225 @@ public:
  	 * coordinate), which requires linear time.
 	 */
 	void Build(
-		std::vector<std::pair<Object, AABB>>::iterator first,
-		std::vector<std::pair<Object, AABB>>::iterator last,
+		std::vector<std::pair<PrimitiveReference, AABB>>::iterator first,
+		std::vector<std::pair<PrimitiveReference, AABB>>::iterator last,
 		std::default_random_engine &engine,
 		std::uniform_int_distribution<int> &distrib
 	);
 };
+
+
+/**
+ * \struct Bounds
+ * \brief Lightweight axis-aligned box in single precision, used by FlatBVH.
+ *
+ * A default-constructed Bounds is empty.
+ */
+struct Bounds {
+	/// Minimal coordinates of the box.
+	float min[3] = {
+		std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::infinity()
+	};
+
+	/// Maximal coordinates of the box.
+	float max[3] = {
+		-std::numeric_limits<float>::infinity(),
+		-std::numeric_limits<float>::infinity(),
+		-std::numeric_limits<float>::infinity()
+	};
+
+	/// Extends the box so that it contains the input box.
+	inline void Grow(const Bounds &b) {
+		for (int i=0; i<3; i++) {
+			min[i] = std::min(min[i], b.min[i]);
+			max[i] = std::max(max[i], b.max[i]);
+		}
+	}
+
+	/// Extends the box so that it contains the input point.
+	inline void Grow(const Point &p) {
+		const double coordinates[3] = {p.x(), p.y(), p.z()};
+		for (int i=0; i<3; i++) {
+			// Rounds outwards so that the box stays conservative
+			min[i] = std::min(min[i], std::nextafter(
+				static_cast<float>(coordinates[i]),
+				-std::numeric_limits<float>::infinity()));
+			max[i] = std::max(max[i], std::nextafter(
+				static_cast<float>(coordinates[i]),
+				std::numeric_limits<float>::infinity()));
+		}
+	}
+
+	/// Outputs the i-th coordinate of the center of the box.
+	inline float Centroid(int i) const {
+		return (min[i] + max[i]) / 2;
+	}
+
+	/// Converts the box into an AABB.
+	inline AABB ToAABB() const {
+		return AABB{Point{min[0], min[1], min[2]}, Point{max[0], max[1], max[2]}};
+	}
+};
+
+
+/**
+ * \class FlatBVH
+ * \brief Bounding Volume Hierarchy over indexed items, stored as a flat array
+ *        of nodes in depth-first order.
+ *
+ * Unlike BVH, a FlatBVH does not own any object: it computes an order of the
+ * items in which each leaf covers a contiguous range of items, and its owner
+ * is expected to store them in this order. This allows compact owners (e.g.
+ * structures of arrays) to intersect whole leaves at once.
+ */
+class FlatBVH {
+private:
+	/**
+	 * \struct Node
+	 * \brief Node of the tree. Its first child is the next node in the array.
+	 */
+	struct Node {
+		Bounds bounds; //!< Bounding box of the node.
+
+		/// First item of the leaf, or index of the second child of an interior
+		/// node.
+		unsigned int first;
+
+		/// Number of items of the leaf; 0 for an interior node.
+		unsigned int count;
+	};
+
+	std::vector<Node> nodes_; //!< Nodes in depth-first order.
+
+	/**
+	 * \fn static bool Hit(const Bounds &b, const double origin[3], const double inv_direction[3], double t_max, double &entry)
+	 * \brief Tests if a ray enters the input box before distance t_max.
+	 * \param entry Output distance at which the ray enters the box (0 if its
+	 *        origin lies in the box).
+	 */
+	static inline bool Hit(
+		const Bounds &b, const double origin[3], const double inv_direction[3],
+		double t_max, double &entry
+	) {
+		double t_min = 0;
+		for (int i=0; i<3; i++) {
+			double t1 = (b.min[i] - origin[i]) * inv_direction[i];
+			double t2 = (b.max[i] - origin[i]) * inv_direction[i];
+			t_min = std::max(t_min, std::min(t1, t2));
+			t_max = std::min(t_max, std::max(t1, t2));
+		}
+		entry = t_min;
+		return t_min <= t_max;
+	}
+
+	/**
+	 * \fn void BuildNode(std::vector<unsigned int> &order, const std::vector<Bounds> &items, unsigned int first, unsigned int last, unsigned int leaf_size, unsigned int block)
+	 * \brief Recursively builds the node covering items order[first..last).
+	 *
+	 * Splits the items at the median of their centroids along the axis of
+	 * largest extent, rounded so that the first half is a multiple of block.
+	 */
+	void BuildNode(
+		std::vector<unsigned int> &order, const std::vector<Bounds> &items,
+		unsigned int first, unsigned int last, unsigned int leaf_size,
+		unsigned int block
+	);
+
+public:
+	/**
+	 * \fn std::vector<unsigned int> Build(const std::vector<Bounds> &items, unsigned int leaf_size, unsigned int block=1)
+	 * \brief Builds the tree over the input bounding boxes.
+	 * \param leaf_size Maximal number of items per leaf.
+	 * \param block Granularity of the leaves: every leaf but the last starts
+	 *        at a multiple of block. Must divide leaf_size.
+	 * \return The order in which the items should be stored: the i-th stored
+	 *         item is items[order[i]].
+	 */
+	std::vector<unsigned int> Build(
+		const std::vector<Bounds> &items, unsigned int leaf_size,
+		unsigned int block=1
+	);
+
+	/// Indicates if the tree contains no item.
+	inline bool IsEmpty() const {
+		return nodes_.empty();
+	}
+
+	/// Outputs the bounding box of all items.
+	inline Bounds RootBounds() const {
+		return nodes_.empty() ? Bounds{} : nodes_[0].bounds;
+	}
+
+	/// Outputs the memory used by the nodes, in bytes.
+	inline size_t MemoryUsage() const {
+		return nodes_.capacity() * sizeof(Node);
+	}
+
+	/**
+	 * \fn template <class LeafFunction> void Traverse(const Ray &r, double &t_max, LeafFunction intersect_leaf) const
+	 * \brief Calls intersect_leaf on every leaf entered by the input Ray before
+	 *        distance t_max, nearest nodes first.
+	 * \param t_max Distance beyond which nodes are skipped; intersect_leaf is
+	 *        expected to lower it when it finds a closer hit.
+	 * \param intersect_leaf Function called as intersect_leaf(first, count) on
+	 *        the range of stored items of each visited leaf.
+	 */
+	template <class LeafFunction>
+	void Traverse(
+		const Ray &r, double &t_max, LeafFunction intersect_leaf
+	) const {
+		if (nodes_.empty()) {
+			return;
+		}
+		const double origin[3] = {r.Origin().x(), r.Origin().y(), r.Origin().z()};
+		const double inv_direction[3] = {
+			1/r.Direction().x(), 1/r.Direction().y(), 1/r.Direction().z()
+		};
+
+		// Stack of nodes to visit, with their entry distance
+		std::pair<unsigned int, double> stack[64];
+		int stack_size = 0;
+		double entry;
+		if (!Hit(nodes_[0].bounds, origin, inv_direction, t_max, entry)) {
+			return;
+		}
+		stack[stack_size++] = {0, entry};
+		while (stack_size > 0) {
+			std::pair<unsigned int, double> top = stack[--stack_size];
+			if (top.second > t_max) {
+				continue;
+			}
+			unsigned int index = top.first;
+			while (true) {
+				const Node &node = nodes_[index];
+				if (node.count > 0) {
+					intersect_leaf(node.first, node.count);
+					break;
+				}
+				// Goes down to the nearest child, and remembers the other one
+				double entry1, entry2;
+				bool hit1 = Hit(nodes_[index+1].bounds, origin, inv_direction,
+					t_max, entry1);
+				bool hit2 = Hit(nodes_[node.first].bounds, origin,
+					inv_direction, t_max, entry2);
+				if (hit1 && hit2) {
+					if (entry1 <= entry2) {
+						stack[stack_size++] = {node.first, entry2};
+						index = index+1;
+					} else {
+						stack[stack_size++] = {index+1, entry1};
+						index = node.first;
+					}
+				} else if (hit1) {
+					index = index+1;
+				} else if (hit2) {
+					index = node.first;
+				} else {
+					break;
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,80 @@
+/**
+ * \file progress.cpp
+ * \brief Implements the progress reporter of progress.hpp.
+ */
+
+#include <algorithm>
+#include <sstream>
+#include "progress.hpp"
+#include "utils.hpp"
+
+
+ProgressReporter::ProgressReporter(
+	std::uint64_t total, std::chrono::milliseconds interval
+) :
+	total_{total},
+	start_{Clock::now()}
+{
+	thread_ = std::thread{&ProgressReporter::Run, this, interval};
+}
+
+
+ProgressReporter::~ProgressReporter() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		finished_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+
+	// Mean rate over the whole task
+	double elapsed =
+		std::chrono::duration<double>(Clock::now() - start_).count();
+	Report(elapsed > 0 ? rays_.load(std::memory_order_relaxed) / elapsed : 0);
+}
+
+
+void ProgressReporter::Report(double rays_per_second) const {
+	std::uint64_t done = done_.load(std::memory_order_relaxed);
+	double progress = total_ != 0 ? std::min(1., (double) done / total_) : 1;
+	double elapsed =
+		std::chrono::duration<double>(Clock::now() - start_).count();
+
+	std::ostringstream details;
+	details << std::fixed << std::setprecision(1);
+	if (progress < 1) {
+		details << "ETA ";
+		if (progress > 0) {
+			// The remaining work is assumed to go as fast as the completed one
+			long remaining = static_cast<long>(elapsed * (1-progress)/progress);
+			if (remaining >= 60) {
+				details << remaining/60 << "m";
+			}
+			details << remaining%60 << "s";
+		} else {
+			details << "?";
+		}
+		details << ", ";
+	} else {
+		details << elapsed << "s, ";
+	}
+	details << rays_per_second*1e-6 << " Mrays/s";
+	show_progress(progress, details.str());
+}
+
+
+void ProgressReporter::Run(std::chrono::milliseconds interval) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	Clock::time_point last_time = start_;
+	std::uint64_t last_rays = 0;
+	while (!wake_.wait_for(lock, interval, [this] { return finished_; })) {
+		// Rate over the last interval
+		Clock::time_point time = Clock::now();
+		std::uint64_t rays = rays_.load(std::memory_order_relaxed);
+		double duration =
+			std::chrono::duration<double>(time - last_time).count();
+		Report(duration > 0 ? (rays - last_rays) / duration : 0);
+		last_time = time;
+		last_rays = rays;
+	}
+}
@@ -0,0 +1,77 @@
+/**
+ * \file progress.hpp
+ * \brief Defines the reporter printing the progress of a render from a
+ *        separate thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+
+/**
+ * \class ProgressReporter
+ * \brief Prints periodically the progress bar of a task, its remaining time
+ *        and the current number of rays traced per second.
+ *
+ * Workers only add their completed work to relaxed atomic counters, ideally
+ * once per tile, and never wait nor print: a separate thread wakes up at a
+ * fixed interval, reads the counters and prints the bar. Reports thus cost
+ * the same whatever the number of workers and the granularity of the work.
+ */
+class ProgressReporter {
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	const std::uint64_t total_; //!< Units of work of the task.
+	const Clock::time_point start_; //!< Start of the task.
+
+	std::atomic<std::uint64_t> done_{0}; //!< Completed units of work.
+	std::atomic<std::uint64_t> rays_{0}; //!< Rays traced so far.
+
+	std::mutex mutex_; //!< Protects finished_.
+	std::condition_variable wake_; //!< Wakes up the thread when finished.
+	bool finished_ = false; //!< Indicates that the thread must stop.
+
+	std::thread thread_; //!< Thread printing the reports.
+
+	/**
+	 * \fn void Report(double rays_per_second) const
+	 * \brief Prints the progress bar, followed by the remaining time and the
+	 *        input rate.
+	 */
+	void Report(double rays_per_second) const;
+
+	/// Prints a report at each interval, until finished_ is set.
+	void Run(std::chrono::milliseconds interval);
+
+public:
+	/**
+	 * \fn ProgressReporter(std::uint64_t total, std::chrono::milliseconds interval=std::chrono::milliseconds{500})
+	 * \brief Starts the thread reporting the progress of a task.
+	 * \param total Units of work of the task (e.g. pixels).
+	 * \param interval Duration between two reports.
+	 */
+	ProgressReporter(
+		std::uint64_t total,
+		std::chrono::milliseconds interval=std::chrono::milliseconds{500}
+	);
+
+	/// Stops the thread, and prints a last report, without ending the line.
+	~ProgressReporter();
+
+	ProgressReporter(const ProgressReporter&) = delete;
+	ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+	/// Records completed work and the rays it traced. Can be called by any
+	/// number of threads at once.
+	inline void Add(std::uint64_t work, std::uint64_t rays=0) {
+		done_.fetch_add(work, std::memory_order_relaxed);
+		rays_.fetch_add(rays, std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,314 @@
+/**
+ * \file sampler.cpp
+ * \brief Implements the samplers of sampler.hpp.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include "sampler.hpp"
+
+
+/// Smallest value output by the samplers, so that values lie in (0,1).
+static const double kMinValue = 1e-10;
+
+
+/**
+ * \fn static inline std::uint32_t Mix(std::uint32_t h)
+ * \brief Finalizer of MurmurHash3, spreading each input bit over the output.
+ */
+static inline std::uint32_t Mix(std::uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+
+/// Combines a hash with a new value.
+static inline std::uint32_t Hash(std::uint32_t h, std::uint32_t value) {
+	return Mix(h ^ (value + 0x9e3779b9u + (h << 6) + (h >> 2)));
+}
+
+
+/// Outputs the hash of the seed, a pixel and a dimension (or group).
+static inline std::uint32_t Hash(
+	std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+	std::uint32_t dimension
+) {
+	std::uint32_t h = Hash(Mix(static_cast<std::uint32_t>(seed)),
+		static_cast<std::uint32_t>(seed >> 32));
+	return Hash(Hash(Hash(h, x), y), dimension);
+}
+
+
+/// Converts 32 random bits to a value in (0,1).
+static inline double ToUnit(std::uint32_t bits) {
+	return (bits + 0.5) * (1. / 4294967296.);
+}
+
+
+/// Outputs the fractional part of a value, kept in (0,1).
+static inline double Fraction(double value) {
+	value -= std::floor(value);
+	return std::min(std::max(value, kMinValue), 1-kMinValue);
+}
+
+
+double IndependentSampler::Get(
+	std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+	std::uint32_t sample, std::uint32_t dimension
+) const {
+	RandomStream stream{seed, (static_cast<std::uint64_t>(y) << 32) | x, sample};
+	stream.Seek(dimension);
+	return stream.Uniform();
+}
+
+
+/**
+ * \fn static const std::array<std::array<std::uint32_t, 32>, 4>& SobolDirections()
+ * \brief Outputs the direction numbers of the first four dimensions of the
+ *        Sobol sequence (Joe and Kuo), aligned on the most significant bit.
+ */
+static const std::array<std::array<std::uint32_t, 32>, 4>& SobolDirections() {
+	static const std::array<std::array<std::uint32_t, 32>, 4> directions = [] {
+		// Degree, coefficients and initial numbers of the primitive
+		// polynomials of dimensions 1 to 3
+		const unsigned int degrees[3] = {1, 2, 3};
+		const unsigned int coefficients[3] = {0, 1, 1};
+		const unsigned int initial[3][3] = {{1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+
+		std::array<std::array<std::uint32_t, 32>, 4> v;
+		for (int k=0; k<32; k++) {
+			// Dimension 0 is the van der Corput sequence
+			v[0][k] = 1u << (31-k);
+		}
+		for (int d=1; d<4; d++) {
+			unsigned int s = degrees[d-1];
+			unsigned int a = coefficients[d-1];
+			for (unsigned int k=0; k<32; k++) {
+				if (k < s) {
+					v[d][k] = initial[d-1][k] << (31-k);
+				} else {
+					v[d][k] = v[d][k-s] ^ (v[d][k-s] >> s);
+					for (unsigned int j=1; j<s; j++) {
+						if ((a >> (s-1-j)) & 1) {
+							v[d][k] ^= v[d][k-j];
+						}
+					}
+				}
+			}
+		}
+		return v;
+	}();
+	return directions;
+}
+
+
+/// Reverses the order of the bits of the input value.
+static inline std::uint32_t ReverseBits(std::uint32_t v) {
+	v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+	v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+	v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+	v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+
+/**
+ * \fn static inline std::uint32_t OwenScramble(std::uint32_t v, std::uint32_t seed)
+ * \brief Applies a nested uniform scrambling to the bits of v, as a hash
+ *        whose lower bits only depend on the lower bits of its input (Laine
+ *        and Karras), applied to the reversed bits.
+ */
+static inline std::uint32_t OwenScramble(std::uint32_t v, std::uint32_t seed) {
+	v = ReverseBits(v);
+	v += seed;
+	v ^= v * 0x6c50b47cu;
+	v ^= v * 0xb82f1e52u;
+	v ^= v * 0xc7afe638u;
+	v ^= v * 0x8d22f6e6u;
+	return ReverseBits(v);
+}
+
+
+/**
+ * \fn static double ScrambledSobol(std::uint32_t sample, std::uint32_t dimension, std::uint32_t group_seed)
+ * \brief Outputs a dimension of a sample of the Owen-scrambled Sobol sequence
+ *        (see SobolSampler).
+ * \param group_seed Seed of the shuffle and scrambling of the group of four
+ *        dimensions containing dimension.
+ */
+static double ScrambledSobol(
+	std::uint32_t sample, std::uint32_t dimension, std::uint32_t group_seed
+) {
+	std::uint32_t index = OwenScramble(sample, group_seed);
+	const auto &directions = SobolDirections()[dimension % 4];
+	std::uint32_t bits = 0;
+	for (int k=0; index != 0; k++, index >>= 1) {
+		if (index & 1) {
+			bits ^= directions[k];
+		}
+	}
+	return ToUnit(OwenScramble(bits, Hash(group_seed, dimension % 4)));
+}
+
+
+double SobolSampler::Get(
+	std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+	std::uint32_t sample, std::uint32_t dimension
+) const {
+	// Each group of four dimensions gets its own shuffle and scrambling
+	return ScrambledSobol(sample, dimension, Hash(seed, x, y, dimension / 4));
+}
+
+
+double HaltonSampler::Get(
+	std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+	std::uint32_t sample, std::uint32_t dimension
+) const {
+	static const unsigned int primes[kNbPrimes] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61,
+		67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137,
+		139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211,
+		223, 227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283,
+		293, 307, 311
+	};
+
+	// Radical inverse of the sample index
+	const unsigned int base = primes[dimension % kNbPrimes];
+	double inverse = 0;
+	double factor = 1. / base;
+	for (std::uint32_t n=sample; n != 0; n /= base) {
+		inverse += (n % base) * factor;
+		factor /= base;
+	}
+	return Fraction(inverse + ToUnit(Hash(seed, x, y, dimension)));
+}
+
+
+/**
+ * \fn static const std::vector<float>& BlueNoiseMask()
+ * \brief Outputs a tileable blue noise mask of kMaskSize x kMaskSize values
+ *        uniformly distributed in (0,1), built by the void-and-cluster method
+ *        (Ulichney).
+ *
+ * Pixels are ranked by repeatedly removing the tightest cluster of an
+ * initial binary pattern, then filling the largest void; the energy of a
+ * pixel is the sum of Gaussian weights of its toroidal distances to the
+ * pixels set to one.
+ */
+static const std::vector<float>& BlueNoiseMask() {
+	static const std::vector<float> mask = [] {
+		const int n = BlueNoiseSampler::kMaskSize;
+		const int size = n*n;
+		const double sigma = 1.5;
+
+		std::vector<double> kernel(size);
+		for (int dy=0; dy<n; dy++) {
+			for (int dx=0; dx<n; dx++) {
+				double tx = std::min(dx, n-dx);
+				double ty = std::min(dy, n-dy);
+				kernel[dy*n+dx] = std::exp(-(tx*tx + ty*ty) / (2*sigma*sigma));
+			}
+		}
+
+		std::vector<char> ones(size, false);
+		std::vector<double> energy(size, 0);
+		auto set = [&](int p, bool one) {
+			ones[p] = one;
+			double sign = one ? 1 : -1;
+			int px = p % n;
+			int py = p / n;
+			for (int q=0; q<size; q++) {
+				int dx = (q % n - px + n) % n;
+				int dy = (q / n - py + n) % n;
+				energy[q] += sign * kernel[dy*n+dx];
+			}
+		};
+		auto tightest_cluster = [&] {
+			int best = -1;
+			for (int p=0; p<size; p++) {
+				if (ones[p] && (best < 0 || energy[p] > energy[best])) {
+					best = p;
+				}
+			}
+			return best;
+		};
+		auto largest_void = [&] {
+			int best = -1;
+			for (int p=0; p<size; p++) {
+				if (!ones[p] && (best < 0 || energy[p] < energy[best])) {
+					best = p;
+				}
+			}
+			return best;
+		};
+
+		// Initial pattern: a tenth of the pixels, chosen at random, then
+		// evened out by moving the tightest clusters to the largest voids
+		const int nb_initial = size / 10;
+		RandomStream rng;
+		for (int k=0; k<nb_initial; ) {
+			int p = rng.NextBits() % size;
+			if (!ones[p]) {
+				set(p, true);
+				k++;
+			}
+		}
+		for (;;) {
+			int cluster = tightest_cluster();
+			set(cluster, false);
+			int hole = largest_void();
+			set(hole, true);
+			if (hole == cluster) {
+				break;
+			}
+		}
+		std::vector<char> initial_ones = ones;
+		std::vector<double> initial_energy = energy;
+
+		// Ranks the pixels of the initial pattern by removing clusters, then
+		// the other ones by filling voids
+		std::vector<int> rank(size);
+		for (int r=nb_initial-1; r>=0; r--) {
+			int cluster = tightest_cluster();
+			set(cluster, false);
+			rank[cluster] = r;
+		}
+		ones.swap(initial_ones);
+		energy.swap(initial_energy);
+		for (int r=nb_initial; r<size; r++) {
+			int hole = largest_void();
+			set(hole, true);
+			rank[hole] = r;
+		}
+
+		std::vector<float> values(size);
+		for (int p=0; p<size; p++) {
+			values[p] = (rank[p] + 0.5f) / size;
+		}
+		return values;
+	}();
+	return mask;
+}
+
+
+double BlueNoiseSampler::Get(
+	std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+	std::uint32_t sample, std::uint32_t dimension
+) const {
+	// Random toroidal shift of the mask for each dimension
+	std::uint32_t h = Hash(seed, 0, 0, dimension);
+	std::uint32_t mx = (x + (h & 0xffff)) % kMaskSize;
+	std::uint32_t my = (y + (h >> 16)) % kMaskSize;
+
+	// The Sobol sequence is shared by all pixels, and only rotated by the
+	// mask
+	std::uint32_t group_seed = Hash(Hash(seed, 0, 0, dimension / 4), 1);
+	return Fraction(BlueNoiseMask()[my*kMaskSize + mx]
+		+ ScrambledSobol(sample, dimension, group_seed));
+}
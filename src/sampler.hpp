@@ -0,0 +1,160 @@
+/**
+ * \file sampler.hpp
+ * \brief Defines the generators of the sample values used by the integrators
+ *        (independent, Sobol, Halton and blue noise).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "utils.hpp"
+
+
+/**
+ * \class Sampler
+ * \brief Abstract generator of the values of the samples of each pixel.
+ *
+ * A sample is a point of the unit hypercube, whose dimensions are consumed in
+ * order by the decisions of a path (pixel jitter, then directions and choices
+ * at each bounce). Values are pure functions of the seed, the pixel, the
+ * sample index and the dimension, so that samplers have no state, and can be
+ * shared by all threads.
+ */
+class Sampler {
+public:
+	virtual ~Sampler() {}
+
+	/**
+	 * \fn virtual double Get(std::uint64_t seed, std::uint32_t x, std::uint32_t y, std::uint32_t sample, std::uint32_t dimension) const
+	 * \brief Outputs a dimension of a sample of a pixel, in (0,1).
+	 * \param seed Global seed of the render.
+	 * \param x, y Column and row of the pixel.
+	 * \param sample Index of the sample in the pixel.
+	 * \param dimension Index of the dimension in the sample.
+	 */
+	virtual double Get(
+		std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+		std::uint32_t sample, std::uint32_t dimension
+	) const = 0;
+};
+
+
+/**
+ * \class SampleStream
+ * \brief Successive dimensions of one sample of a pixel, drawn from a Sampler.
+ */
+class SampleStream {
+private:
+	const Sampler *sampler_;  //!< Generator of the values.
+	std::uint64_t seed_;      //!< Global seed of the render.
+	std::uint32_t x_;         //!< Column of the pixel.
+	std::uint32_t y_;         //!< Row of the pixel.
+	std::uint32_t sample_;    //!< Index of the sample in the pixel.
+	std::uint32_t dimension_; //!< Next dimension to draw.
+
+public:
+	/// Builds an empty stream, which must be assigned before use.
+	SampleStream() :
+		sampler_{nullptr}, seed_{0}, x_{0}, y_{0}, sample_{0}, dimension_{0}
+	{
+	}
+
+	/// Builds the stream of the input sample of pixel (x, y), starting at
+	/// dimension 0.
+	SampleStream(
+		const Sampler &sampler, std::uint64_t seed, std::uint32_t x,
+		std::uint32_t y, std::uint32_t sample
+	) :
+		sampler_{&sampler}, seed_{seed}, x_{x}, y_{y}, sample_{sample},
+		dimension_{0}
+	{
+	}
+
+	/// Outputs the next dimension of the sample, in (0,1).
+	inline double Uniform() {
+		return sampler_->Get(seed_, x_, y_, sample_, dimension_++);
+	}
+
+	/// Sets the next dimension to draw.
+	inline void SetDimension(std::uint32_t dimension) {
+		dimension_ = dimension;
+	}
+};
+
+
+/**
+ * \class IndependentSampler
+ * \brief Sampler whose values are all independent (see RandomStream).
+ */
+class IndependentSampler : public Sampler {
+public:
+	double Get(
+		std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+		std::uint32_t sample, std::uint32_t dimension
+	) const;
+};
+
+
+/**
+ * \class SobolSampler
+ * \brief Owen-scrambled Sobol sequence, randomized independently in each
+ *        pixel.
+ *
+ * Dimensions are grouped by four: each group is a 4D Sobol point set with
+ * nested uniform scrambling, whose points are shuffled by an Owen scrambling
+ * of the sample index (Burley, "Practical Hash-based Owen Scrambling", 2020).
+ * Each group is thus well stratified in all its projections, and groups are
+ * decorrelated from each other. Sample counts that are powers of two give the
+ * best results.
+ */
+class SobolSampler : public Sampler {
+public:
+	double Get(
+		std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+		std::uint32_t sample, std::uint32_t dimension
+	) const;
+};
+
+
+/**
+ * \class HaltonSampler
+ * \brief Halton sequence, with a random offset of each dimension in each pixel
+ *        (Cranley-Patterson rotation).
+ *
+ * Dimension d is the radical inverse of the sample index in the d-th prime
+ * base; dimensions beyond the table of primes reuse it with other offsets.
+ */
+class HaltonSampler : public Sampler {
+public:
+	/// Number of prime bases.
+	static const unsigned int kNbPrimes = 64;
+
+	double Get(
+		std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+		std::uint32_t sample, std::uint32_t dimension
+	) const;
+};
+
+
+/**
+ * \class BlueNoiseSampler
+ * \brief Sampler distributing the error of the first samples as blue noise
+ *        across the image.
+ *
+ * All pixels share the same Owen-scrambled Sobol sequence (see SobolSampler),
+ * which each pixel rotates by the value of a void-and-cluster blue noise
+ * mask, shifted by a random offset per dimension. Each pixel thus keeps a
+ * well stratified sequence, while the values of neighbouring pixels differ
+ * as much as possible, so that their errors cancel out when the image is
+ * seen from a distance.
+ */
+class BlueNoiseSampler : public Sampler {
+public:
+	/// Width and height of the blue noise mask, in pixels.
+	static const unsigned int kMaskSize = 64;
+
+	double Get(
+		std::uint64_t seed, std::uint32_t x, std::uint32_t y,
+		std::uint32_t sample, std::uint32_t dimension
+	) const;
+};
@@ -3,7 +3,18 @@
  * \brief Implements classes of scene.hpp.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include "progress.hpp"
 #include "scene.hpp"
+#include "tiles.hpp"
+
+
+/// Number of rays intersected with the objects by the current thread, read
+/// by the progress reports.
+static thread_local std::uint64_t nb_traced_rays = 0;
 
 
 Ray Camera::Launch(size_t i, size_t j, double di, double dj) const {
@@ -11,93 +22,396 @@ Ray Camera::Launch(size_t i, size_t j, double di, double dj) const {
 		(j + dj - (double)width_/2 + 0.5)*right_
 		+ (i + di - (double)height_/2 + 0.5)*up_
 		+ height_/(2*tan(fov_/2))*direction_;
-	return Ray{origin_, ray_direction};
+	Ray r{origin_, ray_direction};
+
+	// Derivatives of the normalized direction with respect to j and i
+	const Vector &d = r.Direction();
+	double norm = ray_direction.Norm();
+	r.SetDifferentials(
+		Vector{0, 0, 0}, Vector{0, 0, 0},
+		(right_ - (right_|d)*d) / norm, (up_ - (up_|d)*d) / norm
+	);
+	return r;
 }
 
 
-Vector Scene::LightIntensity(
-	const Point &p, const Vector &normal, const Ray &r,
+Scene::Scene(
+	const Camera &camera,
+	const std::shared_ptr<const ObjectContainer> &objects
+) :
+	camera_{camera},
+	objects_{objects}
+{
+	// Emitters point to the primitives owned by the shared container
+	if (auto vector = dynamic_cast<const ObjectVector*>(objects.get())) {
+		area_lights_ = AreaLights{vector->Primitives()};
+	} else if (auto bvh = dynamic_cast<const BVH*>(objects.get())) {
+		if (!bvh->IsEmpty()) {
+			area_lights_ = AreaLights{bvh->Primitives()};
+		}
+	}
+	image_.assign(3*camera.Height()*camera.Width(), 0);
+	sample_counts_.assign(camera.Height()*camera.Width(), 0);
+}
+
+
+bool Scene::IsLightVisible(
+	const SurfaceInteraction &surface, const Light &l
+) const {
+	// Throw a ray towards the light
+	const Point &p = surface.HitPoint();
+	Vector direction_light = l.Source() - p;
+	Ray to_light = surface.Spawn(p, direction_light);
+	Intersection inter_light = objects_->Intersect(to_light);
+	nb_traced_rays++;
+	double d = inter_light.Distance();
+	// If an object is between the light and the intersection point,
+	// then the color is dark
+	return inter_light.IsEmpty() || d*d > direction_light.NormSquared();
+}
+
+
+Vector Scene::PointLightIntensity(
+	const Light &l, const Point &p, const Vector &normal, const Ray &r,
 	const Material &material, const Vector &diffuse_color,
 	const Vector &specular_color, double opacity, double fraction_diffuse_brdf
 ) const {
+	Vector direction_light = l.Source() - p;
+	Ray to_light{p, direction_light};
+	Vector color_light;
+	// Diffuse part
+	double dd = direction_light.NormSquared();
+	color_light = color_light
+		+ std::max(to_light.Direction()|normal, 0.) * l.Intensity()
+		* opacity*(1-fraction_diffuse_brdf) / (PI * dd)
+		* diffuse_color;
+
+	// Specular part
+	if (material.FractionSpecular() != 0) {
+		direction_light.Normalize();
+		Vector direction_light_reflected = direction_light
+			- 2*(direction_light|normal)*normal;
+		direction_light_reflected.Normalize();
+		color_light = color_light + material.FractionSpecular()
+			* pow(std::max(direction_light_reflected|r.Direction(), 0.),
+				material.SpecularCoefficient())
+			* l.Intensity() * specular_color / (PI * dd);
+	}
+
+	return color_light;
+}
+
+
+Vector Scene::LightIntensity(
+	const SurfaceInteraction &surface, const Ray &r,
+	const Material &material, const Vector &diffuse_color,
+	const Vector &specular_color, double opacity, double fraction_diffuse_brdf,
+	double u_light, double u_resampling, ReservoirReuse *reuse
+) const {
+	const Point &p = surface.HitPoint();
+	const Vector &normal = surface.Normal();
 	if (
 		opacity*(1-fraction_diffuse_brdf) == 0
 		&& material.SpecularCoefficient() == 0
 	) {
+		if (reuse != nullptr && reuse->output != nullptr) {
+			*reuse->output = Reservoir{};
+		}
+		if (reuse != nullptr && reuse->candidates != nullptr) {
+			*reuse->candidates = Reservoir{};
+		}
 		return Vector{0, 0, 0};
 	}
 
+	if (light_candidates_ != 0) {
+		return ResampledLightIntensity(
+			surface, r, material, diffuse_color, specular_color, opacity,
+			fraction_diffuse_brdf, u_light, u_resampling, reuse
+		);
+	}
+
 	Vector final_color;
 
 	// Traverses the set of lights
-	for (const auto &l : lights_) {
-		// Throw a ray towards the light
-		Vector direction_light = l.Source() - p;
-		Ray to_light{p, direction_light};
-		Intersection inter_light = objects_->Intersect(to_light);
-		double d = inter_light.Distance();
-		// If an object is between the light and the intersection point,
-		// then the color is dark
-		if (inter_light.IsEmpty() || d*d > direction_light.NormSquared()) {
-			Vector color_light;
-			// Diffuse part
-			double dd = direction_light.NormSquared();
-			color_light = color_light
-				+ std::max(to_light.Direction()|normal, 0.) * l.Intensity()
-				* opacity*(1-fraction_diffuse_brdf) / (PI * dd)
-				* diffuse_color;
-
-			// Specular part
-			if (material.FractionSpecular() != 0) {
-				direction_light.Normalize();
-				Vector direction_light_reflected = direction_light
-					- 2*(direction_light|normal)*normal;
-				direction_light_reflected.Normalize();
-				color_light = color_light + material.FractionSpecular()
-					* pow(std::max(direction_light_reflected|r.Direction(), 0.),
-						material.SpecularCoefficient())
-					* l.Intensity() * specular_color / (PI * dd);
+	if (light_samples_ == 0) {
+		for (const auto &l : lights_) {
+			if (IsLightVisible(surface, l)) {
+				final_color = final_color + PointLightIntensity(
+					l, p, normal, r, material, diffuse_color, specular_color,
+					opacity, fraction_diffuse_brdf
+				);
 			}
+		}
+		return final_color;
+	}
 
-			final_color = final_color + color_light;
+	// Chooses lights in the tree, with stratified samples; lights behind the
+	// surface only contribute to the specular part
+	bool two_sided = material.FractionSpecular() != 0;
+	for (unsigned int k=0; k<light_samples_; k++) {
+		size_t light;
+		double probability;
+		if (
+			light_tree_.Sample(
+				p, normal, two_sided, (k + u_light) / light_samples_, light,
+				probability
+			) && IsLightVisible(surface, lights_[light])
+		) {
+			final_color = final_color + PointLightIntensity(
+				lights_[light], p, normal, r, material, diffuse_color,
+				specular_color, opacity, fraction_diffuse_brdf
+			) / probability;
 		}
 	}
+	return final_color / light_samples_;
+}
 
-	return final_color;
+
+/**
+ * \fn static double GeometricTerm(const Light &l, const Point &p, const Vector &normal)
+ * \brief Outputs the power of the input Light received by a surface at p,
+ *        averaged on the channels, ignoring its material.
+ */
+static double GeometricTerm(
+	const Light &l, const Point &p, const Vector &normal
+) {
+	Vector direction_light = l.Source() - p;
+	double dd = direction_light.NormSquared();
+	double cosine = (direction_light|normal);
+	if (dd == 0 || cosine <= 0) {
+		return 0;
+	}
+	const Vector &intensity = l.Intensity();
+	return (intensity.x() + intensity.y() + intensity.z()) / 3
+		* cosine / (dd * sqrt(dd));
+}
+
+
+Vector Scene::ResampledLightIntensity(
+	const SurfaceInteraction &surface, const Ray &r,
+	const Material &material, const Vector &diffuse_color,
+	const Vector &specular_color, double opacity, double fraction_diffuse_brdf,
+	double u_light, double u_resampling, ReservoirReuse *reuse
+) const {
+	const Point &p = surface.HitPoint();
+	const Vector &normal = surface.Normal();
+	// Target density: unshadowed contribution, averaged on the channels
+	auto target = [&](size_t light) {
+		Vector color = PointLightIntensity(
+			lights_[light], p, normal, r, material, diffuse_color,
+			specular_color, opacity, fraction_diffuse_brdf
+		);
+		return (color.x() + color.y() + color.z()) / 3;
+	};
+
+	// Candidates chosen in the tree, stratified along u_light; lights behind
+	// the surface only contribute to the specular part
+	bool two_sided = material.FractionSpecular() != 0;
+	Reservoir reservoir;
+	for (unsigned int k=0; k<light_candidates_; k++) {
+		size_t light;
+		double probability;
+		if (light_tree_.Sample(
+			p, normal, two_sided, (k + u_light) / light_candidates_, light,
+			probability
+		)) {
+			double target_light = target(light);
+			reservoir.Update(
+				light, target_light / probability, target_light, 1, u_resampling
+			);
+		} else {
+			reservoir.Update(0, 0, 0, 1, u_resampling);
+		}
+	}
+
+	reservoir.Finalize(p, normal);
+	if (reuse != nullptr && reuse->candidates != nullptr) {
+		*reuse->candidates = reservoir;
+	}
+
+	// Reservoirs of other shading points lying on similar surfaces, with the
+	// number of candidates they stand for
+	const Reservoir *inputs[ReservoirReuse::kMaxReservoirs+1] = {&reservoir};
+	double counts[ReservoirReuse::kMaxReservoirs+1] = {reservoir.Count()};
+	unsigned int nb_inputs = 1;
+	if (reuse != nullptr) {
+		double tolerance = 0.01 * (p - r.Origin()).Norm();
+		for (unsigned int k=0; k<reuse->nb_reservoirs; k++) {
+			const Reservoir &other = *reuse->reservoirs[k];
+			if (
+				other.Count() != 0
+				&& (other.ShadingNormal()|normal) >= 0.9
+				&& std::abs((other.ShadingPoint()-p)|normal) <= tolerance
+			) {
+				inputs[nb_inputs] = &other;
+				counts[nb_inputs] = std::min(other.Count(), reuse->max_count);
+				nb_inputs++;
+			}
+		}
+	}
+
+	// Resamples the lights of all reservoirs, the one of p included; each is
+	// weighted by the balance heuristic between the reservoirs, computed on
+	// the geometric terms of the light at their shading points, or only kept
+	// in the one of p if these terms all vanish
+	if (nb_inputs > 1) {
+		Reservoir combined;
+		for (unsigned int i=0; i<nb_inputs; i++) {
+			const Reservoir &input = *inputs[i];
+			if (input.ContributionWeight() == 0) {
+				combined.Update(0, 0, 0, counts[i], u_resampling);
+				continue;
+			}
+			const Light &l = lights_[input.Light()];
+			double sum = 0;
+			for (unsigned int j=0; j<nb_inputs; j++) {
+				sum += counts[j] * GeometricTerm(
+					l, inputs[j]->ShadingPoint(), inputs[j]->ShadingNormal()
+				);
+			}
+			double mis_weight = i == 0 ? 1 : 0;
+			if (sum > 0) {
+				mis_weight = counts[i] * GeometricTerm(
+					l, input.ShadingPoint(), input.ShadingNormal()
+				) / sum;
+			}
+			double target_light = target(input.Light());
+			combined.Update(
+				input.Light(),
+				mis_weight * target_light * input.ContributionWeight(),
+				target_light, counts[i], u_resampling
+			);
+		}
+		combined.Finalize(p, normal, true);
+		reservoir = combined;
+	}
+
+	// Only the kept light casts a shadow ray; the reservoir is reused whatever
+	// its visibility, since targets ignore visibility
+	Vector color;
+	if (
+		reservoir.ContributionWeight() > 0
+		&& IsLightVisible(surface, lights_[reservoir.Light()])
+	) {
+		color = reservoir.ContributionWeight() * PointLightIntensity(
+			lights_[reservoir.Light()], p, normal, r, material, diffuse_color,
+			specular_color, opacity, fraction_diffuse_brdf
+		);
+	}
+	if (reuse != nullptr && reuse->output != nullptr) {
+		*reuse->output = reservoir;
+	}
+	return color;
+}
+
+
+void Scene::BuildLightTree() {
+	light_tree_ = light_samples_ != 0 || light_candidates_ != 0 ?
+		LightTree{lights_} : LightTree{};
+}
+
+
+/**
+ * \fn static double PowerHeuristic(double pdf, double other_pdf)
+ * \brief Outputs the weight of a sample drawn with density pdf, against a
+ *        strategy of density other_pdf, with the power heuristic.
+ */
+static double PowerHeuristic(double pdf, double other_pdf) {
+	if (pdf == 0) {
+		return 0;
+	}
+	return pdf*pdf / (pdf*pdf + other_pdf*other_pdf);
+}
+
+
+Vector Scene::AreaLightIntensity(
+	const SurfaceInteraction &surface, const Ray &r,
+	const Material &material, const Vector &diffuse_color,
+	const Vector &specular_color, double opacity, double fraction_diffuse_brdf,
+	double diffuse_density, double u_emitter, double u, double v
+) const {
+	const Point &p = surface.HitPoint();
+	const Vector &normal = surface.Normal();
+	LightSample sample;
+	if (
+		(opacity == 0 && material.FractionSpecular() == 0)
+		|| !area_lights_.Sample(p, u_emitter, u, v, sample)
+	) {
+		return Vector{0, 0, 0};
+	}
+
+	// Throw a ray towards the sampled point, which is hidden if another object
+	// is hit before
+	Ray to_light = surface.Spawn(p, sample.direction);
+	Intersection inter_light = objects_->Intersect(to_light);
+	nb_traced_rays++;
+	if (
+		!inter_light.IsEmpty() && &inter_light.Object() != sample.object
+		&& inter_light.Distance() < sample.distance*(1-1e-6)
+	) {
+		return Vector{0, 0, 0};
+	}
+
+	Vector radiance = sample.radiance / sample.pdf;
+	Vector color_light;
+	// Diffuse parts: the direct one, as for punctual lights, and the one
+	// estimated by diffuse rays, which is weighted against them
+	double cosine = to_light.Direction()|normal;
+	if (cosine > 0) {
+		double weight = opacity*(1-fraction_diffuse_brdf)
+			+ opacity*fraction_diffuse_brdf / PI
+				* PowerHeuristic(sample.pdf, diffuse_density*cosine/PI);
+		color_light = color_light
+			+ weight * cosine / PI * radiance * diffuse_color;
+	}
+
+	// Specular part
+	if (material.FractionSpecular() != 0) {
+		Vector direction_light_reflected = to_light.Direction()
+			- 2*(to_light.Direction()|normal)*normal;
+		direction_light_reflected.Normalize();
+		color_light = color_light + material.FractionSpecular()
+			* pow(std::max(direction_light_reflected|r.Direction(), 0.),
+				material.SpecularCoefficient())
+			* radiance * specular_color / PI;
+	}
+
+	return color_light;
 }
 
 
 Vector Scene::GetBRDFColor(
 	unsigned int nb_samples, unsigned int nb_recursions, double intensity,
-	const Vector &diffuse_color, const Vector &normal,
-	const Point &intersection_point, double index
-) {
+	const Vector &diffuse_color, const SurfaceInteraction &surface,
+	double index, double diffuse_density, SampleStream &sampler
+) const {
+	const Vector &normal = surface.Normal();
 	Vector result;
 	Vector ortho1 = normal.Orthogonal();
 	Vector ortho2 = normal^ortho1;
 	for (unsigned int i=0; i<nb_samples; i++) {
 		// Launches a random ray into the half plane defined by the intersection
 		// point and its normal
-		double r1 = distrib_(engine_);
-		double r2 = distrib_(engine_);
+		double r1 = sampler.Uniform();
+		double r2 = sampler.Uniform();
 		double root = sqrt(1-r2);
 		Vector random_direction = cos(2*PI*r1)*root*ortho1
 			+ sin(2*PI*r1)*root*ortho2 + sqrt(r2)*normal;
 		result = result +
-			GetColor(Ray{intersection_point, random_direction},
-				nb_recursions-1, 1, index, intensity);
+			GetColor(surface.SpawnDiffuse(random_direction, ortho1, ortho2),
+				sampler, nb_recursions-1, 1, index, intensity,
+				diffuse_density*sqrt(r2)/PI);
 	}
 	return result / (nb_samples * PI) * diffuse_color;
 }
 
 
-Vector Scene::GetTransmissionReflexionColor(
-	unsigned int nb_samples, unsigned int nb_recursions, double intensity,
-	const Ray &r, const RawObject &o, const Point &intersection_point,
-	const Material &material, const Vector &specular_color,
-	const Intersection &inter, double index, const Vector &normal)
-{
-	Vector refracted_direction, reflected_direction;
+double Scene::FresnelSplit(
+	const Ray &r, const RawObject &o, const Material &material,
+	const Intersection &inter, double index, const Vector &normal,
+	Vector &reflected_direction, Vector &refracted_direction,
+	double &new_index
+) const {
 	const Vector &ray_dir = r.Direction();
 
 	// Refraction part
@@ -111,7 +425,7 @@ Vector Scene::GetTransmissionReflexionColor(
 	}
 	double in_out_ = n_in/n_out;
 	// Determines the new index of the ambient material
-	double new_index = index;
+	new_index = index;
 	if (inter.IsOut() && o.IsFlat()) {
 		new_index = material.RefractiveIndex();
 	}
@@ -129,15 +443,43 @@ Vector Scene::GetTransmissionReflexionColor(
 
 	// Reflection
 	reflected_direction = ray_dir - 2*dot_prod*normal;
-	double coef_reflection;
 	if (!is_ray_refracted) {
-		coef_reflection = 1;
+		return 1;
 	} else {
 		// Fresnel coefficients (approximation)
 		double k0 =
 			(n_in - n_out)*(n_in - n_out)/((n_in + n_out)*(n_in + n_out));
 		double c = 1 + dot_prod;
-		coef_reflection = k0 + (1-k0)*c*c*c*c*c;
+		return k0 + (1-k0)*c*c*c*c*c;
+	}
+}
+
+
+Vector Scene::GetTransmissionReflexionColor(
+	unsigned int nb_samples, unsigned int nb_recursions, double intensity,
+	const Ray &r, const RawObject &o, const SurfaceInteraction &surface,
+	const Material &material, const Vector &specular_color,
+	const Intersection &inter, double index, SampleStream &sampler) const
+{
+	Vector refracted_direction, reflected_direction;
+	double new_index;
+	double coef_reflection = FresnelSplit(
+		r, o, material, inter, index, surface.Normal(), reflected_direction,
+		refracted_direction, new_index
+	);
+
+	// Rays in both directions, with propagated differentials (there is no
+	// refracted ray in case of total reflection)
+	Ray reflected = surface.SpawnReflected(
+		r, surface.HitPoint(), reflected_direction
+	);
+	Ray refracted;
+	if (coef_reflection < 0.999) {
+		refracted = surface.SpawnRefracted(
+			r, r(inter.Distance()*1.001), refracted_direction,
+			inter.IsOut() ? index/material.RefractiveIndex()
+				: material.RefractiveIndex()/index
+		);
 	}
 
 	// Samples the rays between refraction and reflection using Fresnel
@@ -146,32 +488,31 @@ Vector Scene::GetTransmissionReflexionColor(
 	if (coef_reflection >= 0.999) {
 		final_color = specular_color *
 			GetColor(
-				Ray{intersection_point, reflected_direction}, nb_recursions-1,
-				nb_samples, index, intensity
+				reflected, sampler, nb_recursions-1, nb_samples, index,
+				intensity
 			)
 		;
 	} else if (coef_reflection <= 0.001) {
 		final_color = material.TransparentColor() *
 			GetColor(
-				Ray{r(inter.Distance()*1.001), refracted_direction},
-				nb_recursions-1, nb_samples, new_index, intensity
+				refracted, sampler, nb_recursions-1, nb_samples, new_index,
+				intensity
 			)
 		;
 	} else {
 		for (unsigned int i=0; i<nb_samples; i++) {
-			double p = distrib_(engine_);
+			double p = sampler.Uniform();
 			if (p <= coef_reflection) {
 				final_color = final_color + specular_color *
 					GetColor(
-						Ray{intersection_point, reflected_direction},
-						nb_recursions-1, 1, index, coef_reflection*intensity
+						reflected, sampler, nb_recursions-1, 1, index,
+						coef_reflection*intensity
 					)
 				;
 			} else {
 				final_color = final_color + material.TransparentColor()
 					* GetColor(
-						Ray{r(inter.Distance()*1.001), refracted_direction},
-						nb_recursions-1, 1, new_index,
+						refracted, sampler, nb_recursions-1, 1, new_index,
 						(1-coef_reflection)*intensity
 					)
 				;
@@ -186,10 +527,12 @@ Vector Scene::GetTransmissionReflexionColor(
 }
 
 
-Vector Scene::GetColor(const Ray &r, unsigned int nb_recursions,
-	unsigned int nb_samples, double index, double intensity) {
+Vector Scene::GetColor(const Ray &r, SampleStream &sampler,
+	unsigned int nb_recursions, unsigned int nb_samples, double index,
+	double intensity, double diffuse_pdf, ReservoirReuse *reuse) const {
 	// Check first the intersection with the objects of the scene
 	Intersection inter = objects_->Intersect(r);
+	nb_traced_rays++;
 
 	if (inter.IsEmpty()) {
 		// No intersection
@@ -198,10 +541,8 @@ Vector Scene::GetColor(const Ray &r, unsigned int nb_recursions,
 
 	// Definition of parameters for the following computations
 	const RawObject &o = inter.Object();
-	const Material &material = o.ObjectMaterial();
-	Point intersection_point = Point(r(inter.Distance()),
-		inter.BarycentricCoordinates());
-	Vector normal = o.Normal(intersection_point);
+	SurfaceInteraction surface = o.Interact(r, inter);
+	const Material &material = surface.SurfaceMaterial();
 
 	double opacity;
 	double fraction_diffuse_brdf;
@@ -216,52 +557,98 @@ Vector Scene::GetColor(const Ray &r, unsigned int nb_recursions,
 	Vector diffuse_color;
 	Vector specular_color;
 	if (opacity != 0) {
-		diffuse_color = o.DiffuseColor(intersection_point);
+		diffuse_color = surface.DiffuseColor();
 	}
 	if (material.FractionSpecular() != 0 || opacity != 1) {
-		specular_color = o.SpecularColor(intersection_point);
+		specular_color = surface.SpecularColor();
+	}
+
+	// Light emitted by the surface, weighted against the area light samples of
+	// the previous vertex if r is a diffuse ray
+	Vector emitted_color;
+	if (material.IsEmissive()) {
+		double weight = 1;
+		if (diffuse_pdf != 0) {
+			weight = PowerHeuristic(
+				diffuse_pdf,
+				area_lights_.Pdf(r.Origin(), o, r(inter.Distance()))
+			);
+		}
+		emitted_color = weight * material.Emission();
+	}
+
+	// Expected number of diffuse rays launched from the intersection point
+	double fraction_diffusion = 0;
+	double diffuse_density = 0;
+	if (opacity != 1 || fraction_diffuse_brdf != 0) {
+		fraction_diffusion =
+			opacity*fraction_diffuse_brdf
+				/ (1 - opacity*(1-fraction_diffuse_brdf));
+		if (fraction_diffusion >= 0.999) {
+			diffuse_density = nb_samples;
+		} else if (fraction_diffusion > 0.001) {
+			diffuse_density = nb_samples*fraction_diffusion;
+		}
+	}
+
+	// Samples the lights before the recursion, so that the dimensions they use
+	// do not depend on the rest of the tree
+	double u_light = 0;
+	double u_resampling = 0;
+	if (light_samples_ != 0 || light_candidates_ != 0) {
+		u_light = sampler.Uniform();
+	}
+	if (light_candidates_ != 0) {
+		u_resampling = sampler.Uniform();
+	}
+	Vector area_light_color;
+	if (!area_lights_.IsEmpty()) {
+		double u_emitter = sampler.Uniform();
+		double u = sampler.Uniform();
+		double v = sampler.Uniform();
+		area_light_color = AreaLightIntensity(
+			surface, r, material, diffuse_color, specular_color, opacity,
+			fraction_diffuse_brdf, diffuse_density, u_emitter, u, v
+		);
 	}
 
 	// Sampling between diffusion and reflection / transmission, if one part is
 	// not predominant
 	Vector final_color;
 	if (opacity != 1 || fraction_diffuse_brdf != 0) {
-		double fraction_diffusion =
-			opacity*fraction_diffuse_brdf
-				/ (1 - opacity*(1-fraction_diffuse_brdf));
 		if (fraction_diffusion >= 0.999) {
 			final_color =
 				GetBRDFColor(
 					nb_samples, nb_recursions,
 					opacity * fraction_diffuse_brdf * intensity, diffuse_color,
-					normal, intersection_point, index
+					surface, index, diffuse_density, sampler
 				)
 			;
 		} else if (fraction_diffusion <= 0.001) {
 			final_color =
 				GetTransmissionReflexionColor(
 					nb_samples, nb_recursions, (1-opacity) * intensity, r, o,
-					intersection_point, material, specular_color, inter, index,
-					normal
+					surface, material, specular_color, inter, index, sampler
 				)
 			;
 		} else {
 			for (unsigned int i=0; i<nb_samples; i++) {
-				double p = distrib_(engine_);
+				double p = sampler.Uniform();
 				if (p <= fraction_diffusion) {
 					final_color = final_color +
 						GetBRDFColor(
 							1, nb_recursions,
 							opacity*fraction_diffuse_brdf*intensity,
-							diffuse_color, normal, intersection_point, index
+							diffuse_color, surface, index, diffuse_density,
+							sampler
 						)
 					;
 				} else {
 					final_color = final_color +
 						GetTransmissionReflexionColor(
 							1, nb_recursions, (1-opacity)*intensity, r, o,
-							intersection_point, material, specular_color, inter,
-							index, normal
+							surface, material, specular_color, inter, index,
+							sampler
 						)
 					;
 				}
@@ -272,12 +659,13 @@ Vector Scene::GetColor(const Ray &r, unsigned int nb_recursions,
 		}
 	}
 
-	// Adds direct illuminations
+	// Adds direct illuminations and emitted light
 	final_color = (1-opacity*(1-fraction_diffuse_brdf)) * final_color
 		+ LightIntensity(
-			intersection_point, normal, r,	material, diffuse_color,
-			specular_color, opacity, fraction_diffuse_brdf
+			surface, r, material, diffuse_color, specular_color, opacity,
+			fraction_diffuse_brdf, u_light, u_resampling, reuse
 		)
+		+ area_light_color + emitted_color
 	;
 
 	return final_color;
@@ -286,51 +674,773 @@ Vector Scene::GetColor(const Ray &r, unsigned int nb_recursions,
 
 void Scene::Render(unsigned int nb_recursions, unsigned int nb_samples,
 	bool anti_aliasing, bool progress_bar) {
-	size_t computed_pixels = 0;
-	#pragma omp parallel for schedule(dynamic, 1)
+	if (integrator_ == Integrator::kWavefront) {
+		RenderWavefront(nb_recursions, nb_samples, anti_aliasing, progress_bar);
+		return;
+	}
+	BuildLightTree();
+	sample_counts_.assign(Height()*Width(), nb_samples);
+	auto pixel_color = [&](size_t i, size_t j) {
+		Vector color_pixel;
+		if (!anti_aliasing) {
+			// Usual procedure without anti-aliasing: the launched ray will be
+			// duplicated when needed
+			Ray r = camera_.Launch(i, j);
+			if (integrator_ == Integrator::kIterative) {
+				for (unsigned int k=0; k<nb_samples; k++) {
+					color_pixel = color_pixel + TracePath(
+						r, SampleStream(*sampler_, seed_, j, i, k),
+						nb_recursions
+					);
+				}
+				if (nb_samples != 0) {
+					color_pixel = color_pixel / nb_samples;
+				}
+			} else {
+				SampleStream sampler(*sampler_, seed_, j, i, 0);
+				color_pixel = GetColor(r, sampler, nb_recursions, nb_samples);
+			}
+		} else if (nb_samples != 0) {
+			// For anti-aliasing, nb_samples jittered rays are generated
+			for (unsigned int k=0; k<nb_samples; k++) {
+				color_pixel = color_pixel + SampleColor(
+					i, j, k, nb_recursions, true, 1/sqrt(nb_samples)
+				);
+			}
+			color_pixel = color_pixel / nb_samples;
+		}
+		return color_pixel;
+	};
+
+	std::unique_ptr<ProgressReporter> reporter;
+	if (progress_bar) {
+		reporter.reset(new ProgressReporter(Height()*Width()));
+	}
+	TileScheduler scheduler(Height(), Width());
+	scheduler.Run([&](const Tile &tile, size_t) {
+		std::uint64_t first_ray = nb_traced_rays;
+
+		// Local framebuffer of the tile, merged into image_ once complete
+		std::vector<Vector> colors(tile.height*tile.width);
+		for (size_t di=0; di<tile.height; di++) {
+			for (size_t dj=0; dj<tile.width; dj++) {
+				colors[di*tile.width+dj] =
+					pixel_color(tile.row+di, tile.column+dj);
+			}
+		}
+		for (size_t di=0; di<tile.height; di++) {
+			for (size_t dj=0; dj<tile.width; dj++) {
+				SetPixel(tile.row+di, tile.column+dj, colors[di*tile.width+dj]);
+			}
+		}
+
+		if (reporter) {
+			reporter->Add(tile.height*tile.width, nb_traced_rays - first_ray);
+		}
+	});
+	reporter.reset();
+	std::cout << std::endl;
+}
+
+
+Vector Scene::SampleColor(size_t i, size_t j, unsigned int k,
+	unsigned int nb_recursions, bool anti_aliasing,
+	double differential_scale, ReservoirReuse *reuse) const {
+	SampleStream sampler(*sampler_, seed_, j, i, k);
+	double di = 0;
+	double dj = 0;
+	if (anti_aliasing) {
+		// Gaussian distribution centered at the center of the pixel
+		double x = sampler.Uniform();
+		double y = sampler.Uniform();
+		double R = sqrt(-2*log(x));
+		di = R*cos(2*PI*y)*0.5;
+		dj = R*sin(2*PI*y)*0.5;
+	}
+	Ray r = camera_.Launch(i, j, di, dj);
+	if (anti_aliasing) {
+		r.ScaleDifferentials(differential_scale);
+	}
+	return integrator_ != Integrator::kRecursive ?
+		TracePath(r, sampler, nb_recursions, reuse)
+		: GetColor(r, sampler, nb_recursions, 1, 1, 1, 0, reuse);
+}
+
+
+/**
+ * \fn static double DisplayError(const Vector &sum, const Vector &squares, unsigned int n, double gamma)
+ * \brief Estimates the standard error of the mean of n colors, as seen on the
+ *        final image, from their sum and the sum of their squares.
+ * \param gamma Gamma correction applied to the mean color (see SetPixel).
+ * \return The largest error among the three channels, in [0,1] units of the
+ *         gamma-corrected image.
+ *
+ * The standard error of each channel is scaled by the derivative of the gamma
+ * correction at the mean value, and vanishes for saturated channels.
+ */
+static double DisplayError(
+	const Vector &sum, const Vector &squares, unsigned int n, double gamma
+) {
+	// Darker channels use the derivative of the correction at this value,
+	// which is finite
+	const double min_mean = 1./255;
+
+	if (n < 2) {
+		return std::numeric_limits<double>::infinity();
+	}
+	Vector mean = sum / n;
+	Vector variance = (squares / n - mean*mean) * (n / (n-1.));
+	const double means[3] = {mean.x(), mean.y(), mean.z()};
+	const double variances[3] = {variance.x(), variance.y(), variance.z()};
+	double error = 0;
+	for (int c=0; c<3; c++) {
+		if (means[c] >= 1) {
+			continue;
+		}
+		double slope = pow(std::max(means[c], min_mean), 1/gamma - 1) / gamma;
+		error = std::max(error, slope * sqrt(std::max(variances[c], 0.) / n));
+	}
+	return error;
+}
+
+
+void Scene::RenderAdaptive(unsigned int nb_recursions,
+	const AdaptiveOptions &options, bool anti_aliasing, bool progress_bar) {
+	BuildLightTree();
+	const size_t nb_pixels = Height()*Width();
+	const unsigned int base_samples = std::max(1u, options.base_samples);
+	const unsigned int max_samples =
+		std::max(base_samples, options.max_samples);
+	const double differential_scale = 1/sqrt(base_samples);
+
+	// Sums of the colors of the samples of each pixel, and of their squares
+	std::vector<Vector> sums(nb_pixels);
+	std::vector<Vector> squares(nb_pixels);
+	std::vector<unsigned int> counts(nb_pixels, 0);
+
+	// Target number of samples of each pixel for the current round; pixels
+	// that reached it receive no more samples
+	std::vector<unsigned int> targets(nb_pixels, base_samples);
+	size_t nb_active = nb_pixels;
+
+	TileScheduler scheduler(Height(), Width());
+	while (nb_active != 0) {
+		std::unique_ptr<ProgressReporter> reporter;
+		if (progress_bar) {
+			reporter.reset(new ProgressReporter(nb_active));
+		}
+		scheduler.Run([&](const Tile &tile, size_t) {
+			std::uint64_t first_ray = nb_traced_rays;
+			size_t nb_computed = 0;
+			for (size_t i=tile.row; i<tile.row+tile.height; i++) {
+				for (size_t j=tile.column; j<tile.column+tile.width; j++) {
+					size_t p = i*Width()+j;
+					if (counts[p] == targets[p]) {
+						continue;
+					}
+					for (unsigned int k=counts[p]; k<targets[p]; k++) {
+						Vector color = SampleColor(
+							i, j, k, nb_recursions, anti_aliasing,
+							differential_scale
+						);
+						sums[p] = sums[p] + color;
+						squares[p] = squares[p] + color*color;
+					}
+					counts[p] = targets[p];
+					SetPixel(i, j, sums[p] / counts[p]);
+					nb_computed++;
+				}
+			}
+
+			if (reporter && nb_computed != 0) {
+				reporter->Add(nb_computed, nb_traced_rays - first_ray);
+			}
+		});
+		if (reporter) {
+			reporter.reset();
+			std::cout << std::endl;
+		}
+
+		// Pixels whose error is still too high double their samples
+		nb_active = 0;
+		for (size_t p=0; p<nb_pixels; p++) {
+			if (
+				counts[p] == targets[p] && counts[p] < max_samples
+				&& DisplayError(sums[p], squares[p], counts[p], gamma_)
+					> options.threshold
+			) {
+				targets[p] = std::min(2*counts[p], max_samples);
+				nb_active++;
+			}
+		}
+	}
+
+	SetSampleCounts(counts);
+}
+
+
+unsigned int Scene::RenderProgressive(unsigned int nb_recursions,
+	const ProgressiveOptions &options, bool anti_aliasing, bool progress_bar) {
+	typedef std::chrono::steady_clock Clock;
+
+	if (options.max_samples == 0 && options.time_limit <= 0) {
+		throw std::runtime_error(
+			"Scene::RenderProgressive: no target number of samples nor deadline"
+		);
+	}
+	BuildLightTree();
+	const Clock::time_point start = Clock::now();
+	auto elapsed = [&start] {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	};
+	auto deadline_passed = [&] {
+		return options.time_limit > 0 && elapsed() >= options.time_limit;
+	};
+	const double differential_scale =
+		options.max_samples != 0 ? 1/sqrt(options.max_samples) : 1;
+
+	// Local framebuffer of each tile: sums of the colors of the samples of
+	// each pixel (three channels per pixel, row by row), and number of
+	// samples of the tile, merged into image_ when resolved
+	TileScheduler scheduler(Height(), Width());
+	const std::vector<Tile> &tiles = scheduler.Tiles();
+	std::vector<std::vector<float>> accumulations(tiles.size());
+	std::vector<unsigned int> tile_counts(tiles.size(), 0);
+	for (size_t t=0; t<tiles.size(); t++) {
+		accumulations[t].assign(3*tiles[t].height*tiles[t].width, 0);
+	}
+
+	// Converts the accumulated colors to image_
+	auto resolve = [&] {
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (size_t t=0; t<tiles.size(); t++) {
+			if (tile_counts[t] == 0) {
+				continue;
+			}
+			const std::vector<float> &accumulation = accumulations[t];
+			for (size_t di=0; di<tiles[t].height; di++) {
+				for (size_t dj=0; dj<tiles[t].width; dj++) {
+					size_t p = di*tiles[t].width+dj;
+					SetPixel(tiles[t].row+di, tiles[t].column+dj, Vector{
+						accumulation[3*p], accumulation[3*p+1],
+						accumulation[3*p+2]
+					} / tile_counts[t]);
+				}
+			}
+		}
+	};
+
+	// Reservoirs of the first vertex of each pixel, combined and of the
+	// candidates alone, in the previous and the current pass, if they are
+	// reused
+	const bool temporal_reuse = light_candidates_ != 0
+		&& options.temporal_reuse;
+	const bool spatial_reuse = light_candidates_ != 0
+		&& options.spatial_reuse != 0;
+	std::vector<Reservoir> previous_reservoirs;
+	std::vector<Reservoir> reservoirs;
+	std::vector<Reservoir> previous_candidates;
+	std::vector<Reservoir> candidates;
+	if (temporal_reuse) {
+		previous_reservoirs.assign(Height()*Width(), Reservoir{});
+		reservoirs.assign(Height()*Width(), Reservoir{});
+	}
+	if (spatial_reuse) {
+		previous_candidates.assign(Height()*Width(), Reservoir{});
+		candidates.assign(Height()*Width(), Reservoir{});
+	}
+	IndependentSampler neighbor_sampler;
+	unsigned int nb_passes = 0;
+
+	// Reservoirs combined at the first vertex of pixel (i,j), from the
+	// previous pass: the one of the pixel, and the candidates of random
+	// neighbors in a disk
+	auto prepare_reuse = [&](size_t i, size_t j, ReservoirReuse &reuse) {
+		reuse.max_count = options.max_reuse_count * light_candidates_;
+		if (temporal_reuse) {
+			reuse.reservoirs[reuse.nb_reservoirs++] =
+				&previous_reservoirs[i*Width()+j];
+			reuse.output = &reservoirs[i*Width()+j];
+			*reuse.output = Reservoir{};
+		}
+		if (!spatial_reuse) {
+			return;
+		}
+		reuse.candidates = &candidates[i*Width()+j];
+		*reuse.candidates = Reservoir{};
+		SampleStream neighbors(neighbor_sampler, ~seed_, j, i, nb_passes);
+		unsigned int nb_neighbors = std::min(
+			options.spatial_reuse,
+			ReservoirReuse::kMaxReservoirs - reuse.nb_reservoirs
+		);
+		for (unsigned int k=0; k<nb_neighbors; k++) {
+			double radius = options.reuse_radius * sqrt(neighbors.Uniform());
+			double angle = 2*PI*neighbors.Uniform();
+			long ni = lround(i + radius*cos(angle));
+			long nj = lround(j + radius*sin(angle));
+			if (
+				ni >= 0 && nj >= 0 && ni < (long) Height()
+				&& nj < (long) Width()
+			) {
+				reuse.reservoirs[reuse.nb_reservoirs++] =
+					&previous_candidates[ni*Width()+nj];
+			}
+		}
+	};
+
+	double last_flush = 0;
+	while (
+		(options.max_samples == 0 || nb_passes < options.max_samples)
+		&& !deadline_passed()
+	) {
+		bool complete = true;
+		scheduler.Run([&](const Tile &tile, size_t t) {
+			if (deadline_passed()) {
+				#pragma omp atomic write
+				complete = false;
+				return;
+			}
+			std::vector<float> &accumulation = accumulations[t];
+			for (size_t di=0; di<tile.height; di++) {
+				for (size_t dj=0; dj<tile.width; dj++) {
+					size_t p = di*tile.width+dj;
+					ReservoirReuse reuse;
+					bool reuse_reservoirs = temporal_reuse || spatial_reuse;
+					if (reuse_reservoirs) {
+						prepare_reuse(tile.row+di, tile.column+dj, reuse);
+					}
+					Vector color = SampleColor(
+						tile.row+di, tile.column+dj, nb_passes, nb_recursions,
+						anti_aliasing, differential_scale,
+						reuse_reservoirs ? &reuse : nullptr
+					);
+					accumulation[3*p] += color.x();
+					accumulation[3*p+1] += color.y();
+					accumulation[3*p+2] += color.z();
+				}
+			}
+			tile_counts[t]++;
+		});
+		if (!complete) {
+			break;
+		}
+		nb_passes++;
+		previous_reservoirs.swap(reservoirs);
+		previous_candidates.swap(candidates);
+
+		if (
+			!options.flush_filename.empty() && options.flush_interval > 0
+			&& elapsed() - last_flush >= options.flush_interval
+		) {
+			resolve();
+			Save(options.flush_filename);
+			last_flush = elapsed();
+		}
+
+		// Prints progress bar if needed
+		if (progress_bar) {
+			double progress = 0;
+			if (options.max_samples != 0) {
+				progress = (double) nb_passes / options.max_samples;
+			}
+			if (options.time_limit > 0) {
+				progress = std::max(progress, elapsed() / options.time_limit);
+			}
+			show_progress(std::min(progress, 1.));
+		}
+	}
+	if (progress_bar) {
+		std::cout << std::endl;
+	}
+
+	resolve();
+	if (!options.flush_filename.empty()) {
+		Save(options.flush_filename);
+	}
+
+	std::vector<unsigned int> counts(Height()*Width());
+	for (size_t t=0; t<tiles.size(); t++) {
+		const Tile &tile = tiles[t];
+		for (size_t di=0; di<tile.height; di++) {
+			for (size_t dj=0; dj<tile.width; dj++) {
+				counts[(tile.row+di)*Width() + tile.column+dj] = tile_counts[t];
+			}
+		}
+	}
+	SetSampleCounts(counts);
+	return nb_passes;
+}
+
+
+bool Scene::ShadePath(
+	PathState &path, const Intersection &inter, Vector &color,
+	bool russian_roulette
+) const {
+	if (inter.IsEmpty()) {
+		// No intersection
+		return false;
+	}
+
+	// Definition of parameters for the following computations, as in GetColor
+	const Ray &r = path.ray;
+	const RawObject &o = inter.Object();
+	SurfaceInteraction surface = o.Interact(r, inter);
+	const Material &material = surface.SurfaceMaterial();
+	const Point &intersection_point = surface.HitPoint();
+	const Vector &normal = surface.Normal();
+
+	double opacity;
+	double fraction_diffuse_brdf;
+	if (path.nb_recursions == 0
+		|| (!russian_roulette && path.intensity < 0.01)) {
+		opacity = 1;
+		fraction_diffuse_brdf = 0;
+	} else {
+		opacity = material.Opacity();
+		fraction_diffuse_brdf = material.FractionDiffuseBRDF();
+	}
+
+	Vector diffuse_color;
+	Vector specular_color;
+	if (opacity != 0) {
+		diffuse_color = surface.DiffuseColor();
+	}
+	if (material.FractionSpecular() != 0 || opacity != 1) {
+		specular_color = surface.SpecularColor();
+	}
+
+	// Values of the bounce, read at fixed dimensions of the sample so that
+	// each decision of the path always uses the same dimension; the Fresnel
+	// choice shares its dimension with the diffuse direction, since only one
+	// of them is made
+	path.sampler.SetDimension(kCameraDimensions + path.depth*kBounceDimensions);
+	double u_lobe = path.sampler.Uniform();
+	double u_roulette = path.sampler.Uniform();
+	double u_direction1 = path.sampler.Uniform();
+	double u_direction2 = path.sampler.Uniform();
+	double u_emitter = path.sampler.Uniform();
+	double u_light1 = path.sampler.Uniform();
+	double u_light2 = path.sampler.Uniform();
+	double u_light = path.sampler.Uniform();
+	double u_resampling = path.sampler.Uniform();
+
+	// Probability of continuing the path with a diffuse ray
+	double fraction_diffusion = 0;
+	double diffuse_density = 0;
+	if (opacity != 1 || fraction_diffuse_brdf != 0) {
+		fraction_diffusion = opacity*fraction_diffuse_brdf
+			/ (1 - opacity*(1-fraction_diffuse_brdf));
+		if (fraction_diffusion >= 0.999) {
+			diffuse_density = 1;
+		} else if (fraction_diffusion > 0.001) {
+			diffuse_density = fraction_diffusion;
+		}
+	}
+
+	// Adds emitted light, weighted as in GetColor, and direct illumination
+	if (material.IsEmissive()) {
+		double weight = 1;
+		if (path.diffuse_pdf != 0) {
+			weight = PowerHeuristic(
+				path.diffuse_pdf,
+				area_lights_.Pdf(r.Origin(), o, r(inter.Distance()))
+			);
+		}
+		color = color + weight * path.weight * material.Emission();
+	}
+	color = color + path.weight * LightIntensity(
+		surface, r, material, diffuse_color, specular_color, opacity,
+		fraction_diffuse_brdf, u_light, u_resampling, path.reuse
+	);
+	path.reuse = nullptr;
+	if (!area_lights_.IsEmpty()) {
+		color = color + path.weight * AreaLightIntensity(
+			surface, r, material, diffuse_color, specular_color, opacity,
+			fraction_diffuse_brdf, diffuse_density, u_emitter, u_light1, u_light2
+		);
+	}
+
+	if (opacity == 1 && fraction_diffuse_brdf == 0) {
+		return false;
+	}
+
+	// Chooses between diffusion and reflection / transmission
+	bool diffusion = diffuse_density != 0
+		&& (diffuse_density == 1 || u_lobe <= fraction_diffusion);
+	path.weight = (1-opacity*(1-fraction_diffuse_brdf)) * path.weight;
+	path.throughput = (1-opacity*(1-fraction_diffuse_brdf)) * path.throughput;
+	path.nb_recursions--;
+	path.depth++;
+
+	if (diffusion) {
+		// Random ray into the half plane defined by the intersection point and
+		// its normal, as in GetBRDFColor
+		Vector ortho1 = normal.Orthogonal();
+		Vector ortho2 = normal^ortho1;
+		double r1 = u_direction1;
+		double r2 = u_direction2;
+		double root = sqrt(1-r2);
+		Vector random_direction = cos(2*PI*r1)*root*ortho1
+			+ sin(2*PI*r1)*root*ortho2 + sqrt(r2)*normal;
+		path.ray = surface.SpawnDiffuse(random_direction, ortho1, ortho2);
+		path.diffuse_pdf = diffuse_density*sqrt(r2)/PI;
+		path.weight = path.weight * diffuse_color / PI;
+		path.throughput = path.throughput * diffuse_color;
+		path.intensity *= opacity*fraction_diffuse_brdf;
+	} else {
+		// Reflection or refraction, as in GetTransmissionReflexionColor
+		Vector refracted_direction, reflected_direction;
+		double new_index;
+		double coef_reflection = FresnelSplit(
+			r, o, material, inter, path.index, normal, reflected_direction,
+			refracted_direction, new_index
+		);
+		path.diffuse_pdf = 0;
+		path.intensity *= 1-opacity;
+		bool reflection = coef_reflection >= 0.999;
+		if (coef_reflection > 0.001 && coef_reflection < 0.999) {
+			reflection = u_direction1 <= coef_reflection;
+			path.intensity *=
+				reflection ? coef_reflection : 1-coef_reflection;
+		}
+		if (reflection) {
+			path.ray = surface.SpawnReflected(
+				r, intersection_point, reflected_direction
+			);
+			path.weight = path.weight * specular_color;
+			path.throughput = path.throughput * specular_color;
+		} else {
+			path.ray = surface.SpawnRefracted(
+				r, r(inter.Distance()*1.001), refracted_direction,
+				inter.IsOut() ? path.index/material.RefractiveIndex()
+					: material.RefractiveIndex()/path.index
+			);
+			path.weight = path.weight * material.TransparentColor();
+			path.throughput = path.throughput * material.TransparentColor();
+			path.index = new_index;
+		}
+	}
+
+	// Russian roulette: terminates the path with a probability decreasing with
+	// its throughput, and compensates the weight of the surviving ones
+	if (russian_roulette && path.depth >= kRouletteDepth) {
+		const Vector &t = path.throughput;
+		double survival =
+			std::min(1., std::max(t.x(), std::max(t.y(), t.z())));
+		if (!(u_roulette < survival)) {
+			return false;
+		}
+		path.weight = path.weight / survival;
+		path.throughput = path.throughput / survival;
+	}
+
+	return true;
+}
+
+
+Vector Scene::TracePath(
+	const Ray &r, const SampleStream &sampler, unsigned int nb_recursions,
+	ReservoirReuse *reuse
+) const {
+	PathState path;
+	path.ray = r;
+	path.sampler = sampler;
+	path.nb_recursions = nb_recursions;
+	path.reuse = reuse;
+	Vector color;
+	bool alive = true;
+	while (alive) {
+		nb_traced_rays++;
+		alive = ShadePath(path, objects_->Intersect(path.ray), color, true);
+	}
+	return color;
+}
+
+
+void Scene::SortPaths(
+	const std::vector<PathState> &paths, std::vector<size_t> &order
+) {
+	// Bounding box of the origins of the paths
+	double double_inf = std::numeric_limits<double>::infinity();
+	Point p_min{double_inf, double_inf, double_inf};
+	Point p_max = -p_min;
+	for (const auto &path : paths) {
+		const Point &o = path.ray.Origin();
+		p_min = Point{std::min(p_min.x(), o.x()), std::min(p_min.y(), o.y()),
+			std::min(p_min.z(), o.z())};
+		p_max = Point{std::max(p_max.x(), o.x()), std::max(p_max.y(), o.y()),
+			std::max(p_max.z(), o.z())};
+	}
+	Vector extent = p_max - p_min;
+	Vector inv_extent{
+		extent.x() > 0 ? 1/extent.x() : 0,
+		extent.y() > 0 ? 1/extent.y() : 0,
+		extent.z() > 0 ? 1/extent.z() : 0
+	};
+
+	// Morton keys of the origins (high bits) and directions (low bits)
+	std::vector<std::pair<std::uint64_t, size_t>> keys(paths.size());
+	#pragma omp parallel for
+	for (size_t i=0; i<paths.size(); i++) {
+		Vector o = (paths[i].ray.Origin() - p_min) * inv_extent;
+		Vector d = (paths[i].ray.Direction() + Vector{1, 1, 1}) / 2;
+		keys[i] = {
+			(static_cast<std::uint64_t>(MortonCode(o.x(), o.y(), o.z())) << 30)
+				| MortonCode(d.x(), d.y(), d.z()),
+			i
+		};
+	}
+	std::sort(keys.begin(), keys.end());
+
+	order.resize(paths.size());
+	for (size_t i=0; i<paths.size(); i++) {
+		order[i] = keys[i].second;
+	}
+}
+
+
+void Scene::SetPixel(size_t i, size_t j, const Vector &color) {
+	// Gamma correction and image storage
+	image_.at((Height()-i-1)*Width()+j)
+		= std::min(255, (int)(255*pow(color.x(), 1/gamma_)));
+	image_.at((Height()-i-1)*Width()+j + Width()*Height())
+		= std::min(255, (int)(255*pow(color.y(), 1/gamma_)));
+	image_.at((Height()-i-1)*Width()+j + 2*Width()*Height())
+		= std::min(255, (int)(255*pow(color.z(), 1/gamma_)));
+}
+
+
+void Scene::SetSampleCounts(const std::vector<unsigned int> &counts) {
+	sample_counts_.resize(counts.size());
 	for (size_t i=0; i<Height(); i++) {
 		for (size_t j=0; j<Width(); j++) {
-			Vector color_pixel;
-			if (!anti_aliasing) {
-				// Usual procedure without anti-aliasing: the launched ray will
-				// be duplicated when needed
-				Ray r = camera_.Launch(i, j);
-				color_pixel = GetColor(r, nb_recursions, nb_samples);
-			} else if (nb_samples != 0) {
-				// For anti-aliasing, nb_samples rays are generated using a
-				// Gaussian distribution centered at the center of the pixel
-				for (unsigned int k=0; k<nb_samples; k++) {
-					double x = distrib_(engine_);
-					double y = distrib_(engine_);
+			sample_counts_[(Height()-i-1)*Width()+j] = counts[i*Width()+j];
+		}
+	}
+}
+
+
+void Scene::RenderWavefront(unsigned int nb_recursions,
+	unsigned int nb_samples, bool anti_aliasing, bool progress_bar,
+	size_t wave_size) {
+	BuildLightTree();
+	const size_t nb_pixels = Height()*Width();
+	sample_counts_.assign(nb_pixels, nb_samples);
+	std::vector<Vector> colors(nb_pixels);
+	std::vector<PathState> paths;
+	std::vector<size_t> order;
+	std::vector<Ray> rays;
+	std::vector<Intersection> intersections;
+	std::unique_ptr<ProgressReporter> reporter;
+	if (progress_bar) {
+		reporter.reset(new ProgressReporter(nb_samples*nb_pixels));
+	}
+
+	// Pixels by tiles of 8x8, so that consecutive camera rays are coherent
+	// without being sorted
+	std::vector<size_t> pixels;
+	pixels.reserve(nb_pixels);
+	for (size_t ti=0; ti<Height(); ti+=8) {
+		for (size_t tj=0; tj<Width(); tj+=8) {
+			for (size_t i=ti; i<std::min(ti+8, Height()); i++) {
+				for (size_t j=tj; j<std::min(tj+8, Width()); j++) {
+					pixels.push_back(i*Width()+j);
+				}
+			}
+		}
+	}
+
+	for (unsigned int k=0; k<nb_samples; k++) {
+		for (size_t first=0; first<nb_pixels; first+=wave_size) {
+			size_t last = std::min(nb_pixels, first+wave_size);
+
+			// Launches one path per pixel of the wave, drawing from the same
+			// stream as the corresponding sample of Render; the queue is empty
+			// after the previous wave, so that paths start from their default
+			paths.resize(last-first);
+			#pragma omp parallel for
+			for (size_t p=first; p<last; p++) {
+				size_t i = pixels[p] / Width();
+				size_t j = pixels[p] % Width();
+				PathState &path = paths[p-first];
+				path.sampler = SampleStream(*sampler_, seed_, j, i, k);
+				double di = 0;
+				double dj = 0;
+				if (anti_aliasing) {
+					// Gaussian distribution centered at the center of the pixel
+					double x = path.sampler.Uniform();
+					double y = path.sampler.Uniform();
 					double R = sqrt(-2*log(x));
-					double di = R*cos(2*PI*y)*0.5;
-					double dj = R*sin(2*PI*y)*0.5;
-					Ray r = camera_.Launch(i, j, di, dj);
-					color_pixel = color_pixel
-						+ GetColor(r, nb_recursions, 1);
+					di = R*cos(2*PI*y)*0.5;
+					dj = R*sin(2*PI*y)*0.5;
+				}
+				path.ray = camera_.Launch(i, j, di, dj);
+				if (anti_aliasing) {
+					path.ray.ScaleDifferentials(1/sqrt(nb_samples));
 				}
-				color_pixel = color_pixel / nb_samples;
+				path.pixel = pixels[p];
+				path.nb_recursions = nb_recursions;
 			}
 
-			// Gamma correction and image storage
-			image_.at((Height()-i-1)*Width()+j)
-				= std::min(255, (int)(255*pow(color_pixel.x(), 1/gamma_)));
-			image_.at((Height()-i-1)*Width()+j + Width()*Height())
-				= std::min(255, (int)(255*pow(color_pixel.y(), 1/gamma_)));
-			image_.at((Height()-i-1)*Width()+j + 2*Width()*Height())
-				= std::min(255, (int)(255*pow(color_pixel.z(), 1/gamma_)));
-
-			// Prints progress bar if needed
-			if (progress_bar) {
-				#pragma omp critical
-				{
-				computed_pixels++;
-				show_progress((double) computed_pixels / (Height()*Width()));
+			// Extends all paths by one bounce until they are all terminated
+			order.resize(paths.size());
+			for (size_t p=0; p<paths.size(); p++) {
+				order[p] = p;
+			}
+			for (bool first_bounce=true; !paths.empty(); first_bounce=false) {
+				if (!first_bounce) {
+					SortPaths(paths, order);
+				}
+				rays.clear();
+				for (size_t q=0; q<paths.size(); q++) {
+					rays.push_back(paths[order[q]].ray);
+				}
+				objects_->IntersectBatch(rays, intersections);
+
+				// Each pixel has at most one path in the queue, so that colors
+				// can be updated concurrently. Paths play Russian roulette as
+				// in TracePath
+				std::vector<char> alive(paths.size());
+				std::uint64_t nb_rays = paths.size();
+				#pragma omp parallel for schedule(dynamic, 64) \
+					reduction(+:nb_rays)
+				for (size_t q=0; q<paths.size(); q++) {
+					size_t p = order[q];
+					std::uint64_t first_ray = nb_traced_rays;
+					alive[p] = ShadePath(
+						paths[p], intersections[q], colors[paths[p].pixel], true
+					);
+					nb_rays += nb_traced_rays - first_ray;
+				}
+				if (reporter) {
+					reporter->Add(0, nb_rays);
+				}
+
+				// Removes terminated paths
+				size_t nb_alive = 0;
+				for (size_t p=0; p<paths.size(); p++) {
+					if (alive[p]) {
+						paths[nb_alive++] = paths[p];
+					}
 				}
+				paths.resize(nb_alive);
+			}
+
+			if (reporter) {
+				reporter->Add(last-first);
 			}
 		}
 	}
-	std::cout << std::endl;
+
+	for (size_t i=0; i<Height(); i++) {
+		for (size_t j=0; j<Width(); j++) {
+			SetPixel(i, j, colors[i*Width()+j] / nb_samples);
+		}
+	}
+	if (reporter) {
+		reporter.reset();
+		std::cout << std::endl;
+	}
 }
 
 
@@ -342,3 +1452,24 @@ void Scene::Save(const std::string &filename) const {
 	};
 	cimg.save(filename.data());
 }
+
+
+void Scene::SaveSampleCounts(const std::string &filename) const {
+	unsigned int max_count = 0;
+	for (unsigned int count : sample_counts_) {
+		max_count = std::max(max_count, count);
+	}
+	std::vector<unsigned char> levels(sample_counts_.size(), 0);
+	for (size_t p=0; p<sample_counts_.size(); p++) {
+		if (max_count != 0) {
+			levels[p] = static_cast<unsigned char>(
+				255. * sample_counts_[p] / max_count);
+		}
+	}
+	cimg_library::CImg<unsigned char> cimg{
+		levels.data(),
+		static_cast<unsigned int>(Width()), static_cast<unsigned int>(Height()),
+		1, 1
+	};
+	cimg.save(filename.data());
+}
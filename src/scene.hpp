@@ -1,12 +1,14 @@
 /**
  * \file scene.hpp
- * \brief Defines classes allowing to define a scene (Camera, Light, Scene).
+ * \brief Defines classes allowing to define a scene (Camera, Scene).
  */
 
 #pragma once
 
+#include "light.hpp"
 #include "object.hpp"
 #include "object_container.hpp"
+#include "sampler.hpp"
 
 
 /**
@@ -59,6 +61,17 @@ public:
 		return width_;
 	}
 
+	/// Outputs the origin of the rays.
+	inline const Point& Origin() const {
+		return origin_;
+	}
+
+	/// Outputs the angle covered by a pixel at the center of the image, in
+	/// radians: a pixel at distance d covers a length of d times this angle.
+	inline double PixelAngle() const {
+		return 2*tan(fov_/2) / height_;
+	}
+
 	/**
 	 * \fn Ray Launch(int i, int j, double di=0, double dj=0)
 	 * \brief Launches a Ray at a given pixel of the Camera.
@@ -66,40 +79,146 @@ public:
 	 * \param j Width coordinate of the pixel.
 	 * \param di Perturbation of the height coordinate of the pixel.
 	 * \param dj Perturbation of the width coordinate of the pixel.
+	 *
+	 * The Ray carries the differentials of its direction with respect to the
+	 * pixel coordinates.
 	 */
 	Ray Launch(size_t i, size_t j, double di=0, double dj=0) const;
 };
 
 
 /**
- * \class Light
- * \brief Represents a punctual light source.
+ * \enum Integrator
+ * \brief Algorithm used by Scene::Render to compute the color of a Ray.
  */
-class Light {
-private:
-	const Point source_;      //!< Point which light comes from.
-	const Vector intensity_ ; //!< Colored intensity of the light.
+enum class Integrator {
+	/// Recursive integrator (see Scene::GetColor), which splits the Ray at the
+	/// first vertex and truncates paths of low importance.
+	kRecursive,
 
-public:
-	/// Builds a Light from its punctual source and an intensity.
-	Light(
-		const Point &source,
-		const Vector &intensity
-	) :
-		source_{source},
-		intensity_{intensity}
-	{
-	}
+	/// Iterative integrator (see Scene::TracePath), which follows one path per
+	/// sample in a loop and terminates it by Russian roulette.
+	kIterative,
 
-	/// Outputs the source point of the Light.
-	inline const Point& Source() const {
-		return source_;
-	}
+	/// Wavefront integrator (see Scene::RenderWavefront), which follows the
+	/// same paths as the iterative one, but extends all of them by one bounce
+	/// at a time and intersects their rays as sorted batches. Only Render
+	/// dispatches to it; other methods use the iterative integrator instead.
+	kWavefront
+};
 
-	/// Outputs the (R,G,B) intensity of the Light.
-	inline const Vector& Intensity() const {
-		return intensity_;
-	}
+
+/**
+ * \struct ReservoirReuse
+ * \brief Reservoirs of previous samples combined with the lights resampled
+ *        at the first vertex of a path (see Scene::SetLightCandidates).
+ */
+struct ReservoirReuse {
+	/// Maximal number of reservoirs combined at once.
+	static const unsigned int kMaxReservoirs = 16;
+
+	/// Reservoirs to combine, built at other shading points.
+	const Reservoir *reservoirs[kMaxReservoirs];
+	unsigned int nb_reservoirs = 0; //!< Number of reservoirs to combine.
+
+	/// Maximal number of candidates a combined reservoir stands for.
+	double max_count = 0;
+
+	/// Output reservoir of the first vertex, combined with the reservoirs
+	/// above, or nullptr.
+	Reservoir *output = nullptr;
+
+	/// Output reservoir of the candidates of the first vertex alone, or
+	/// nullptr.
+	Reservoir *candidates = nullptr;
+};
+
+
+/**
+ * \struct PathState
+ * \brief State of a path traced by the wavefront integrator between two
+ *        bounces.
+ */
+struct PathState {
+	Ray ray;                   //!< Next Ray to trace along the path.
+	Vector weight{1, 1, 1};    //!< Throughput of the path, per channel.
+	size_t pixel = 0;          //!< Index of the pixel the path contributes to.
+	unsigned int nb_recursions = 0; //!< Remaining depth of the path.
+	double index = 1;          //!< Refractive index of the current environment.
+	double intensity = 1;      //!< Importance of the path in the final pixel.
+
+	/// Density with which ray was sampled as a diffuse ray, with respect to
+	/// solid angle, or 0 if it is not a diffuse ray (see Scene::GetColor).
+	double diffuse_pdf = 0;
+	unsigned int depth = 0;    //!< Number of bounces done so far.
+	SampleStream sampler;      //!< Dimensions of the sample of the path.
+
+	/// Reservoirs combined at the next vertex of the path, or nullptr.
+	ReservoirReuse *reuse = nullptr;
+
+	/// Product of the colors reflected or transmitted along the path, rescaled
+	/// by the survival probabilities of Russian roulette.
+	Vector throughput{1, 1, 1};
+};
+
+
+/**
+ * \struct AdaptiveOptions
+ * \brief Options controlling the number of samples of each pixel in
+ *        Scene::RenderAdaptive.
+ */
+struct AdaptiveOptions {
+	/// Number of samples taken by every pixel before estimating its error.
+	unsigned int base_samples = 16;
+
+	/// Maximal number of samples of a pixel.
+	unsigned int max_samples = 1024;
+
+	/// Standard error of the color of a pixel, in [0,1] units of the final
+	/// image, under which it stops receiving samples.
+	double threshold = 0.01;
+};
+
+
+/**
+ * \struct ProgressiveOptions
+ * \brief Options controlling when Scene::RenderProgressive stops and saves
+ *        intermediate images.
+ *
+ * At least one of max_samples and time_limit must be set.
+ */
+struct ProgressiveOptions {
+	/// Number of samples per pixel after which the render stops, or 0 for no
+	/// target.
+	unsigned int max_samples = 0;
+
+	/// Wall-clock duration after which the render stops, in seconds, or 0 for
+	/// no deadline.
+	double time_limit = 0;
+
+	/// Minimal duration between two saves of the intermediate image, in
+	/// seconds, or 0 to only save the final image.
+	double flush_interval = 0;
+
+	/// File into which the intermediate images and the final one are saved,
+	/// or empty to save none.
+	std::string flush_filename;
+
+	/// Indicates if the reservoir of each pixel is combined with the one of
+	/// the same pixel in the previous pass, when lights are resampled (see
+	/// Scene::SetLightCandidates).
+	bool temporal_reuse = false;
+
+	/// Number of neighboring pixels whose candidates of the previous pass are
+	/// combined with the reservoir of each pixel, when lights are resampled.
+	unsigned int spatial_reuse = 0;
+
+	/// Radius, in pixels, of the neighborhood of spatial reuse.
+	double reuse_radius = 10;
+
+	/// Maximal number of candidates a reused reservoir stands for, relative
+	/// to the number of candidates of a shading point.
+	double max_reuse_count = 1;
 };
 
 
@@ -107,51 +226,165 @@ public:
  * \class Scene
  * \brief Represents a scene, containing a Camera, a vector of Lights and an
  *        ObjectContainer.
+ *
+ * Objects whose Material emits light are also light sources: emissive
+ * spheres and triangles, including those of meshes, are sampled as area
+ * lights at each diffuse vertex (next-event estimation), and the light
+ * reaching them through diffuse rays is combined with these samples by
+ * multiple importance sampling, with the power heuristic.
  */
 class Scene {
 private:
 	const Camera camera_; //!< Point of view from which the scene is seen.
-	std::shared_ptr<ObjectContainer> objects_; //!< Container of all objects.
+	/// Container of all objects.
+	std::shared_ptr<const ObjectContainer> objects_;
 	std::vector<unsigned char> image_; //!< Rendered scene storage.
+
+	/// Number of samples taken by each pixel during the last render, in the
+	/// order of the pixels of image_.
+	std::vector<unsigned int> sample_counts_;
 	std::vector<Light> lights_; //!< Stores all the light sources in the scene.
+	AreaLights area_lights_; //!< Emissive surfaces of the objects.
+
+	/// Number of lights of lights_ chosen at each shading point, or 0 to use
+	/// all of them.
+	unsigned int light_samples_ = 0;
+
+	/// Number of candidate lights resampled into one at each shading point, or
+	/// 0 to disable resampling.
+	unsigned int light_candidates_ = 0;
+
+	/// Hierarchy of lights_ choosing the lights, built at the beginning of each
+	/// render if light_samples_ or light_candidates_ is not 0.
+	LightTree light_tree_;
 	double gamma_ = 2.2; //!< Correction to apply to the final intensity.
 
-	std::default_random_engine engine_; //!< Random engine generator.
-	/// Uniform real distribution over [0,1].
-	std::uniform_real_distribution<double> distrib_
-		= std::uniform_real_distribution<double>{0, 1};
+	/// Algorithm computing the color of the rays launched by Render.
+	Integrator integrator_ = Integrator::kRecursive;
 
-	/// Computes the intensity given by the lights at a given point, given a
-	/// normal to this point (properly coefficiented).
-	/// \note All arguments are taken from the body of GetColor.
-	Vector LightIntensity(
-		const Point &p, const Vector &normal, const Ray &r,
+	/// Generator of the samples of each pixel.
+	std::shared_ptr<const Sampler> sampler_{new IndependentSampler};
+
+	/// Global seed of the samples, combined with the pixel and sample indices.
+	std::uint64_t seed_ = 0;
+
+	/// Computes the intensity given by the input Light at a given point, given
+	/// a normal to this point (properly coefficiented), as if it were visible.
+	/// \note Other arguments are taken from the body of GetColor.
+	Vector PointLightIntensity(
+		const Light &l, const Point &p, const Vector &normal, const Ray &r,
 		const Material &material, const Vector &diffuse_color,
 		const Vector &specular_color, double opacity,
 		double fraction_diffuse_brdf
 	) const;
 
-	/// Computes the color that is due to diffusion of light accross the Scene.
-	/// \note All arguments are taken from the body of GetColor.
+	/// Indicates if no object lies between the point of the input surface and
+	/// Light.
+	bool IsLightVisible(
+		const SurfaceInteraction &surface, const Light &l
+	) const;
+
+	/**
+	 * \fn Vector LightIntensity(const SurfaceInteraction &surface, const Ray &r, const Material &material, const Vector &diffuse_color, const Vector &specular_color, double opacity, double fraction_diffuse_brdf, double u_light, double u_resampling, ReservoirReuse *reuse) const
+	 * \brief Computes the intensity given by the lights at the point of the
+	 *        input surface, given its normal (properly coefficiented).
+	 * \param surface Surface hit by r, which shadow rays leave.
+	 * \param u_light Value of the sample choosing the lights in light_tree_,
+	 *        irrelevant if all lights are used.
+	 * \param u_resampling Value of the sample resampling the candidate lights,
+	 *        irrelevant if lights are not resampled.
+	 * \param reuse Reservoirs of previous samples to combine, or nullptr.
+	 * \note Other arguments are taken from the body of GetColor.
+	 *
+	 * The light_samples_ chosen lights, or the light_candidates_ candidates,
+	 * are stratified along u_light.
+	 */
+	Vector LightIntensity(
+		const SurfaceInteraction &surface, const Ray &r,
+		const Material &material, const Vector &diffuse_color,
+		const Vector &specular_color, double opacity,
+		double fraction_diffuse_brdf, double u_light, double u_resampling,
+		ReservoirReuse *reuse
+	) const;
+
+	/// Computes the intensity given by the lights at a given point with one
+	/// shadow ray, towards a light resampled from light_candidates_ candidates
+	/// and the reservoirs of reuse, if any.
+	/// \note All arguments are taken from LightIntensity.
+	Vector ResampledLightIntensity(
+		const SurfaceInteraction &surface, const Ray &r,
+		const Material &material, const Vector &diffuse_color,
+		const Vector &specular_color, double opacity,
+		double fraction_diffuse_brdf, double u_light, double u_resampling,
+		ReservoirReuse *reuse
+	) const;
+
+	/// Builds light_tree_ if lights are chosen or resampled, and clears it
+	/// otherwise.
+	void BuildLightTree();
+
+	/**
+	 * \fn Vector AreaLightIntensity(const SurfaceInteraction &surface, const Ray &r, const Material &material, const Vector &diffuse_color, const Vector &specular_color, double opacity, double fraction_diffuse_brdf, double diffuse_density, double u_emitter, double u, double v) const
+	 * \brief Computes the intensity given by one sample of the area lights at
+	 *        the point of the input surface, for both the direct and the
+	 *        diffuse parts.
+	 * \param surface Surface hit by r, which the shadow ray leaves.
+	 * \param diffuse_density Expected number of diffuse rays launched from the
+	 *        point, which weights the sample against them.
+	 * \param u_emitter, u, v Values of the sample (see AreaLights::Sample).
+	 * \note Other arguments are taken from the body of GetColor.
+	 */
+	Vector AreaLightIntensity(
+		const SurfaceInteraction &surface, const Ray &r,
+		const Material &material, const Vector &diffuse_color,
+		const Vector &specular_color, double opacity,
+		double fraction_diffuse_brdf, double diffuse_density,
+		double u_emitter, double u, double v
+	) const;
+
+	/**
+	 * \fn double FresnelSplit(const Ray &r, const RawObject &o, const Material &material, const Intersection &inter, double index, const Vector &normal, Vector &reflected_direction, Vector &refracted_direction, double &new_index) const
+	 * \brief Computes the directions of the reflected and refracted rays at an
+	 *        intersection point, and the Fresnel coefficient between them.
+	 * \param reflected_direction, refracted_direction Output directions;
+	 *        refracted_direction is only relevant if the returned coefficient
+	 *        is lower than 1.
+	 * \param new_index Output refractive index of the environment of the
+	 *        refracted ray.
+	 * \return The fraction of the light that is reflected.
+	 * \note Other arguments are taken from the body of GetColor.
+	 */
+	double FresnelSplit(
+		const Ray &r, const RawObject &o, const Material &material,
+		const Intersection &inter, double index, const Vector &normal,
+		Vector &reflected_direction, Vector &refracted_direction,
+		double &new_index
+	) const;
+
+	/// Computes the color that is due to diffusion of light accross the Scene;
+	/// diffuse_density is the expected number of diffuse rays launched from
+	/// the surface (see AreaLightIntensity).
+	/// \note Other arguments are taken from the body of GetColor.
 	Vector GetBRDFColor(
 		unsigned int nb_samples, unsigned int nb_recursions, double intensity,
-		const Vector &diffuse_color, const Vector &normal,
-		const Point &intersection_point, double index
-	);
+		const Vector &diffuse_color, const SurfaceInteraction &surface,
+		double index, double diffuse_density, SampleStream &sampler
+	) const;
 
 	/// Computes the fraction of the color that is due reflection or refraction.
 	/// \note All arguments are taken from the body of GetColor.
 	Vector GetTransmissionReflexionColor(
 		unsigned int nb_samples, unsigned int nb_recursions, double intensity,
-		const Ray &r, const RawObject &o, const Point &intersection_point,
+		const Ray &r, const RawObject &o, const SurfaceInteraction &surface,
 		const Material &material, const Vector &specular_color,
-		const Intersection &inter, double index, const Vector &normal
-	);
+		const Intersection &inter, double index, SampleStream &sampler
+	) const;
 
 	/**
-	 * \fn Vector GetColor(const Ray &r, unsigned int nb_recursions, unsigned int nb_samples=1, double index=1, double intensity=1)
+	 * \fn Vector GetColor(const Ray &r, SampleStream &sampler, unsigned int nb_recursions, unsigned int nb_samples=1, double index=1, double intensity=1, double diffuse_pdf=0, ReservoirReuse *reuse=nullptr) const
 	 * \brief Computes the (R,G,B) color produced by the input Ray, with R, G
 	 *        and B between 0 and 1.
+	 * \param sampler Dimensions of the sample, consumed in order.
 	 * \param nb_recursions Limits the depth of the recursive calls tree.
 	 * \param nb_samples Number of rays to relaunch in the diffusion
 	 *        computation.
@@ -159,6 +392,12 @@ private:
 	 *        the Ray is casted from inside an object).
 	 * \param intensity Importance of the computed color in the final pixel of
 	 *        the original launch Ray.
+	 * \param diffuse_pdf Density with which r was sampled by the diffuse rays
+	 *        of the previous vertex, with respect to solid angle, or 0 if it
+	 *        was not a diffuse ray. Weights the light emitted by the hit
+	 *        surface against the area light samples of that vertex.
+	 * \param reuse Reservoirs combined with the lights resampled at the
+	 *        intersection point, or nullptr.
 	 *
 	 * If a component of the color vector goes over 1, it will be counted as 1.
 	 *
@@ -168,36 +407,191 @@ private:
 	 * Irrelevant if nb_samples = 0.
 	 */
 	Vector GetColor(
-		const Ray &r, unsigned int nb_recursions, unsigned int nb_samples=1,
-		double index=1, double intensity=1
+		const Ray &r, SampleStream &sampler, unsigned int nb_recursions,
+		unsigned int nb_samples=1, double index=1, double intensity=1,
+		double diffuse_pdf=0, ReservoirReuse *reuse=nullptr
+	) const;
+
+	/**
+	 * \fn bool ShadePath(PathState &path, const Intersection &inter, Vector &color, bool russian_roulette=false) const
+	 * \brief Shades one vertex of a path of the wavefront or iterative
+	 *        integrator.
+	 * \param path Path to extend; replaced by its continuation, if any.
+	 * \param inter Closest Intersection of the path's current Ray.
+	 * \param color Color of the pixel of the path, incremented by the direct
+	 *        illumination at the vertex.
+	 * \param russian_roulette If set to true, paths of low importance are not
+	 *        truncated, but terminated at random after kRouletteDepth bounces
+	 *        with a probability given by their throughput.
+	 * \return true if the path continues, false if it is terminated.
+	 *
+	 * Follows exactly the decisions of GetColor with nb_samples = 1, but picks
+	 * one continuation instead of recursing into it, so that the result has
+	 * the same expectation.
+	 */
+	bool ShadePath(
+		PathState &path, const Intersection &inter, Vector &color,
+		bool russian_roulette=false
+	) const;
+
+	/**
+	 * \fn Vector TracePath(const Ray &r, const SampleStream &sampler, unsigned int nb_recursions, ReservoirReuse *reuse=nullptr) const
+	 * \brief Computes the color produced by the input Ray by following a
+	 *        single path in a loop, terminated by Russian roulette.
+	 * \param sampler Dimensions of the sample of the path.
+	 * \param nb_recursions Maximal depth of the path, as a safeguard: the
+	 *        path is only truncated there.
+	 * \param reuse Reservoirs combined at the first vertex, or nullptr.
+	 *
+	 * Unlike GetColor, the stack does not grow with the depth of the path,
+	 * and paths are never truncated because of their low importance, so that
+	 * the estimate is unbiased up to nb_recursions bounces.
+	 */
+	Vector TracePath(
+		const Ray &r, const SampleStream &sampler, unsigned int nb_recursions,
+		ReservoirReuse *reuse=nullptr
+	) const;
+
+	/**
+	 * \fn Vector SampleColor(size_t i, size_t j, unsigned int k, unsigned int nb_recursions, bool anti_aliasing, double differential_scale, ReservoirReuse *reuse=nullptr) const
+	 * \brief Computes the color of the k-th sample of pixel (i,j) with the
+	 *        selected Integrator, splitting no Ray.
+	 * \param anti_aliasing If set to true, the Ray is jittered around the
+	 *        center of the pixel, as in Render.
+	 * \param differential_scale Scale of the differentials of jittered rays.
+	 * \param reuse Reservoirs combined at the first vertex, or nullptr.
+	 */
+	Vector SampleColor(
+		size_t i, size_t j, unsigned int k, unsigned int nb_recursions,
+		bool anti_aliasing, double differential_scale,
+		ReservoirReuse *reuse=nullptr
+	) const;
+
+	/**
+	 * \fn static void SortPaths(const std::vector<PathState> &paths, std::vector<size_t> &order)
+	 * \brief Outputs the indices of the paths sorted by the Morton code of the
+	 *        origin of their Ray, then by the Morton code of its direction, to
+	 *        trace coherent batches.
+	 *
+	 * Only the indices are sorted, since paths are much larger than their rays.
+	 */
+	static void SortPaths(
+		const std::vector<PathState> &paths, std::vector<size_t> &order
 	);
 
+	/// Applies gamma correction to the input color and stores it in image_ at
+	/// pixel (i,j).
+	void SetPixel(size_t i, size_t j, const Vector &color);
+
+	/// Stores in sample_counts_ the input numbers of samples of each pixel,
+	/// given in the order of the pixels of the Camera (index i*Width()+j).
+	void SetSampleCounts(const std::vector<unsigned int> &counts);
+
 public:
-	/// Constructs a Scene from a Camera and an ObjectVector.
+	/// Number of bounces after which the iterative integrator starts playing
+	/// Russian roulette.
+	static const unsigned int kRouletteDepth = 3;
+
+	/// Number of sample dimensions used by the camera (pixel jitter).
+	static const unsigned int kCameraDimensions = 2;
+
+	/// Number of sample dimensions used by each bounce of a path of the
+	/// iterative or wavefront integrator: choice of the lobe, Russian
+	/// roulette, diffuse direction or Fresnel choice, area light sample, and
+	/// choice and resampling of the punctual lights.
+	static const unsigned int kBounceDimensions = 9;
+
+	/// Constructs a Scene from a Camera and an ObjectVector, whose emissive
+	/// objects become area lights. The level of detail of each MeshInstance
+	/// is selected from the Camera.
 	Scene(
 		const Camera &camera,
 		const ObjectVector &objects
 	) :
-		camera_{camera},
-		objects_{new ObjectVector(objects)}
+		camera_{camera}
 	{
-		using namespace std;
-		engine_ = default_random_engine(
-			chrono::high_resolution_clock::now().time_since_epoch().count()
-		);
+		// Emitters point to the objects of the copy owned by the Scene
+		std::shared_ptr<ObjectVector> copy{new ObjectVector(objects)};
+		copy->SelectLevels(camera);
+		area_lights_ = AreaLights{copy->Primitives()};
+		objects_ = copy;
 		image_.assign(3*camera.Height()*camera.Width(), 0);
+		sample_counts_.assign(camera.Height()*camera.Width(), 0);
 	}
 
+	/**
+	 * \fn Scene(const Camera &camera, const std::shared_ptr<const ObjectContainer> &objects)
+	 * \brief Constructs a Scene from a Camera and a shared container of
+	 *        objects, such as a BVH or a StreamedMesh.
+	 *
+	 * The container is traced as it is: emissive objects only become area
+	 * lights if it is an ObjectVector or a BVH, and levels of detail are only
+	 * selected by the other constructor. Containers with their own
+	 * IntersectBatch (BVH, StreamedMesh) are best rendered with the wavefront
+	 * integrator, which traces sorted batches of rays.
+	 */
+	Scene(
+		const Camera &camera,
+		const std::shared_ptr<const ObjectContainer> &objects
+	);
+
 	/// Adds the input Light to the scene.
 	inline void AddLight(const Light &light) {
 		lights_.push_back(light);
 	}
 
+	/**
+	 * \fn void SetLightSamples(unsigned int nb_samples)
+	 * \brief Sets the number of punctual lights chosen at each shading point,
+	 *        or 0 to use all of them (default).
+	 *
+	 * Lights are chosen by a LightTree according to their estimated
+	 * contribution, so that the cost of shading only grows logarithmically
+	 * with the number of lights; this adds noise, and is meant for scenes with
+	 * many lights.
+	 */
+	inline void SetLightSamples(unsigned int nb_samples) {
+		light_samples_ = nb_samples;
+	}
+
+	/**
+	 * \fn void SetLightCandidates(unsigned int nb_candidates)
+	 * \brief Sets the number of candidate lights resampled into one at each
+	 *        shading point, or 0 to disable resampling (default).
+	 *
+	 * Candidates are chosen by a LightTree, then one of them is kept in a
+	 * Reservoir according to its unshadowed contribution, and only this one
+	 * casts a shadow ray. Resampling overrides SetLightSamples. With
+	 * RenderProgressive, reservoirs can moreover be reused between passes and
+	 * neighboring pixels (see ProgressiveOptions), which introduces a slight
+	 * bias at the edges of objects and of shadows.
+	 */
+	inline void SetLightCandidates(unsigned int nb_candidates) {
+		light_candidates_ = nb_candidates;
+	}
+
 	/// Sets the gamma correction.
 	inline void SetGamma(double gamma) {
 		gamma_ = gamma;
 	}
 
+	/// Sets the global seed of the random numbers. Renders with the same seed
+	/// are identical, whatever the number of threads.
+	inline void SetSeed(std::uint64_t seed) {
+		seed_ = seed;
+	}
+
+	/// Sets the generator of the samples of each pixel (IndependentSampler by
+	/// default).
+	inline void SetSampler(const std::shared_ptr<const Sampler> &sampler) {
+		sampler_ = sampler;
+	}
+
+	/// Sets the algorithm computing the color of the rays launched by Render.
+	inline void SetIntegrator(Integrator integrator) {
+		integrator_ = integrator;
+	}
+
 	/// Outputs the current camera.
 	inline const Camera& GetCamera() const {
 		return camera_;
@@ -220,21 +614,142 @@ public:
 	 * \param nb_samples Number of rays launched by pixel.
 	 * \param anti_aliasing If set to true, enables anti_aliasing.
 	 * \param progress_bar If set to true, enables a progress bar in the command
-	 *        line.
-	 * \warning Enabling the progress bar slows significantly scenes that are
-	 *          quickly rendered without progress bar. It should only be
-	 *          enabled for scenes needing more than 2 minutes of rendering.
+	 *        line, with the remaining time and the number of rays traced per
+	 *        second (see ProgressReporter).
 	 *
 	 * In order to optimize the rendering step when the number of launched rays
 	 * is greater than 1, this method (and all methods subsequently called)
 	 * only launches one ray, and, when needed splits this ray into nb_samples.
 	 * This optimization enables to save duplicate computations.
+	 *
+	 * The color of each Ray is computed by the selected Integrator; the
+	 * iterative one traces nb_samples independent paths instead of splitting
+	 * a single one, and the wavefront one calls RenderWavefront.
+	 *
+	 * Each sample draws its values from the Sampler of the scene, as a pure
+	 * function of its pixel and index, so that the image only depends on the
+	 * seed (see SetSeed).
+	 *
+	 * Pixels are rendered by tiles distributed between threads by a
+	 * TileScheduler; each tile is computed in a local buffer, then copied to
+	 * image_.
 	 */
 	void Render(
 		unsigned int nb_recursions, unsigned int nb_samples,
 		bool anti_aliasing=false, bool progress_bar=false
 	);
 
+	/**
+	 * \fn void RenderWavefront(unsigned int nb_recursions, unsigned int nb_samples, bool anti_aliasing=false, bool progress_bar=false, size_t wave_size=1<<16)
+	 * \brief Renders the current scene with a wavefront integrator and stores
+	 *        it in image_.
+	 * \param nb_recursions Limits the depth of the paths.
+	 * \param nb_samples Number of paths launched by pixel.
+	 * \param anti_aliasing If set to true, enables anti_aliasing.
+	 * \param progress_bar If set to true, enables a progress bar in the command
+	 *        line, with the remaining time and the number of rays traced per
+	 *        second (see ProgressReporter).
+	 * \param wave_size Maximal number of paths traced together; the default
+	 *        limits their states to about 20 MB.
+	 *
+	 * Instead of following each ray recursively, this method keeps a queue of
+	 * paths (one per pixel, for up to wave_size pixels at a time) and extends
+	 * them all by one bounce at each step: the queue is sorted for coherence
+	 * (camera rays are launched by tiles of 8x8 pixels instead), intersected
+	 * as a batch (see ObjectContainer::IntersectBatch), then shaded as a
+	 * batch. Each path is the one TracePath would follow for the same sample,
+	 * Russian roulette included, so that the image is the one of the iterative
+	 * integrator. Only the rays of the paths are batched; shadow rays are
+	 * still traced one by one while shading. Batches only pay off with
+	 * containers whose IntersectBatch exploits their coherence, such as a BVH,
+	 * which traverses the tree by packets.
+	 */
+	void RenderWavefront(
+		unsigned int nb_recursions, unsigned int nb_samples,
+		bool anti_aliasing=false, bool progress_bar=false,
+		size_t wave_size=1<<16
+	);
+
+	/**
+	 * \fn void RenderAdaptive(unsigned int nb_recursions, const AdaptiveOptions &options=AdaptiveOptions{}, bool anti_aliasing=false, bool progress_bar=false)
+	 * \brief Renders the current scene with a number of samples adapted to
+	 *        each pixel, and stores it in image_.
+	 * \param nb_recursions Limits the depth of the paths.
+	 * \param options Base and maximal numbers of samples, and error threshold.
+	 * \param anti_aliasing If set to true, enables anti_aliasing.
+	 * \param progress_bar If set to true, enables a progress bar in the command
+	 *        line, for each round of samples.
+	 *
+	 * Every pixel first takes options.base_samples samples, then the mean and
+	 * variance of their colors give the standard error of the pixel, after
+	 * gamma correction. Pixels whose error exceeds options.threshold double
+	 * their number of samples, up to options.max_samples, and are estimated
+	 * again, until no pixel needs more samples. Sample counts thus stay powers
+	 * of two times the base count, which suits the Sobol sampler.
+	 *
+	 * Each sample launches a single Ray (see SampleColor), so that the
+	 * variance of the pixel can be estimated. The number of samples of each
+	 * pixel is available in SampleCounts.
+	 */
+	void RenderAdaptive(
+		unsigned int nb_recursions,
+		const AdaptiveOptions &options=AdaptiveOptions{},
+		bool anti_aliasing=false, bool progress_bar=false
+	);
+
+	/**
+	 * \fn unsigned int RenderProgressive(unsigned int nb_recursions, const ProgressiveOptions &options, bool anti_aliasing=false, bool progress_bar=false)
+	 * \brief Renders the current scene by successive passes of one sample per
+	 *        pixel, until a target number of samples or a deadline, and stores
+	 *        it in image_.
+	 * \param nb_recursions Limits the depth of the paths.
+	 * \param options Stopping criteria and saves of intermediate images.
+	 * \param anti_aliasing If set to true, enables anti_aliasing.
+	 * \param progress_bar If set to true, enables a progress bar in the command
+	 *        line, towards the closest stopping criterion.
+	 * \return The number of complete passes.
+	 * \throw std::runtime_error If options sets no stopping criterion.
+	 *
+	 * Colors are accumulated in floating-point buffers local to each tile
+	 * (see TileScheduler), and only converted to image_ when an intermediate
+	 * image is saved, and at the end. The deadline is checked before each
+	 * tile, so that a pass may stop before its end: pixels then have
+	 * different numbers of samples, given by SampleCounts.
+	 *
+	 * Jittered rays have their differentials scaled for options.max_samples
+	 * samples, if set, and are left unscaled otherwise.
+	 *
+	 * If lights are resampled (see SetLightCandidates), reservoirs of the
+	 * first vertex of each pixel are kept for the next pass, and combined with
+	 * the candidates of the first vertex of the same pixel (temporal reuse) or
+	 * of its neighbors (spatial reuse), provided that their shading point lies
+	 * close to its tangent plane with a similar normal. Spatial reuse only
+	 * combines the candidates of the neighbors, and not the reservoirs they
+	 * reused in turn, so that passes stay nearly independent; temporal reuse
+	 * makes successive passes correlated, which lowers the noise of the first
+	 * passes more than the one of the final image.
+	 */
+	unsigned int RenderProgressive(
+		unsigned int nb_recursions, const ProgressiveOptions &options,
+		bool anti_aliasing=false, bool progress_bar=false
+	);
+
+	/// Outputs the rendered image, as three planes (R, G, B) of gamma-corrected
+	/// values, the last row of the Camera first.
+	inline const std::vector<unsigned char>& Image() const {
+		return image_;
+	}
+
+	/// Outputs the number of samples taken by each pixel during the last
+	/// render, in the order of the pixels of Image.
+	inline const std::vector<unsigned int>& SampleCounts() const {
+		return sample_counts_;
+	}
+
 	/// Saves the rendered scene into the given filename.
 	void Save(const std::string &filename) const;
+
+	/// Saves the number of samples of each pixel into the given filename, as
+	/// a grayscale image scaled by the largest number of samples.
+	void SaveSampleCounts(const std::string &filename) const;
 };
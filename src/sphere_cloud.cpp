@@ -0,0 +1,197 @@
+/**
+ * \file sphere_cloud.cpp
+ * \brief Implements methods of class SphereCloud.
+ */
+
+#include <stdexcept>
+#include "sphere_cloud.hpp"
+
+
+Object::Object(SphereCloud &cloud) :
+	raw_object_{new SphereCloud{std::move(cloud)}},
+	type_{PrimitiveType::kOther}
+{
+}
+
+
+void SphereCloud::Build(
+	const std::vector<Point> &centers,
+	const std::vector<double> &radii,
+	const std::vector<std::uint16_t> &material_indices
+) {
+	if (radii.size() != centers.size()
+		|| material_indices.size() != centers.size()) {
+		throw std::runtime_error("SphereCloud: inconsistent array sizes");
+	}
+	for (auto index : material_indices) {
+		if (index >= materials_.size()) {
+			throw std::runtime_error("SphereCloud: invalid material index");
+		}
+	}
+
+	// Bounding boxes of the spheres
+	std::vector<Bounds> bounds(centers.size());
+	for (size_t i=0; i<centers.size(); i++) {
+		Vector offset{radii[i], radii[i], radii[i]};
+		bounds[i].Grow(centers[i] - offset);
+		bounds[i].Grow(centers[i] + offset);
+	}
+
+	// Stores the spheres in the order of the leaves of the BVH
+	std::vector<unsigned int> order = bvh_.Build(bounds, kLeafSize, kBlockSize);
+	size_t size = (centers.size() + kBlockSize - 1) / kBlockSize * kBlockSize;
+	// Padding spheres have a NaN radius, so that they are never hit
+	x_.assign(size, 0);
+	y_.assign(size, 0);
+	z_.assign(size, 0);
+	radius_.assign(size, std::numeric_limits<float>::quiet_NaN());
+	material_indices_.assign(size, 0);
+	for (size_t i=0; i<order.size(); i++) {
+		const Point &center = centers[order[i]];
+		x_[i] = center.x();
+		y_[i] = center.y();
+		z_[i] = center.z();
+		radius_[i] = radii[order[i]];
+		material_indices_[i] = material_indices[order[i]];
+	}
+}
+
+
+bool SphereCloud::IntersectSphere(
+	unsigned int i, const Ray &r, double &t, bool &out
+) const {
+	// Same computation as Sphere::Intersect
+	Vector center_to_origin = r.Origin() - Point{x_[i], y_[i], z_[i]};
+	double dot_prod = r.Direction() | center_to_origin;
+	double radius = radius_[i];
+	double delta = dot_prod*dot_prod - center_to_origin.NormSquared()
+		+ radius*radius;
+	if (!(delta >= 0)) {
+		return false;
+	}
+	double root = sqrt(delta);
+	if (-dot_prod - root > 0) {
+		t = -dot_prod - root;
+		out = true;
+	} else if (-dot_prod + root > 0) {
+		t = -dot_prod + root;
+		out = false;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
+size_t SphereCloud::MemoryUsage() const {
+	return sizeof(SphereCloud)
+		+ (x_.capacity() + y_.capacity() + z_.capacity() + radius_.capacity())
+			* sizeof(float)
+		+ material_indices_.capacity() * sizeof(std::uint16_t)
+		+ materials_.capacity() * sizeof(Material)
+		+ bvh_.MemoryUsage();
+}
+
+
+Intersection SphereCloud::Intersect(const Ray &r) const {
+	const float origin_x = r.Origin().x();
+	const float origin_y = r.Origin().y();
+	const float origin_z = r.Origin().z();
+	const float direction_x = r.Direction().x();
+	const float direction_y = r.Direction().y();
+	const float direction_z = r.Direction().z();
+	const float float_inf = std::numeric_limits<float>::infinity();
+
+	double t_max = std::numeric_limits<double>::infinity();
+	bool found = false;
+	bool out = false;
+	unsigned int sphere = 0;
+	bvh_.Traverse(r, t_max, [&](unsigned int leaf, unsigned int count) {
+		for (unsigned int first=leaf; first<leaf+count; first+=kBlockSize) {
+			const float *x = x_.data() + first;
+			const float *y = y_.data() + first;
+			const float *z = z_.data() + first;
+			const float *radius = radius_.data() + first;
+
+			// Tests a whole block of spheres at once in single precision;
+			// blocks always start at a multiple of kBlockSize and the arrays
+			// are padded
+			float t_block[kBlockSize];
+			#pragma omp simd
+			for (unsigned int k=0; k<kBlockSize; k++) {
+				float to_center_x = x[k] - origin_x;
+				float to_center_y = y[k] - origin_y;
+				float to_center_z = z[k] - origin_z;
+				float dot_prod = to_center_x*direction_x
+					+ to_center_y*direction_y + to_center_z*direction_z;
+				float distance_squared = to_center_x*to_center_x
+					+ to_center_y*to_center_y + to_center_z*to_center_z;
+				float delta = dot_prod*dot_prod + radius[k]*radius[k]
+					- distance_squared;
+				float root = std::sqrt(std::max(delta, 0.f));
+				float t_near = dot_prod - root;
+				float t_far = dot_prod + root;
+				// Grazing rays are kept up to the rounding error of delta, and
+				// decided in double precision
+				t_block[k] = delta >= -1e-6f*distance_squared
+					? (t_near > 0 ? t_near : t_far) : float_inf;
+			}
+
+			// Confirms the candidates in double precision
+			unsigned int block_count = leaf+count-first;
+			for (unsigned int k=0; k<block_count && k<kBlockSize; k++) {
+				if (t_block[k] > 0 && t_block[k] < float_inf
+					&& t_block[k] < 1.001*t_max) {
+					double t;
+					bool sphere_out;
+					if (IntersectSphere(first+k, r, t, sphere_out)
+						&& t < t_max) {
+						t_max = t;
+						out = sphere_out;
+						sphere = first+k;
+						found = true;
+					}
+				}
+			}
+		}
+	});
+
+	if (!found) {
+		return Intersection{*this};
+	}
+	return Intersection{t_max, out, 0, 0, *this, sphere};
+}
+
+
+Vector SphereCloud::Normal(const Point &p) const {
+	return Vector{0, 0, 1};
+}
+
+
+AABB SphereCloud::BoundingBox() const {
+	return bvh_.RootBounds().ToAABB();
+}
+
+
+SurfaceInteraction SphereCloud::Interact(
+	const Ray &r,
+	const Intersection &inter
+) const {
+	unsigned int i = inter.Primitive();
+	Point p = r(inter.Distance());
+	Vector direction = p - Point{x_[i], y_[i], z_[i]};
+	double distance_to_center_squared = direction.NormSquared();
+	// Gives an "in" normal (directed towards the center) if p is in the sphere,
+	// an "out" normal otherwise, as Sphere::Normal
+	direction.Normalize();
+	double radius = radius_[i];
+	if (distance_to_center_squared < radius*radius) {
+		direction = -direction;
+	}
+	SurfaceInteraction s{
+		p, direction, Vector{1, 0, 0}, materials_[material_indices_[i]], *this,
+		i
+	};
+	s.ComputeDifferentials(r, inter.Distance());
+	return s;
+}
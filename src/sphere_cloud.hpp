@@ -0,0 +1,123 @@
+/**
+ * \file sphere_cloud.hpp
+ * \brief Defines the SphereCloud object.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "object_container.hpp"
+
+
+/**
+ * \class SphereCloud
+ * \brief Defines a large set of spheres stored as a structure of arrays, with
+ *        its own BVH.
+ *
+ * Each sphere only costs its center and radius in single precision, and the
+ * 16-bit index of its material in a shared table: 18 bytes, plus 2 to 3 bytes
+ * of BVH nodes since leaves hold up to kLeafSize spheres. Leaves are made of
+ * blocks of kBlockSize consecutive spheres, which are intersected together
+ * with vectorized code.
+ */
+class SphereCloud : public RawObject {
+public:
+	/// Number of spheres intersected together in a leaf.
+	static const unsigned int kBlockSize = 8;
+
+	/// Maximal number of spheres in a leaf of the BVH.
+	static const unsigned int kLeafSize = 4*kBlockSize;
+
+private:
+	std::vector<float> x_;      //!< First coordinates of the centers.
+	std::vector<float> y_;      //!< Second coordinates of the centers.
+	std::vector<float> z_;      //!< Third coordinates of the centers.
+	std::vector<float> radius_; //!< Radii of the spheres.
+
+	/// Index of the Material of each sphere in materials_.
+	std::vector<std::uint16_t> material_indices_;
+
+	std::vector<Material> materials_; //!< Materials shared by the spheres.
+
+	/// BVH whose leaves are blocks of consecutive spheres.
+	FlatBVH bvh_;
+
+	/**
+	 * \fn void Build(const std::vector<Point> &centers, const std::vector<double> &radii, const std::vector<std::uint16_t> &material_indices)
+	 * \brief Builds the BVH and stores the spheres in its order, padded to a
+	 *        multiple of kBlockSize with spheres that cannot be hit.
+	 */
+	void Build(
+		const std::vector<Point> &centers,
+		const std::vector<double> &radii,
+		const std::vector<std::uint16_t> &material_indices
+	);
+
+	/**
+	 * \fn bool IntersectSphere(unsigned int i, const Ray &r, double &t, bool &out) const
+	 * \brief Computes in double precision the Intersection between the i-th
+	 *        sphere and the input Ray.
+	 * \param t, out Output distance and side of the intersection, if any.
+	 */
+	bool IntersectSphere(
+		unsigned int i, const Ray &r, double &t, bool &out
+	) const;
+
+public:
+	/**
+	 * \fn SphereCloud(const std::vector<Point> &centers, const std::vector<double> &radii, const std::vector<Material> &materials, const std::vector<std::uint16_t> &material_indices)
+	 * \brief Builds a cloud of spheres.
+	 * \param centers, radii Centers and radii of the spheres.
+	 * \param materials Table of the materials of the cloud.
+	 * \param material_indices Index in materials of the Material of each
+	 *        sphere.
+	 */
+	SphereCloud(
+		const std::vector<Point> &centers,
+		const std::vector<double> &radii,
+		const std::vector<Material> &materials,
+		const std::vector<std::uint16_t> &material_indices
+	) :
+		RawObject{materials.at(0), false},
+		materials_{materials}
+	{
+		Build(centers, radii, material_indices);
+	}
+
+	/// Builds a cloud of spheres sharing the same Material.
+	SphereCloud(
+		const std::vector<Point> &centers,
+		const std::vector<double> &radii,
+		const Material &material=Material{}
+	) :
+		SphereCloud{
+			centers, radii, std::vector<Material>{material},
+			std::vector<std::uint16_t>(centers.size(), 0)
+		}
+	{
+	}
+
+	/// Outputs the number of spheres in the cloud, padding included.
+	inline size_t Size() const {
+		return radius_.size();
+	}
+
+	/// Outputs the memory used by the cloud, in bytes.
+	size_t MemoryUsage() const;
+
+	/**
+	 * \fn Intersection Intersect(const Ray &r) const
+	 * \brief Traverses the BVH of the cloud; the primitive identifier of the
+	 *        Intersection is the index of the hit sphere.
+	 */
+	Intersection Intersect(const Ray &r) const;
+
+	/// \warning Does not return the normal of the object. Normals to individual
+	///          spheres are computed by Interact.
+	Vector Normal(const Point &p) const;
+
+	AABB BoundingBox() const;
+
+	/// Computes the normal and Material of the hit sphere.
+	SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const;
+};
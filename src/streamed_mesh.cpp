@@ -0,0 +1,446 @@
+/**
+ * \file streamed_mesh.cpp
+ * \brief Implements meshes streamed from disk by clusters, and the cache of
+ *        resident clusters.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include "streamed_mesh.hpp"
+
+
+/**
+ * \struct LastCluster
+ * \brief Last cluster accessed by a thread, which spares a lookup in the
+ *        cache for coherent rays.
+ */
+struct LastCluster {
+	std::uint64_t key = static_cast<std::uint64_t>(-1); //!< Cluster key.
+	std::shared_ptr<const GeometryCluster> cluster;      //!< Cluster content.
+};
+
+
+/// Last cluster accessed by the current thread.
+static thread_local LastCluster last_cluster;
+
+
+/// Moves the position of the input file to the given offset.
+static bool Seek(std::FILE *file, std::uint64_t offset) {
+	#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+	#else
+	return fseeko(file, offset, SEEK_SET) == 0;
+	#endif
+}
+
+
+GeometryCluster::GeometryCluster(
+	std::vector<Triangle> &&triangles,
+	std::vector<const Material*> &&materials
+) :
+	triangles{std::move(triangles)},
+	materials{std::move(materials)}
+{
+	// Triangles, their references, and a leaf and an interior node per
+	// triangle
+	bytes = this->materials.size() * (
+		sizeof(Triangle) + sizeof(const Material*) + sizeof(PrimitiveReference)
+		+ 2*sizeof(BVH)
+	);
+}
+
+
+GeometryCache& GeometryCache::Instance() {
+	static GeometryCache cache;
+	return cache;
+}
+
+
+unsigned int GeometryCache::NewMeshId() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return next_id_++;
+}
+
+
+void GeometryCache::SetMemoryBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	memory_budget_ = bytes;
+	Evict();
+}
+
+
+std::shared_ptr<const GeometryCluster> GeometryCache::Find(std::uint64_t key) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = clusters_.find(key);
+	if (it == clusters_.end()) {
+		return nullptr;
+	}
+	hits_++;
+	lru_.splice(lru_.begin(), lru_, it->second.recent);
+	return it->second.cluster;
+}
+
+
+std::shared_ptr<const GeometryCluster> GeometryCache::Insert(
+	std::uint64_t key,
+	std::shared_ptr<const GeometryCluster> cluster
+) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = clusters_.find(key);
+	if (it != clusters_.end()) {
+		lru_.splice(lru_.begin(), lru_, it->second.recent);
+		return it->second.cluster;
+	}
+	misses_++;
+	lru_.push_front(key);
+	clusters_.insert({key, ClusterEntry{cluster, lru_.begin()}});
+	resident_bytes_ += cluster->bytes;
+	Evict();
+	return cluster;
+}
+
+
+void GeometryCache::Evict() {
+	while (resident_bytes_ > memory_budget_ && !lru_.empty()) {
+		auto it = clusters_.find(lru_.back());
+		resident_bytes_ -= it->second.cluster->bytes;
+		clusters_.erase(it);
+		lru_.pop_back();
+	}
+}
+
+
+void GeometryCache::Release(unsigned int mesh) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto it=lru_.begin(); it!=lru_.end();) {
+		if ((*it >> 32) == mesh) {
+			auto entry = clusters_.find(*it);
+			resident_bytes_ -= entry->second.cluster->bytes;
+			clusters_.erase(entry);
+			it = lru_.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+
+void GeometryCache::Clear() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	clusters_.clear();
+	lru_.clear();
+	hits_ = 0;
+	misses_ = 0;
+	resident_bytes_ = 0;
+}
+
+
+size_t GeometryCache::Hits() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return hits_;
+}
+
+
+size_t GeometryCache::Misses() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return misses_;
+}
+
+
+size_t GeometryCache::ResidentBytes() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return resident_bytes_;
+}
+
+
+size_t GeometryCache::MemoryBudget() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return memory_budget_;
+}
+
+
+StreamedMesh::StreamedMesh(
+	const std::string &filename,
+	const std::string &folder,
+	const Material &material,
+	const StreamingOptions &options
+) :
+	id_{GeometryCache::Instance().NewMeshId()},
+	cluster_size_{std::max(options.cluster_size, 1u)}
+{
+	ObjData data = LoadOBJ(filename, true, true);
+	surfaces_.reset(new ObjSurfaces{data.materials, folder, material});
+
+	// Computes the bounds of the triangles in parallel, marking the invalid
+	// ones
+	std::vector<Bounds> bounds(data.NbTriangles());
+	std::vector<char> is_valid(data.NbTriangles(), false);
+	#pragma omp parallel for schedule(dynamic, 4096)
+	for (size_t j=0; j<data.NbTriangles(); j++) {
+		ObjTriangle triangle;
+		if (data.ExtractTriangle(j, triangle)) {
+			for (int k=0; k<3; k++) {
+				const float *p = &triangle.positions[3*k];
+				bounds[j].Grow(Point{p[0], p[1], p[2]});
+			}
+			is_valid[j] = true;
+		}
+	}
+
+	// Removes the invalid triangles
+	std::vector<unsigned int> indices;
+	for (size_t j=0; j<bounds.size(); j++) {
+		if (is_valid[j]) {
+			bounds[indices.size()] = bounds[j];
+			indices.push_back(j);
+		}
+	}
+	bounds.resize(indices.size());
+	std::vector<char>().swap(is_valid);
+	nb_triangles_ = indices.size();
+
+	// Groups the triangles into clusters: leaves hold at most cluster_size_
+	// triangles and start at a multiple of it, so that the c-th cluster is
+	// made of the stored triangles [c*cluster_size_, (c+1)*cluster_size_)
+	std::vector<unsigned int> order =
+		clusters_.Build(bounds, cluster_size_, cluster_size_);
+	std::vector<Bounds>().swap(bounds);
+
+	// Writes the clusters one after the other
+	file_ = options.cache_filename.empty() ?
+		std::tmpfile() : std::fopen(options.cache_filename.c_str(), "w+b");
+	if (!file_) {
+		throw std::runtime_error("Cannot create the geometry cache file");
+	}
+	cluster_offsets_.push_back(0);
+	std::vector<ObjTriangle> records;
+	for (size_t first=0; first<nb_triangles_; first+=cluster_size_) {
+		size_t count = std::min<size_t>(cluster_size_, nb_triangles_ - first);
+		records.resize(count);
+		#pragma omp parallel for
+		for (size_t k=0; k<count; k++) {
+			data.ExtractTriangle(indices[order[first + k]], records[k]);
+		}
+		if (std::fwrite(records.data(), sizeof(ObjTriangle), count, file_)
+			!= count)
+		{
+			throw std::runtime_error("Cannot write the geometry cache file");
+		}
+		cluster_offsets_.push_back(
+			cluster_offsets_.back() + count*sizeof(ObjTriangle)
+		);
+	}
+	if (std::fflush(file_) != 0) {
+		throw std::runtime_error("Cannot write the geometry cache file");
+	}
+}
+
+
+StreamedMesh::~StreamedMesh() {
+	GeometryCache::Instance().Release(id_);
+	if (file_) {
+		std::fclose(file_);
+	}
+}
+
+
+std::shared_ptr<const GeometryCluster> StreamedMesh::LoadCluster(
+	size_t cluster
+) const {
+	std::uint64_t offset = cluster_offsets_[cluster];
+	size_t count = (cluster_offsets_[cluster+1] - offset) / sizeof(ObjTriangle);
+	std::vector<ObjTriangle> records(count);
+	{
+		std::lock_guard<std::mutex> lock(file_mutex_);
+		if (!Seek(file_, offset)
+			|| std::fread(records.data(), sizeof(ObjTriangle), count, file_)
+				!= count)
+		{
+			throw std::runtime_error("Cannot read the geometry cache file");
+		}
+	}
+
+	// Builds the triangles outside of the lock
+	std::vector<Triangle> triangles(count);
+	std::vector<const Material*> materials(count);
+	for (size_t k=0; k<count; k++) {
+		triangles[k] = surfaces_->MakeTriangle(records[k]);
+		materials[k] = &surfaces_->MaterialOf(records[k]);
+	}
+	return std::make_shared<const GeometryCluster>(
+		std::move(triangles), std::move(materials)
+	);
+}
+
+
+std::shared_ptr<const GeometryCluster> StreamedMesh::Resident(
+	size_t cluster
+) const {
+	std::uint64_t key = GeometryCache::Key(id_, cluster);
+	if (last_cluster.key == key) {
+		return last_cluster.cluster;
+	}
+	std::shared_ptr<const GeometryCluster> resident =
+		GeometryCache::Instance().Find(key);
+	if (resident) {
+		last_cluster = LastCluster{key, resident};
+	}
+	return resident;
+}
+
+
+std::shared_ptr<const GeometryCluster> StreamedMesh::Fetch(
+	size_t cluster
+) const {
+	std::shared_ptr<const GeometryCluster> resident = Resident(cluster);
+	if (resident) {
+		return resident;
+	}
+
+	// Concurrent misses may read the same cluster twice; the cache only
+	// keeps the first copy
+	std::uint64_t key = GeometryCache::Key(id_, cluster);
+	resident = GeometryCache::Instance().Insert(key, LoadCluster(cluster));
+	last_cluster = LastCluster{key, resident};
+	return resident;
+}
+
+
+void StreamedMesh::IntersectCluster(
+	const GeometryCluster &cluster, size_t index, const Ray &r,
+	Intersection &closest
+) const {
+	Intersection inter = cluster.triangles.Intersect(r);
+	if (inter < closest) {
+		closest = Intersection{
+			inter.Distance(), inter.IsOut(), inter.U(), inter.V(), surface_,
+			index*cluster_size_ + cluster.TriangleIndex(inter.Object())
+		};
+	}
+}
+
+
+Intersection StreamedMesh::Intersect(const Ray &r) const {
+	Intersection closest{empty_object_};
+	double t_max = std::numeric_limits<double>::infinity();
+	clusters_.Traverse(r, t_max,
+		[&](unsigned int first, unsigned int /*count*/) {
+			size_t index = first / cluster_size_;
+			IntersectCluster(*Fetch(index), index, r, closest);
+			if (!closest.IsEmpty()) {
+				t_max = closest.Distance();
+			}
+		}
+	);
+	return closest;
+}
+
+
+void StreamedMesh::IntersectBatch(
+	const std::vector<Ray> &rays,
+	std::vector<Intersection> &intersections
+) const {
+	intersections.assign(rays.size(), Intersection{empty_object_});
+
+	// Intersects the resident clusters, and records the rays reaching the
+	// other ones as (cluster, ray) pairs
+	std::vector<std::pair<size_t, size_t>> deferred;
+	#pragma omp parallel
+	{
+		std::vector<std::pair<size_t, size_t>> local_deferred;
+		#pragma omp for schedule(dynamic, 64)
+		for (size_t i=0; i<rays.size(); i++) {
+			Intersection &closest = intersections[i];
+			double t_max = std::numeric_limits<double>::infinity();
+			clusters_.Traverse(rays[i], t_max,
+				[&](unsigned int first, unsigned int /*count*/) {
+					size_t index = first / cluster_size_;
+					std::shared_ptr<const GeometryCluster> cluster =
+						Resident(index);
+					if (!cluster) {
+						local_deferred.emplace_back(index, i);
+						return;
+					}
+					IntersectCluster(*cluster, index, rays[i], closest);
+					if (!closest.IsEmpty()) {
+						t_max = closest.Distance();
+					}
+				}
+			);
+		}
+		#pragma omp critical
+		deferred.insert(
+			deferred.end(), local_deferred.begin(), local_deferred.end()
+		);
+	}
+
+	// Loads each missing cluster once, in the order of the file, and
+	// intersects all rays waiting for it. A ray appears at most once per
+	// cluster, so that the rays of a cluster can be processed in parallel.
+	std::sort(deferred.begin(), deferred.end());
+	for (size_t begin=0; begin<deferred.size();) {
+		size_t end = begin;
+		size_t index = deferred[begin].first;
+		while (end < deferred.size() && deferred[end].first == index) {
+			end++;
+		}
+		std::shared_ptr<const GeometryCluster> cluster = Fetch(index);
+		#pragma omp parallel for schedule(dynamic, 64)
+		for (size_t k=begin; k<end; k++) {
+			size_t i = deferred[k].second;
+			IntersectCluster(*cluster, index, rays[i], intersections[i]);
+		}
+		begin = end;
+	}
+}
+
+
+std::pair<std::shared_ptr<const GeometryCluster>, const Triangle*>
+	StreamedMesh::HitTriangle(size_t primitive) const
+{
+	size_t index = primitive / cluster_size_;
+	std::shared_ptr<const GeometryCluster> cluster = Fetch(index);
+	const Triangle *triangle =
+		&cluster->TriangleAt(primitive - index*cluster_size_);
+	return {cluster, triangle};
+}
+
+
+SurfaceInteraction StreamedMesh::Interact(
+	const Ray &r,
+	const Intersection &inter
+) const {
+	size_t index = inter.Primitive() / cluster_size_;
+	std::shared_ptr<const GeometryCluster> cluster = Fetch(index);
+	size_t k = inter.Primitive() - index*cluster_size_;
+	const Triangle &triangle = cluster->TriangleAt(k);
+	SurfaceInteraction local = triangle.Interact(
+		r,
+		Intersection{
+			inter.Distance(), inter.IsOut(), inter.U(), inter.V(), triangle
+		}
+	);
+
+	// The cluster may be evicted before the colors are computed: the colors
+	// are delegated to the Surface, and the Material belongs to the mesh
+	SurfaceInteraction s{
+		local.HitPoint(), local.Normal(), local.BarycentricCoordinates(),
+		*cluster->materials[k], surface_, inter.Primitive()
+	};
+	s.ComputeDifferentials(r, inter.Distance());
+	s.SetUVDifferentials(
+		local.DuDx(), local.DvDx(), local.DuDy(), local.DvDy()
+	);
+	return s;
+}
+
+
+AABB StreamedMesh::BoundingBox() const {
+	Bounds bounds = clusters_.RootBounds();
+	return AABB{
+		Point{bounds.min[0], bounds.min[1], bounds.min[2]},
+		Point{bounds.max[0], bounds.max[1], bounds.max[2]}
+	};
+}
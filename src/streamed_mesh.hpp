@@ -0,0 +1,349 @@
+/**
+ * \file streamed_mesh.hpp
+ * \brief Defines meshes whose triangles are streamed from disk by clusters,
+ *        and the process-wide cache of resident clusters.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "mesh.hpp"
+
+
+/**
+ * \struct GeometryCluster
+ * \brief Resident cluster of a StreamedMesh: a BVH over its triangles, in the
+ *        order in which they are stored on disk.
+ */
+struct GeometryCluster {
+	BVH triangles; //!< BVH over the triangles of the cluster.
+
+	/// Material of each triangle, owned by the StreamedMesh.
+	std::vector<const Material*> materials;
+
+	size_t bytes; //!< Estimated memory used by the cluster.
+
+	/// Builds the BVH of the input triangles.
+	GeometryCluster(
+		std::vector<Triangle> &&triangles,
+		std::vector<const Material*> &&materials
+	);
+
+	/// Outputs the index of the input triangle of the cluster, as returned by
+	/// the Intersect method of triangles.
+	inline size_t TriangleIndex(const RawObject &triangle) const {
+		return static_cast<const Triangle*>(&triangle)
+			- &triangles.Primitives().Triangles()[0];
+	}
+
+	/// Outputs the i-th triangle of the cluster.
+	inline const Triangle& TriangleAt(size_t i) const {
+		return triangles.Primitives().Triangles()[i];
+	}
+};
+
+
+/**
+ * \class GeometryCache
+ * \brief Cache of the clusters of all StreamedMesh objects under a bounded
+ *        memory budget.
+ *
+ * Clusters are keyed by the identifier of their mesh and their index. The
+ * least recently used ones are evicted when the memory used by resident
+ * clusters exceeds the budget; clusters still referenced by some thread stay
+ * alive until they are released.
+ */
+class GeometryCache {
+private:
+	/**
+	 * \struct ClusterEntry
+	 * \brief Resident cluster and its position in the LRU list.
+	 */
+	struct ClusterEntry {
+		std::shared_ptr<const GeometryCluster> cluster; //!< The cluster.
+		std::list<std::uint64_t>::iterator recent;      //!< Position in lru_.
+	};
+
+	mutable std::mutex mutex_; //!< Protects all members below.
+
+	/// Resident clusters, indexed by mesh identifier and cluster index.
+	std::unordered_map<std::uint64_t, ClusterEntry> clusters_;
+
+	/// Keys of the resident clusters, most recently used first.
+	std::list<std::uint64_t> lru_;
+
+	unsigned int next_id_ = 0; //!< Identifier of the next StreamedMesh.
+
+	size_t memory_budget_ = size_t(512) << 20; //!< Maximal resident bytes.
+
+	size_t hits_ = 0;           //!< Number of requests already resident.
+	size_t misses_ = 0;         //!< Number of clusters read from disk.
+	size_t resident_bytes_ = 0; //!< Estimated size of the resident clusters.
+
+	/// Private constructor: the only instance is given by Instance.
+	GeometryCache() {};
+
+	/// Evicts the least recently used clusters until the resident clusters
+	/// fit in the memory budget. Must be called with mutex_ locked.
+	void Evict();
+
+public:
+	GeometryCache(const GeometryCache&) = delete;
+	GeometryCache& operator=(const GeometryCache&) = delete;
+
+	/// Outputs the cache shared by the whole process.
+	static GeometryCache& Instance();
+
+	/// Outputs the key of a cluster of a mesh.
+	static inline std::uint64_t Key(unsigned int mesh, size_t cluster) {
+		return (static_cast<std::uint64_t>(mesh) << 32) | cluster;
+	}
+
+	/// Outputs a new identifier for a StreamedMesh.
+	unsigned int NewMeshId();
+
+	/// Sets the maximal number of bytes of resident clusters, evicting
+	/// clusters if needed.
+	void SetMemoryBudget(size_t bytes);
+
+	/**
+	 * \fn std::shared_ptr<const GeometryCluster> Find(std::uint64_t key)
+	 * \brief Outputs the resident cluster of the input key, or a null pointer
+	 *        if it is not resident. Thread-safe.
+	 */
+	std::shared_ptr<const GeometryCluster> Find(std::uint64_t key);
+
+	/**
+	 * \fn std::shared_ptr<const GeometryCluster> Insert(std::uint64_t key, std::shared_ptr<const GeometryCluster> cluster)
+	 * \brief Makes the input cluster resident, evicting other clusters if
+	 *        needed, and outputs the resident cluster of the key.
+	 *
+	 * Thread-safe. If another thread inserted the same cluster meanwhile, its
+	 * cluster is kept and returned.
+	 */
+	std::shared_ptr<const GeometryCluster> Insert(
+		std::uint64_t key,
+		std::shared_ptr<const GeometryCluster> cluster
+	);
+
+	/// Evicts all clusters of the input mesh.
+	void Release(unsigned int mesh);
+
+	/// Evicts all clusters and resets the statistics.
+	void Clear();
+
+	/// Outputs the number of cluster requests served from memory.
+	size_t Hits() const;
+
+	/// Outputs the number of clusters read from disk.
+	size_t Misses() const;
+
+	/// Outputs the estimated size in bytes of the resident clusters.
+	size_t ResidentBytes() const;
+
+	/// Outputs the maximal number of bytes of resident clusters.
+	size_t MemoryBudget() const;
+};
+
+
+/**
+ * \struct StreamingOptions
+ * \brief Options controlling how a StreamedMesh is stored.
+ */
+struct StreamingOptions {
+	/// Maximal number of triangles of a cluster.
+	unsigned int cluster_size = 4096;
+
+	/// Path of the file storing the clusters. By default, an anonymous
+	/// temporary file is used.
+	std::string cache_filename;
+};
+
+
+/**
+ * \class StreamedMesh
+ * \brief Out-of-core mesh, whose triangles are kept on disk by clusters and
+ *        loaded on demand when a Ray reaches them.
+ *
+ * At construction, the triangles of the file are grouped into spatially
+ * coherent clusters (the leaves of a FlatBVH), which are written one after
+ * the other to a cache file; only this top-level tree, the materials and the
+ * offsets of the clusters stay in memory. Clusters are then read back when
+ * traversal reaches them, turned into a BVH of triangles, and kept in the
+ * GeometryCache under its memory budget.
+ *
+ * A StreamedMesh is an ObjectContainer, which is rendered by giving a shared
+ * pointer to it to a Scene. Intersect loads the clusters reached by a single
+ * Ray, as the iterative integrator and shadow rays do. IntersectBatch, used
+ * by the wavefront integrator (see Integrator::kWavefront), first intersects
+ * all rays of a batch with the resident clusters only, and defers the other
+ * ones, then loads each missing cluster once and intersects all rays waiting
+ * for it. This amortizes the reads over the whole batch, in the order of the
+ * file.
+ *
+ * Intersections refer to a proxy object, which fetches the hit triangle again
+ * when shading, so that they stay valid after their cluster is evicted.
+ */
+class StreamedMesh : public ObjectContainer {
+private:
+	/**
+	 * \class Surface
+	 * \brief Object referenced by the Intersections of the StreamedMesh, whose
+	 *        primitive identifiers are the indices of the stored triangles.
+	 */
+	class Surface final : public RawObject {
+	private:
+		const StreamedMesh &mesh_; //!< Mesh of the surface.
+
+	public:
+		/// Constructs the surface of the input mesh.
+		Surface(const StreamedMesh &mesh) :
+			RawObject{Material{}, true},
+			mesh_{mesh}
+		{
+		}
+
+		inline Intersection Intersect(const Ray &r) const {
+			return mesh_.Intersect(r);
+		}
+
+		/// \warning Does not return the normal of the object. Normals to
+		///          individual triangles should be used instead.
+		inline Vector Normal(const Point &p) const {
+			return Vector{0, 0, 1};
+		}
+
+		inline AABB BoundingBox() const {
+			return mesh_.BoundingBox();
+		}
+
+		inline SurfaceInteraction Interact(
+			const Ray &r,
+			const Intersection &inter
+		) const {
+			return mesh_.Interact(r, inter);
+		}
+
+		inline Vector DiffuseColor(const SurfaceInteraction &s) const {
+			return mesh_.HitTriangle(s.Primitive()).second->DiffuseColor(s);
+		}
+
+		inline Vector SpecularColor(const SurfaceInteraction &s) const {
+			return mesh_.HitTriangle(s.Primitive()).second->SpecularColor(s);
+		}
+	};
+
+	unsigned int id_;           //!< Identifier in the GeometryCache.
+	unsigned int cluster_size_; //!< Maximal number of triangles per cluster.
+	size_t nb_triangles_ = 0;   //!< Number of stored triangles.
+
+	/// Materials and textures of the triangles.
+	std::unique_ptr<const ObjSurfaces> surfaces_;
+
+	FlatBVH clusters_; //!< Tree whose leaves are the clusters.
+
+	/// Position of each cluster in the file, followed by the size of the file.
+	std::vector<std::uint64_t> cluster_offsets_;
+
+	mutable std::mutex file_mutex_; //!< Protects the accesses to file_.
+	std::FILE *file_ = nullptr;     //!< File storing the clusters.
+
+	Surface surface_{*this}; //!< Object referenced by the Intersections.
+
+	/**
+	 * \fn std::shared_ptr<const GeometryCluster> LoadCluster(size_t cluster) const
+	 * \brief Reads a cluster from the file and builds its BVH.
+	 * \throw std::runtime_error If the file cannot be read.
+	 */
+	std::shared_ptr<const GeometryCluster> LoadCluster(size_t cluster) const;
+
+	/// Outputs the input cluster if it is resident, or a null pointer.
+	std::shared_ptr<const GeometryCluster> Resident(size_t cluster) const;
+
+	/// Outputs the input cluster, loading it if it is not resident.
+	std::shared_ptr<const GeometryCluster> Fetch(size_t cluster) const;
+
+	/**
+	 * \fn void IntersectCluster(const GeometryCluster &cluster, size_t index, const Ray &r, Intersection &closest) const
+	 * \brief Replaces closest by the Intersection between the input Ray and
+	 *        the index-th cluster, if it is closer.
+	 */
+	void IntersectCluster(
+		const GeometryCluster &cluster, size_t index, const Ray &r,
+		Intersection &closest
+	) const;
+
+	/**
+	 * \fn std::pair<std::shared_ptr<const GeometryCluster>, const Triangle*> HitTriangle(size_t primitive) const
+	 * \brief Outputs the stored triangle of the input index, with its cluster
+	 *        which keeps it alive.
+	 */
+	std::pair<std::shared_ptr<const GeometryCluster>, const Triangle*>
+		HitTriangle(size_t primitive) const;
+
+	/// Computes the shading data of an Intersection of the StreamedMesh.
+	SurfaceInteraction Interact(const Ray &r, const Intersection &inter) const;
+
+public:
+	/**
+	 * \fn StreamedMesh(const std::string &filename, const std::string &folder, const Material &material=Material{}, const StreamingOptions &options=StreamingOptions{})
+	 * \brief Imports an .obj file and writes its triangles to disk by
+	 *        clusters.
+	 * \param filename Path to the .obj file.
+	 * \param folder Folder of the texture files (with separator at the end).
+	 * \param material Default material of the object, used when some parameter
+	 *        is missing in the input file.
+	 * \param options Storage options.
+	 * \throw std::runtime_error If the file cannot be read or the cache file
+	 *        cannot be written.
+	 *
+	 * The file is read with the native loader (see LoadOBJ), and produces the
+	 * same triangles as Mesh. Only the compact parsed arrays are held in
+	 * memory during the construction, never all triangles at once.
+	 */
+	StreamedMesh(
+		const std::string &filename,
+		const std::string &folder,
+		const Material &material=Material{},
+		const StreamingOptions &options=StreamingOptions{}
+	);
+
+	/// Releases the clusters of the mesh and closes its file.
+	~StreamedMesh();
+
+	StreamedMesh(const StreamedMesh&) = delete;
+	StreamedMesh& operator=(const StreamedMesh&) = delete;
+
+	/// Outputs the number of triangles of the mesh.
+	inline size_t NbTriangles() const {
+		return nb_triangles_;
+	}
+
+	/// Outputs the number of clusters of the mesh.
+	inline size_t NbClusters() const {
+		return cluster_offsets_.size() - 1;
+	}
+
+	Intersection Intersect(const Ray &r) const;
+
+	/**
+	 * \fn void IntersectBatch(const std::vector<Ray> &rays, std::vector<Intersection> &intersections) const
+	 * \brief Computes the closest Intersection of each Ray of a batch,
+	 *        deferring the rays reaching non-resident clusters so that each
+	 *        missing cluster is read once for the whole batch.
+	 */
+	void IntersectBatch(
+		const std::vector<Ray> &rays,
+		std::vector<Intersection> &intersections
+	) const;
+
+	/// Outputs the bounding box of the mesh.
+	AABB BoundingBox() const;
+};
@@ -0,0 +1,528 @@
+/**
+ * \file texture_cache.cpp
+ * \brief Implements tiled mip-mapped textures and the process-wide cache
+ *        paging their tiles.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <climits>
+#include <stdexcept>
+#include "texture_cache.hpp"
+
+
+/**
+ * \struct ThreadTiles
+ * \brief Tiles last accessed by a thread, which spare a lookup in the cache,
+ *        and thus its lock, for coherent accesses.
+ *
+ * The entries are enough for the tiles touched by a shading point: bilinear
+ * taps crossing tile borders, two levels for trilinear filtering, and several
+ * textures per material. The oldest entry is replaced on a miss. Remembered
+ * tiles stay alive after the cache evicts them, which adds at most kSize
+ * tiles per thread to the memory budget.
+ */
+struct ThreadTiles {
+	/// Number of tiles remembered by each thread.
+	static const unsigned int kSize = 16;
+
+	/**
+	 * \struct Entry
+	 * \brief Tile remembered by the thread.
+	 */
+	struct Entry {
+		unsigned int texture = static_cast<unsigned int>(-1); //!< Texture id.
+		size_t tile = 0;                                      //!< Tile index.
+		std::shared_ptr<const TextureCache::Tile> pixels;     //!< Tile content.
+	};
+
+	Entry entries[kSize];  //!< Remembered tiles.
+	unsigned int last = 0; //!< Entry of the last access.
+	unsigned int next = 0; //!< Entry replaced by the next miss.
+};
+
+
+/**
+ * \fn static const float* ToLinearTable(bool srgb)
+ * \brief Outputs the table converting a stored byte to a linear value in
+ *        [0,1], decoding the sRGB transfer function if srgb is set.
+ */
+static const float* ToLinearTable(bool srgb) {
+	struct Tables {
+		float linear[256]; //!< Bytes scaled to [0,1].
+		float srgb[256];   //!< Decoded sRGB bytes.
+
+		Tables() {
+			for (int i=0; i<256; i++) {
+				float c = i / 255.f;
+				linear[i] = c;
+				srgb[i] = c <= 0.04045f ? c / 12.92f
+					: std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+	static const Tables tables;
+	return srgb ? tables.srgb : tables.linear;
+}
+
+
+/// Moves the position of the input file to the given offset.
+static bool Seek(std::FILE *file, std::uint64_t offset) {
+	#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+	#else
+	return fseeko(file, offset, SEEK_SET) == 0;
+	#endif
+}
+
+
+/// Outputs the byte whose value in the input table, sorted increasingly, is
+/// the nearest to c.
+static unsigned char FromLinear(const float *to_linear, float c) {
+	const float *it = std::lower_bound(to_linear, to_linear + 256, c);
+	if (it == to_linear + 256) {
+		return 255;
+	}
+	if (it != to_linear && c - it[-1] < *it - c) {
+		--it;
+	}
+	return static_cast<unsigned char>(it - to_linear);
+}
+
+
+/**
+ * \fn static std::vector<std::vector<std::pair<unsigned int, float>>> BoxWeights(unsigned int size, unsigned int coarser_size)
+ * \brief Outputs, for each texel of a coarser level along one axis, the
+ *        texels of the finer level it covers, with weights proportional to
+ *        the covered lengths and summing to 1.
+ *
+ * When the finer size is odd, a coarser texel covers more than two texels,
+ * so that no row or column of the finer level is dropped.
+ */
+static std::vector<std::vector<std::pair<unsigned int, float>>> BoxWeights(
+	unsigned int size, unsigned int coarser_size
+) {
+	std::vector<std::vector<std::pair<unsigned int, float>>> weights(
+		coarser_size
+	);
+	double scale = static_cast<double>(size) / coarser_size;
+	for (unsigned int x=0; x<coarser_size; x++) {
+		double first = x*scale;
+		double last = (x+1)*scale;
+		for (unsigned int i=static_cast<unsigned int>(first);
+			i<size && i<last; i++)
+		{
+			double covered = std::min(last, i+1.) - std::max(first, double(i));
+			if (covered > 0) {
+				weights[x].push_back({i, static_cast<float>(covered/scale)});
+			}
+		}
+	}
+	return weights;
+}
+
+
+Texture::Texture(
+	unsigned int id, std::uint64_t file_offset,
+	unsigned int width, unsigned int height, bool srgb
+) :
+	id_{id},
+	file_offset_{file_offset},
+	nb_tiles_{0},
+	to_linear_{ToLinearTable(srgb)}
+{
+	while (true) {
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.tiles_x = (width + kTileSize - 1) / kTileSize;
+		level.tiles_y = (height + kTileSize - 1) / kTileSize;
+		level.first_tile = nb_tiles_;
+		levels_.push_back(level);
+		nb_tiles_ += level.tiles_x * level.tiles_y;
+		if (width == 1 && height == 1) {
+			break;
+		}
+		width = std::max(1u, width/2);
+		height = std::max(1u, height/2);
+	}
+}
+
+
+void Texture::Fetch(const Level &l, int x, int y, float *color) const {
+	x %= static_cast<int>(l.width);
+	y %= static_cast<int>(l.height);
+	if (x < 0) {
+		x += l.width;
+	}
+	if (y < 0) {
+		y += l.height;
+	}
+	size_t tile = l.first_tile + (y/kTileSize)*l.tiles_x + x/kTileSize;
+
+	// Looks for the tile among the ones of the thread, the last one first
+	static thread_local ThreadTiles tiles;
+	const ThreadTiles::Entry *entry = &tiles.entries[tiles.last];
+	if (entry->texture != id_ || entry->tile != tile) {
+		unsigned int k = 0;
+		while (k < ThreadTiles::kSize && (tiles.entries[k].texture != id_
+			|| tiles.entries[k].tile != tile))
+		{
+			k++;
+		}
+		if (k == ThreadTiles::kSize) {
+			k = tiles.next;
+			tiles.next = (tiles.next + 1) % ThreadTiles::kSize;
+			ThreadTiles::Entry &replaced = tiles.entries[k];
+			replaced.pixels = TextureCache::Instance().FetchTile(*this, tile);
+			replaced.texture = id_;
+			replaced.tile = tile;
+		}
+		tiles.last = k;
+		entry = &tiles.entries[k];
+	}
+	const unsigned char *texel = entry->pixels->data()
+		+ 3*((y % kTileSize)*kTileSize + x % kTileSize);
+	for (int c=0; c<3; c++) {
+		color[c] = to_linear_[texel[c]];
+	}
+}
+
+
+Vector Texture::Texel(unsigned int level, int x, int y) const {
+	float color[3];
+	Fetch(levels_[std::min(level, NbLevels()-1)], x, y, color);
+	return Vector{color[0], color[1], color[2]};
+}
+
+
+Vector Texture::Lookup(double u, double v, unsigned int level) const {
+	const Level &l = levels_[std::min(level, NbLevels()-1)];
+	float color[3];
+	Fetch(
+		l,
+		static_cast<int>(std::floor(u*l.width)),
+		static_cast<int>(std::floor(v*l.height)),
+		color
+	);
+	return Vector{color[0], color[1], color[2]};
+}
+
+
+Vector Texture::Bilinear(double u, double v, unsigned int level) const {
+	const Level &l = levels_[std::min(level, NbLevels()-1)];
+
+	// Texel centers are at half-integer coordinates
+	double x = u*l.width - 0.5;
+	double y = v*l.height - 0.5;
+	int x0 = static_cast<int>(std::floor(x));
+	int y0 = static_cast<int>(std::floor(y));
+	float tx = x - x0;
+	float ty = y - y0;
+
+	// Fetches the four texels, then blends them channel by channel
+	float texels[4][3];
+	Fetch(l, x0, y0, texels[0]);
+	Fetch(l, x0+1, y0, texels[1]);
+	Fetch(l, x0, y0+1, texels[2]);
+	Fetch(l, x0+1, y0+1, texels[3]);
+	const float weights[4] = {
+		(1-tx)*(1-ty), tx*(1-ty), (1-tx)*ty, tx*ty
+	};
+	float color[3] = {0, 0, 0};
+	for (int k=0; k<4; k++) {
+		#pragma omp simd
+		for (int c=0; c<3; c++) {
+			color[c] += weights[k] * texels[k][c];
+		}
+	}
+	return Vector{color[0], color[1], color[2]};
+}
+
+
+Vector Texture::Trilinear(double u, double v, double level) const {
+	level = std::min(std::max(level, 0.), NbLevels() - 1.);
+	unsigned int fine = static_cast<unsigned int>(level);
+	double t = level - fine;
+	if (t == 0) {
+		return Bilinear(u, v, fine);
+	}
+	return (1-t)*Bilinear(u, v, fine) + t*Bilinear(u, v, fine+1);
+}
+
+
+double Texture::LevelOfDetail(
+	double du_dx, double dv_dx, double du_dy, double dv_dy
+) const {
+	// Length in texels of the longest axis of the footprint
+	const Level &finest = levels_[0];
+	double width = std::max(
+		std::hypot(du_dx*finest.width, dv_dx*finest.height),
+		std::hypot(du_dy*finest.width, dv_dy*finest.height)
+	);
+	return width > 1 ? std::log2(width) : 0;
+}
+
+
+TextureCache& TextureCache::Instance() {
+	static TextureCache cache;
+	return cache;
+}
+
+
+TextureCache::~TextureCache() {
+	if (cache_file_) {
+		std::fclose(cache_file_);
+	}
+}
+
+
+std::string TextureCache::CanonicalPath(const std::string &path) {
+	#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if (_fullpath(buffer, path.c_str(), _MAX_PATH)) {
+		return std::string(buffer);
+	}
+	#else
+	char buffer[PATH_MAX];
+	if (realpath(path.c_str(), buffer)) {
+		return std::string(buffer);
+	}
+	#endif
+	return path;
+}
+
+
+void TextureCache::SetCacheFile(const std::string &filename) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (cache_file_) {
+		throw std::runtime_error("The texture cache file is already in use");
+	}
+	cache_filename_ = filename;
+}
+
+
+void TextureCache::SetMemoryBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	memory_budget_ = bytes;
+	Evict();
+}
+
+
+void TextureCache::OpenCacheFile() {
+	if (cache_file_) {
+		return;
+	}
+	if (cache_filename_.empty()) {
+		cache_file_ = std::tmpfile();
+	} else {
+		cache_file_ = std::fopen(cache_filename_.c_str(), "w+b");
+	}
+	if (!cache_file_) {
+		throw std::runtime_error("Cannot create the texture cache file");
+	}
+}
+
+
+void TextureCache::WriteTiles(const Texture &texture, const Image &image) {
+	// Converts the image to linear RGB (grayscale images are replicated), so
+	// that the pyramid is filtered in linear space
+	unsigned int width = texture.levels_[0].width;
+	unsigned int height = texture.levels_[0].height;
+	std::vector<float> level(3*static_cast<size_t>(width)*height);
+	cimg_forXYC(image, x, y, c) {
+		if (c < 3) {
+			level[3*(static_cast<size_t>(y)*width + x) + c] =
+				texture.to_linear_[image(x, y, 0, c)];
+		}
+	}
+	if (image.spectrum() < 3) {
+		for (size_t i=0; i<level.size(); i+=3) {
+			level[i+1] = level[i];
+			level[i+2] = level[i];
+		}
+	}
+
+	if (!Seek(cache_file_, texture.file_offset_)) {
+		throw std::runtime_error("Cannot write the texture cache file");
+	}
+	Tile tile(Texture::kTileBytes);
+	for (unsigned int l=0; l<texture.NbLevels(); l++) {
+		const Texture::Level &current = texture.levels_[l];
+
+		// Writes the tiles of the level, row by row, padding the tiles at the
+		// border with the last texels, and encodes the texels back to bytes
+		for (unsigned int ty=0; ty<current.tiles_y; ty++) {
+			for (unsigned int tx=0; tx<current.tiles_x; tx++) {
+				for (unsigned int y=0; y<Texture::kTileSize; y++) {
+					size_t py = std::min(
+						ty*Texture::kTileSize + y, current.height-1
+					);
+					for (unsigned int x=0; x<Texture::kTileSize; x++) {
+						size_t px = std::min(
+							tx*Texture::kTileSize + x, current.width-1
+						);
+						for (int c=0; c<3; c++) {
+							tile[3*(y*Texture::kTileSize + x) + c] = FromLinear(
+								texture.to_linear_,
+								level[3*(py*current.width + px) + c]
+							);
+						}
+					}
+				}
+				if (std::fwrite(tile.data(), 1, tile.size(), cache_file_)
+					!= tile.size())
+				{
+					throw std::runtime_error(
+						"Cannot write the texture cache file"
+					);
+				}
+			}
+		}
+
+		// Computes the next level with a box filter, separable
+		if (l+1 < texture.NbLevels()) {
+			const Texture::Level &next = texture.levels_[l+1];
+			auto weights_x = BoxWeights(current.width, next.width);
+			auto weights_y = BoxWeights(current.height, next.height);
+			std::vector<float> coarser(
+				3*static_cast<size_t>(next.width)*next.height, 0.f
+			);
+			for (unsigned int y=0; y<next.height; y++) {
+				for (const auto &wy : weights_y[y]) {
+					for (unsigned int x=0; x<next.width; x++) {
+						float *color =
+							&coarser[3*(static_cast<size_t>(y)*next.width + x)];
+						for (const auto &wx : weights_x[x]) {
+							const float *texel = &level[3*(
+								static_cast<size_t>(wy.first)*current.width
+								+ wx.first
+							)];
+							for (int c=0; c<3; c++) {
+								color[c] += wy.second*wx.second*texel[c];
+							}
+						}
+					}
+				}
+			}
+			level.swap(coarser);
+		}
+	}
+}
+
+
+std::shared_ptr<const Texture> TextureCache::Load(
+	const std::string &path,
+	bool srgb
+) {
+	std::string key = CanonicalPath(path);
+	std::string entry = srgb ? key + "|srgb" : key;
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = textures_.find(entry);
+	if (it != textures_.end()) {
+		hits_++;
+		return it->second;
+	}
+
+	// Decodes the file while holding the lock, so that it is decoded once,
+	// then only keeps its tiles in the cache file
+	OpenCacheFile();
+	Image image(key.c_str());
+	std::shared_ptr<Texture> texture = std::make_shared<Texture>(
+		next_id_++, cache_size_, image.width(), image.height(), srgb
+	);
+	WriteTiles(*texture, image);
+	cache_size_ += texture->NbTiles() * Texture::kTileBytes;
+	textures_.insert({entry, texture});
+	misses_++;
+	return texture;
+}
+
+
+std::shared_ptr<const TextureCache::Tile> TextureCache::FetchTile(
+	const Texture &texture,
+	size_t tile
+) {
+	std::uint64_t key = (static_cast<std::uint64_t>(texture.id_) << 40) | tile;
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = tiles_.find(key);
+	if (it != tiles_.end()) {
+		tile_hits_++;
+		lru_.splice(lru_.begin(), lru_, it->second.recent);
+		return it->second.tile;
+	}
+
+	// Pages the tile in from the cache file
+	std::shared_ptr<Tile> pixels = std::make_shared<Tile>(Texture::kTileBytes);
+	if (!Seek(cache_file_, texture.file_offset_ + tile*Texture::kTileBytes)
+		|| std::fread(pixels->data(), 1, pixels->size(), cache_file_)
+			!= pixels->size())
+	{
+		throw std::runtime_error("Cannot read the texture cache file");
+	}
+	tile_misses_++;
+	lru_.push_front(key);
+	tiles_.insert({key, TileEntry{pixels, lru_.begin()}});
+	resident_bytes_ += Texture::kTileBytes;
+	Evict();
+	return pixels;
+}
+
+
+void TextureCache::Evict() {
+	while (resident_bytes_ > memory_budget_ && !lru_.empty()) {
+		tiles_.erase(lru_.back());
+		lru_.pop_back();
+		resident_bytes_ -= Texture::kTileBytes;
+	}
+}
+
+
+void TextureCache::Clear() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	textures_.clear();
+	tiles_.clear();
+	lru_.clear();
+	hits_ = 0;
+	misses_ = 0;
+	tile_hits_ = 0;
+	tile_misses_ = 0;
+	resident_bytes_ = 0;
+}
+
+
+size_t TextureCache::Hits() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return hits_;
+}
+
+
+size_t TextureCache::Misses() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return misses_;
+}
+
+
+size_t TextureCache::TileHits() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return tile_hits_;
+}
+
+
+size_t TextureCache::TileMisses() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return tile_misses_;
+}
+
+
+size_t TextureCache::ResidentBytes() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return resident_bytes_;
+}
+
+
+size_t TextureCache::MemoryBudget() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return memory_budget_;
+}
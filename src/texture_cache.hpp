@@ -0,0 +1,290 @@
+/**
+ * \file texture_cache.hpp
+ * \brief Defines tiled mip-mapped textures and the process-wide cache paging
+ *        their tiles.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CImg.h"
+#include "utils.hpp"
+
+
+/**
+ * \class Texture
+ * \brief RGB texture stored as a mip pyramid of square tiles, which are paged
+ *        in on demand by the TextureCache.
+ *
+ * A Texture only holds the layout of its pyramid; its pixels live in the
+ * cache file of the TextureCache and are read tile by tile when accessed.
+ * Tiles store the channels of each texel together, so that an RGB fetch
+ * touches a single cache line. Level 0 is the full-resolution image, and each
+ * following level halves its dimensions (rounded down) down to 1x1. Levels are
+ * computed with a box filter on linear values, weighting the texels by their
+ * coverage, so that the last row or column of an odd level is kept.
+ *
+ * Texels are converted to linear values in [0,1] with a precomputed table,
+ * which decodes the sRGB transfer function for color textures.
+ */
+class Texture {
+public:
+	/// Width and height of the tiles, in texels.
+	static const unsigned int kTileSize = 64;
+
+	/// Size of a tile in bytes (RGB, one byte per channel).
+	static const size_t kTileBytes = kTileSize * kTileSize * 3;
+
+	/**
+	 * \struct Level
+	 * \brief Dimensions of a level of the pyramid and position of its tiles.
+	 */
+	struct Level {
+		unsigned int width;   //!< Width of the level, in texels.
+		unsigned int height;  //!< Height of the level, in texels.
+		unsigned int tiles_x; //!< Number of tiles along the width.
+		unsigned int tiles_y; //!< Number of tiles along the height.
+		size_t first_tile;    //!< Index of the first tile of the level.
+	};
+
+private:
+	unsigned int id_;           //!< Identifier of the Texture in the cache.
+	std::uint64_t file_offset_; //!< Position of the first tile in the file.
+	std::vector<Level> levels_; //!< Levels of the pyramid, finest first.
+	size_t nb_tiles_;           //!< Number of tiles of all levels.
+
+	/// Table converting the stored bytes to linear values.
+	const float *to_linear_;
+
+	/**
+	 * \fn void Fetch(const Level &level, int x, int y, float *color) const
+	 * \brief Writes in color the linear RGB values of a texel of the input
+	 *        level. Coordinates outside the level wrap around.
+	 */
+	void Fetch(const Level &level, int x, int y, float *color) const;
+
+	friend class TextureCache;
+
+public:
+	/**
+	 * \fn Texture(unsigned int id, std::uint64_t file_offset, unsigned int width, unsigned int height, bool srgb)
+	 * \brief Computes the layout of the pyramid of an image of the given
+	 *        size, whose tiles are stored from file_offset in the cache file.
+	 * \param srgb Indicates if the stored values are sRGB-encoded.
+	 */
+	Texture(
+		unsigned int id, std::uint64_t file_offset,
+		unsigned int width, unsigned int height, bool srgb
+	);
+
+	/// Outputs the number of levels of the pyramid.
+	inline unsigned int NbLevels() const {
+		return levels_.size();
+	}
+
+	/// Outputs the given level of the pyramid.
+	inline const Level& LevelAt(unsigned int level) const {
+		return levels_[level];
+	}
+
+	/// Outputs the number of tiles of all levels.
+	inline size_t NbTiles() const {
+		return nb_tiles_;
+	}
+
+	/**
+	 * \fn Vector Texel(unsigned int level, int x, int y) const
+	 * \brief Outputs the linear color of a texel of the input level.
+	 *        Coordinates outside the level wrap around.
+	 */
+	Vector Texel(unsigned int level, int x, int y) const;
+
+	/**
+	 * \fn Vector Lookup(double u, double v, unsigned int level=0) const
+	 * \brief Outputs the color of the texel nearest to UV coordinates (u, v)
+	 *        in the input level (u along the width, v along the height).
+	 */
+	Vector Lookup(double u, double v, unsigned int level=0) const;
+
+	/**
+	 * \fn Vector Bilinear(double u, double v, unsigned int level=0) const
+	 * \brief Outputs the color at UV coordinates (u, v) in the input level,
+	 *        interpolated between the four nearest texels.
+	 */
+	Vector Bilinear(double u, double v, unsigned int level=0) const;
+
+	/**
+	 * \fn Vector Trilinear(double u, double v, double level) const
+	 * \brief Outputs the color at UV coordinates (u, v), interpolated
+	 *        bilinearly in the two levels nearest to the input fractional
+	 *        level, then between them.
+	 */
+	Vector Trilinear(double u, double v, double level) const;
+
+	/**
+	 * \fn double LevelOfDetail(double du_dx, double dv_dx, double du_dy, double dv_dy) const
+	 * \brief Outputs the fractional mip level whose texels match a footprint
+	 *        given by the derivatives of the UV coordinates along the image
+	 *        axes.
+	 */
+	double LevelOfDetail(
+		double du_dx, double dv_dx, double du_dy, double dv_dy
+	) const;
+};
+
+
+/**
+ * \class TextureCache
+ * \brief Registry of the textures loaded from disk, shared by all meshes, and
+ *        cache of their tiles under a bounded memory budget.
+ *
+ * Textures are keyed by the canonical path of their file, so that a file is
+ * decoded once even when it is referenced through different relative paths.
+ * When a texture is loaded, its mip pyramid is built and written tile by tile
+ * to a local cache file, and the decoded image is released. Tiles are then
+ * read back on demand, and the least recently used ones are evicted when the
+ * memory used by resident tiles exceeds the budget.
+ */
+class TextureCache {
+public:
+	/// Type of the decoded images.
+	typedef cimg_library::CImg<unsigned char> Image;
+
+	/// Pixels of a tile (kTileSize rows of kTileSize RGB texels).
+	typedef std::vector<unsigned char> Tile;
+
+private:
+	/**
+	 * \struct TileEntry
+	 * \brief Resident tile and its position in the LRU list.
+	 */
+	struct TileEntry {
+		std::shared_ptr<const Tile> tile;          //!< Pixels of the tile.
+		std::list<std::uint64_t>::iterator recent; //!< Position in lru_.
+	};
+
+	mutable std::mutex mutex_; //!< Protects all members below.
+
+	/// Loaded textures, indexed by canonical path (with a suffix for sRGB).
+	std::unordered_map<std::string, std::shared_ptr<const Texture>> textures_;
+
+	/// Resident tiles, indexed by texture identifier and tile index.
+	std::unordered_map<std::uint64_t, TileEntry> tiles_;
+
+	/// Keys of the resident tiles, most recently used first.
+	std::list<std::uint64_t> lru_;
+
+	std::string cache_filename_;    //!< Path of the cache file, or temporary.
+	std::FILE *cache_file_ = nullptr; //!< Cache file storing all tiles.
+	std::uint64_t cache_size_ = 0;  //!< Number of bytes written to the file.
+	unsigned int next_id_ = 0;      //!< Identifier of the next Texture.
+
+	size_t memory_budget_ = size_t(512) << 20; //!< Maximal resident bytes.
+
+	size_t hits_ = 0;           //!< Number of loads served from the cache.
+	size_t misses_ = 0;         //!< Number of loads that decoded a file.
+	size_t tile_hits_ = 0;      //!< Number of tile requests already resident.
+	size_t tile_misses_ = 0;    //!< Number of tiles paged in from the file.
+	size_t resident_bytes_ = 0; //!< Size of the resident tiles.
+
+	/// Private constructor: the only instance is given by Instance.
+	TextureCache() {};
+
+	/// Opens the cache file if needed. Must be called with mutex_ locked.
+	void OpenCacheFile();
+
+	/**
+	 * \fn void WriteTiles(const Texture &texture, const Image &image)
+	 * \brief Builds the pyramid of the input image and writes its tiles to
+	 *        the cache file, at the position given by the Texture. Must be
+	 *        called with mutex_ locked.
+	 */
+	void WriteTiles(const Texture &texture, const Image &image);
+
+	/// Evicts the least recently used tiles until the resident tiles fit in
+	/// the memory budget. Must be called with mutex_ locked.
+	void Evict();
+
+public:
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	/// Closes the cache file.
+	~TextureCache();
+
+	/// Outputs the cache shared by the whole process.
+	static TextureCache& Instance();
+
+	/**
+	 * \fn static std::string CanonicalPath(const std::string &path)
+	 * \brief Outputs the absolute path of the input file, with symbolic links
+	 *        and "." / ".." components resolved, or the input path itself if
+	 *        it cannot be resolved.
+	 */
+	static std::string CanonicalPath(const std::string &path);
+
+	/**
+	 * \fn void SetCacheFile(const std::string &filename)
+	 * \brief Sets the path of the file storing the tiles. By default, an
+	 *        anonymous temporary file is used.
+	 * \throw std::runtime_error If some texture was already loaded.
+	 */
+	void SetCacheFile(const std::string &filename);
+
+	/// Sets the maximal number of bytes of resident tiles, evicting tiles if
+	/// needed.
+	void SetMemoryBudget(size_t bytes);
+
+	/**
+	 * \fn std::shared_ptr<const Texture> Load(const std::string &path, bool srgb=false)
+	 * \brief Outputs the texture stored in the input file, decoding it and
+	 *        writing its tiles only if it is not already in the cache.
+	 * \param srgb Indicates if the file stores sRGB-encoded colors (e.g. a
+	 *        diffuse map) rather than linear values (e.g. a specular map).
+	 * \throw cimg_library::CImgIOException If the file cannot be decoded.
+	 * \throw std::runtime_error If the cache file cannot be written.
+	 *
+	 * Thread-safe; concurrent requests for the same file decode it once.
+	 */
+	std::shared_ptr<const Texture> Load(const std::string &path, bool srgb=false);
+
+	/**
+	 * \fn std::shared_ptr<const Tile> FetchTile(const Texture &texture, size_t tile)
+	 * \brief Outputs the pixels of a tile of the input Texture, reading them
+	 *        from the cache file if they are not resident.
+	 * \throw std::runtime_error If the cache file cannot be read.
+	 *
+	 * Thread-safe. The returned tile stays valid even if it is evicted.
+	 */
+	std::shared_ptr<const Tile> FetchTile(const Texture &texture, size_t tile);
+
+	/// Releases the references of the cache to all textures (textures still
+	/// used by some mesh stay alive), evicts all tiles and resets the
+	/// statistics.
+	void Clear();
+
+	/// Outputs the number of loads served from the cache.
+	size_t Hits() const;
+
+	/// Outputs the number of loads that required decoding a file.
+	size_t Misses() const;
+
+	/// Outputs the number of tile requests served from memory.
+	size_t TileHits() const;
+
+	/// Outputs the number of tiles paged in from the cache file.
+	size_t TileMisses() const;
+
+	/// Outputs the total size in bytes of the resident tiles.
+	size_t ResidentBytes() const;
+
+	/// Outputs the maximal number of bytes of resident tiles.
+	size_t MemoryBudget() const;
+};
@@ -0,0 +1,139 @@
+/**
+ * \file tiles.cpp
+ * \brief Implements the tile scheduler of tiles.hpp.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include "tiles.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+/**
+ * \fn static std::uint64_t SpreadBits(std::uint64_t v)
+ * \brief Inserts a zero bit after each of the 32 lowest bits of v.
+ */
+static std::uint64_t SpreadBits(std::uint64_t v) {
+	v &= 0x00000000FFFFFFFFull;
+	v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+	v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+	v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	v = (v | (v << 2)) & 0x3333333333333333ull;
+	v = (v | (v << 1)) & 0x5555555555555555ull;
+	return v;
+}
+
+
+TileScheduler::TileScheduler(size_t height, size_t width, size_t tile_size) {
+	tile_size = std::max<size_t>(tile_size, 1);
+	std::vector<std::pair<std::uint64_t, Tile>> keyed_tiles;
+	for (size_t i=0; i<height; i+=tile_size) {
+		for (size_t j=0; j<width; j+=tile_size) {
+			Tile tile{
+				i, j, std::min(tile_size, height-i), std::min(tile_size, width-j)
+			};
+			std::uint64_t key = (SpreadBits(i / tile_size) << 1)
+				| SpreadBits(j / tile_size);
+			keyed_tiles.emplace_back(key, tile);
+		}
+	}
+	std::sort(keyed_tiles.begin(), keyed_tiles.end(),
+		[](const std::pair<std::uint64_t, Tile> &a,
+			const std::pair<std::uint64_t, Tile> &b) {
+			return a.first < b.first;
+		}
+	);
+	for (const auto &keyed_tile : keyed_tiles) {
+		tiles_.push_back(keyed_tile.second);
+	}
+}
+
+
+bool TileScheduler::Steal(size_t thread, size_t nb_threads) {
+	for (;;) {
+		// Largest range of the other threads; their sizes may change before
+		// the victim is locked again
+		size_t victim = nb_threads;
+		size_t largest = 0;
+		for (size_t t=0; t<nb_threads; t++) {
+			if (t == thread) {
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(ranges_[t].mutex);
+			if (ranges_[t].end - ranges_[t].begin > largest) {
+				largest = ranges_[t].end - ranges_[t].begin;
+				victim = t;
+			}
+		}
+		if (victim == nb_threads) {
+			return false;
+		}
+
+		// Only one lock is held at a time, so that thieves cannot deadlock
+		size_t begin;
+		size_t end;
+		{
+			Range &range = ranges_[victim];
+			std::lock_guard<std::mutex> lock(range.mutex);
+			size_t size = range.end - range.begin;
+			if (size == 0) {
+				continue;
+			}
+			end = range.end;
+			begin = end - (size+1)/2;
+			range.end = begin;
+		}
+		Range &own = ranges_[thread];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		own.begin = begin;
+		own.end = end;
+		return true;
+	}
+}
+
+
+bool TileScheduler::Next(size_t thread, size_t nb_threads, size_t &tile) {
+	Range &own = ranges_[thread];
+	do {
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (own.begin < own.end) {
+			tile = own.begin++;
+			return true;
+		}
+	} while (Steal(thread, nb_threads));
+	return false;
+}
+
+
+void TileScheduler::Run(
+	const std::function<void(const Tile&, size_t)> &process
+) {
+	size_t nb_threads = 1;
+	#ifdef _OPENMP
+	nb_threads = omp_get_max_threads();
+	#endif
+
+	// Contiguous ranges of tiles of similar sizes
+	ranges_.reset(new Range[nb_threads]);
+	for (size_t t=0; t<nb_threads; t++) {
+		ranges_[t].begin = tiles_.size()*t / nb_threads;
+		ranges_[t].end = tiles_.size()*(t+1) / nb_threads;
+	}
+
+	// Threads missing from the team leave their range to be stolen
+	#pragma omp parallel num_threads(nb_threads)
+	{
+		size_t thread = 0;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		size_t tile;
+		while (Next(thread, nb_threads, tile)) {
+			process(tiles_[tile], tile);
+		}
+	}
+	ranges_.reset();
+}
@@ -0,0 +1,98 @@
+/**
+ * \file tiles.hpp
+ * \brief Defines the split of images into tiles and the work-stealing
+ *        scheduler rendering them in parallel.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/**
+ * \struct Tile
+ * \brief Rectangle of pixels of an image, rendered as a unit.
+ */
+struct Tile {
+	size_t row;    //!< Height coordinate of the first pixel of the tile.
+	size_t column; //!< Width coordinate of the first pixel of the tile.
+	size_t height; //!< Number of rows of the tile.
+	size_t width;  //!< Number of columns of the tile.
+};
+
+
+/**
+ * \class TileScheduler
+ * \brief Distributes the tiles of an image between threads, with work
+ *        stealing.
+ *
+ * Tiles are sorted in the Morton order of their coordinates, so that
+ * consecutive tiles are close in the image. Each thread starts with a
+ * contiguous range of this order, and processes it from its beginning; a
+ * thread whose range is empty steals the second half of the largest remaining
+ * range. Threads thus work on compact regions of the image, which keeps the
+ * objects and textures they hit in cache, while expensive regions are shared
+ * between threads.
+ */
+class TileScheduler {
+public:
+	/// Default width and height of tiles, in pixels.
+	static const size_t kTileSize = 16;
+
+private:
+	/**
+	 * \struct Range
+	 * \brief Range of tiles, in Morton order, remaining for a thread.
+	 */
+	struct Range {
+		std::mutex mutex; //!< Protects begin and end.
+		size_t begin = 0; //!< Index of the next tile to process.
+		size_t end = 0;   //!< Index following the last tile of the range.
+	};
+
+	std::vector<Tile> tiles_; //!< Tiles of the image, in Morton order.
+
+	/// Remaining range of each thread during Run.
+	std::unique_ptr<Range[]> ranges_;
+
+	/**
+	 * \fn bool Steal(size_t thread, size_t nb_threads)
+	 * \brief Moves the second half of the largest range of another thread to
+	 *        the range of the input thread.
+	 * \return false if no tile remains in any range.
+	 */
+	bool Steal(size_t thread, size_t nb_threads);
+
+	/**
+	 * \fn bool Next(size_t thread, size_t nb_threads, size_t &tile)
+	 * \brief Outputs the next tile the input thread should process.
+	 * \return false if no tile remains.
+	 */
+	bool Next(size_t thread, size_t nb_threads, size_t &tile);
+
+public:
+	/**
+	 * \fn TileScheduler(size_t height, size_t width, size_t tile_size=kTileSize)
+	 * \brief Splits an image into square tiles; tiles on the bottom and right
+	 *        borders may be smaller.
+	 */
+	TileScheduler(size_t height, size_t width, size_t tile_size=kTileSize);
+
+	/// Outputs the tiles of the image, in Morton order.
+	inline const std::vector<Tile>& Tiles() const {
+		return tiles_;
+	}
+
+	/**
+	 * \fn void Run(const std::function<void(const Tile&, size_t)> &process)
+	 * \brief Processes all tiles in parallel, each exactly once.
+	 * \param process Function called on each tile and its index in Tiles(),
+	 *        from several threads at once.
+	 * \warning Run must not be called by several threads at once.
+	 */
+	void Run(const std::function<void(const Tile&, size_t)> &process);
+};
@@ -1,12 +1,13 @@
 /**
  * \file utils.cpp
- * \brief Implements the progress bar.
+ * \brief Implements the progress bar, Morton codes and transformations.
  */
 
+#include <algorithm>
 #include "utils.hpp"
 
 
-void show_progress(double progress) {
+void show_progress(double progress, const std::string &details) {
 	std::cout << std::fixed << std::setprecision(2) << "[";
 	int position_progress = 70*progress;
 	for (unsigned i=0; i<70; i++) {
@@ -18,6 +19,112 @@ void show_progress(double progress) {
 			std::cout << " ";
 		}
 	}
-	std::cout << "] " << progress*100 << "%\r";
+	std::cout << "] " << progress*100 << "%";
+	if (!details.empty()) {
+		// Trailing spaces erase the end of longer previous details
+		std::cout << " " << details << "    ";
+	}
+	std::cout << "\r";
 	std::cout.flush();
 }
+
+
+/**
+ * \fn static std::uint32_t ExpandBits(std::uint32_t v)
+ * \brief Inserts two zero bits after each of the 10 lowest bits of v.
+ */
+static std::uint32_t ExpandBits(std::uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+
+std::uint32_t MortonCode(double x, double y, double z) {
+	// Quantization of each coordinate on 10 bits
+	std::uint32_t xx = std::min(std::max(x*1024, 0.), 1023.);
+	std::uint32_t yy = std::min(std::max(y*1024, 0.), 1023.);
+	std::uint32_t zz = std::min(std::max(z*1024, 0.), 1023.);
+	return (ExpandBits(xx) << 2) | (ExpandBits(yy) << 1) | ExpandBits(zz);
+}
+
+
+Transform Transform::Translation(const Vector &v) {
+	Transform t;
+	t.m_[0][3] = v.x();
+	t.m_[1][3] = v.y();
+	t.m_[2][3] = v.z();
+	return t;
+}
+
+
+Transform Transform::Scaling(double sx, double sy, double sz) {
+	Transform t;
+	t.m_[0][0] = sx;
+	t.m_[1][1] = sy;
+	t.m_[2][2] = sz;
+	return t;
+}
+
+
+Transform Transform::Rotation(const Vector &axis, double angle) {
+	// Rodrigues' rotation formula
+	Vector a = axis;
+	a.Normalize();
+	double c = cos(angle);
+	double s = sin(angle);
+	Transform t;
+	t.m_[0][0] = c + a.x()*a.x()*(1-c);
+	t.m_[0][1] = a.x()*a.y()*(1-c) - a.z()*s;
+	t.m_[0][2] = a.x()*a.z()*(1-c) + a.y()*s;
+	t.m_[1][0] = a.y()*a.x()*(1-c) + a.z()*s;
+	t.m_[1][1] = c + a.y()*a.y()*(1-c);
+	t.m_[1][2] = a.y()*a.z()*(1-c) - a.x()*s;
+	t.m_[2][0] = a.z()*a.x()*(1-c) - a.y()*s;
+	t.m_[2][1] = a.z()*a.y()*(1-c) + a.x()*s;
+	t.m_[2][2] = c + a.z()*a.z()*(1-c);
+	return t;
+}
+
+
+Transform Transform::operator*(const Transform &t) const {
+	Transform result;
+	for (int i=0; i<3; i++) {
+		for (int j=0; j<4; j++) {
+			result.m_[i][j] = (j == 3 ? m_[i][3] : 0);
+			for (int k=0; k<3; k++) {
+				result.m_[i][j] += m_[i][k]*t.m_[k][j];
+			}
+		}
+	}
+	return result;
+}
+
+
+Transform Transform::Inverse() const {
+	// Inverse of the linear part using its cofactors
+	const double (&a)[3][4] = m_;
+	double det =
+		a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+		- a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+		+ a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+	double inv_det = 1/det;
+	Transform result;
+	double (&b)[3][4] = result.m_;
+	b[0][0] = (a[1][1]*a[2][2] - a[1][2]*a[2][1])*inv_det;
+	b[0][1] = (a[0][2]*a[2][1] - a[0][1]*a[2][2])*inv_det;
+	b[0][2] = (a[0][1]*a[1][2] - a[0][2]*a[1][1])*inv_det;
+	b[1][0] = (a[1][2]*a[2][0] - a[1][0]*a[2][2])*inv_det;
+	b[1][1] = (a[0][0]*a[2][2] - a[0][2]*a[2][0])*inv_det;
+	b[1][2] = (a[0][2]*a[1][0] - a[0][0]*a[1][2])*inv_det;
+	b[2][0] = (a[1][0]*a[2][1] - a[1][1]*a[2][0])*inv_det;
+	b[2][1] = (a[0][1]*a[2][0] - a[0][0]*a[2][1])*inv_det;
+	b[2][2] = (a[0][0]*a[1][1] - a[0][1]*a[1][0])*inv_det;
+	// The translation is the opposite of the transformed original translation
+	for (int i=0; i<3; i++) {
+		b[i][3] = -(b[i][0]*a[0][3] + b[i][1]*a[1][3] + b[i][2]*a[2][3]);
+	}
+	return result;
+}
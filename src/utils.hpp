@@ -1,7 +1,7 @@
 /**
  * \file utils.hpp
  * \brief Defines useful classes used in the rest of the program (Vector, Ray,
- *        Intersection).
+ *        Transform, Intersection).
  */
 
 #pragma once
@@ -9,19 +9,114 @@
 #include <functional>
 #include <iostream>
 #include <iomanip>
+#include <string>
 #include <cmath>
+#include <cstdint>
 
 
 const double PI = 3.14159265358979323846;
 
 
 /**
- * \fn void show_progress(double progress)
+ * \fn void show_progress(double progress, const std::string &details="")
  * \brief Prints a progress bar on the command line.
  * \param progress Progress to be showed in the progress bar (assumed to lie
  *        between 0 and 1).
+ * \param details Text printed after the percentage.
  */
-void show_progress(double progress);
+void show_progress(double progress, const std::string &details="");
+
+
+/**
+ * \fn std::uint32_t MortonCode(double x, double y, double z)
+ * \brief Computes the 30-bit Morton code of a point of the unit cube.
+ * \param x, y, z Coordinates of the point, clamped to [0,1].
+ *
+ * Each coordinate is quantized on 10 bits, and the bits of the three
+ * coordinates are interleaved, so that close points tend to have close codes.
+ */
+std::uint32_t MortonCode(double x, double y, double z);
+
+
+/**
+ * \class RandomStream
+ * \brief Counter-based generator of random numbers (Philox 4x32-10).
+ *
+ * The n-th number of a stream is a pure function of n and of the key of the
+ * stream (global seed, pixel and sample), so that streams share no state:
+ * each sample of each pixel draws from its own stream, and a render does not
+ * depend on the number of threads nor on the order of the samples.
+ */
+class RandomStream {
+private:
+	std::uint32_t key_[2];     //!< Global seed.
+	std::uint32_t counter_[4]; //!< Block index, sample and pixel.
+	std::uint32_t block_[4];   //!< Last block of random bits.
+	unsigned int next_ = 4;    //!< Index of the next unused word of block_.
+
+	/// Computes block_ from the current counter (ten rounds of Philox), and
+	/// increments the block index.
+	inline void NextBlock() {
+		std::uint32_t c[4] = {
+			counter_[0], counter_[1], counter_[2], counter_[3]
+		};
+		std::uint32_t k[2] = {key_[0], key_[1]};
+		for (int round=0; round<10; round++) {
+			std::uint64_t p0 = static_cast<std::uint64_t>(0xD2511F53u) * c[0];
+			std::uint64_t p1 = static_cast<std::uint64_t>(0xCD9E8D57u) * c[2];
+			std::uint32_t c1 = c[1];
+			c[0] = static_cast<std::uint32_t>(p1 >> 32) ^ c1 ^ k[0];
+			c[1] = static_cast<std::uint32_t>(p1);
+			c[2] = static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k[1];
+			c[3] = static_cast<std::uint32_t>(p0);
+			k[0] += 0x9E3779B9u;
+			k[1] += 0xBB67AE85u;
+		}
+		for (int i=0; i<4; i++) {
+			block_[i] = c[i];
+		}
+		counter_[0]++;
+		next_ = 0;
+	}
+
+public:
+	/// Builds the stream of the input sample of a pixel.
+	RandomStream(
+		std::uint64_t seed=0, std::uint64_t pixel=0, std::uint32_t sample=0
+	) :
+		key_{
+			static_cast<std::uint32_t>(seed),
+			static_cast<std::uint32_t>(seed >> 32)
+		},
+		counter_{
+			0, sample, static_cast<std::uint32_t>(pixel),
+			static_cast<std::uint32_t>(pixel >> 32)
+		}
+	{
+	}
+
+	/// Moves the stream to the input position: the next number output by
+	/// NextBits is the position-th one of the stream.
+	inline void Seek(std::uint64_t position) {
+		counter_[0] = static_cast<std::uint32_t>(position / 4);
+		NextBlock();
+		next_ = position % 4;
+	}
+
+	/// Outputs the next 32 random bits of the stream.
+	inline std::uint32_t NextBits() {
+		if (next_ == 4) {
+			NextBlock();
+		}
+		return block_[next_++];
+	}
+
+	/// Outputs the next number of the stream, uniformly distributed in the
+	/// open interval (0,1).
+	inline double Uniform() {
+		return (NextBits() + 0.5) * (1. / 4294967296.);
+	}
+};
 
 
 /**
@@ -36,12 +131,6 @@ private:
 	double y_; //!< Second coordinate.
 	double z_; //!< Third coordinate.
 
-	/// First barycentric coordinate corresponding to this point's triangle, if
-	/// relevant.
-	double b1_ = 1;
-	double b2_ = 0; //!< Second barycentric coordinate.
-	double b3_ = 0; //!< Third barycentric coordinate.
-
 public:
 	/// Initiates a Vector as the origin \f$\left(0,0,0\right)\f$.
 	Vector() :
@@ -57,18 +146,6 @@ public:
 	{
 	}
 
-	/// Initiates a Point from another Point and a triplet of barycentric
-	/// coordinates.
-	Vector(const Vector &p, const Vector &barycentric) :
-		x_{p.x()},
-		y_{p.y()},
-		z_{p.z()},
-		b1_{barycentric.x()},
-		b2_{barycentric.y()},
-		b3_{barycentric.z()}
-	{
-	}
-
 	/// Returns the first coordinate of the Vector.
 	inline const double& x() const {
 		return x_;
@@ -84,21 +161,6 @@ public:
 		return z_;
 	}
 
-	/// Returns the first barycentric coordinate of the Point.
-	inline const double& b1() const {
-		return b1_;
-	}
-
-	/// Returns the second barycentric coordinate of the Point.
-	inline const double& b2() const {
-		return b2_;
-	}
-
-	/// Returns the third barycentric coordinate of the Point.
-	inline const double& b3() const {
-		return b3_;
-	}
-
 	/// Normalizes the Vector with a unitary norm.
 	void Normalize() {
 		double norm = Norm();
@@ -185,17 +247,41 @@ public:
 typedef Vector Point;
 
 
+class RawObject;
+
+
 /**
  * \class Ray
  * \brief Represents a ray, i.e. a half-line defined by its origin and a
  *        direction.
+ *
+ * A Ray may carry differentials: the derivatives of its origin and of its
+ * (normalized) direction with respect to the image coordinates, which
+ * estimate the footprint of the pixel it comes from. A Ray spawned from a
+ * surface also records the object and primitive it leaves, so that the object
+ * can intersect it consistently with that surface.
  */
 class Ray {
 private:
-	const Point origin_; //!< Source point of the Ray.
-	Vector direction_;   //!< Direction of the Ray, assumed to be normalized.
+	Point origin_;     //!< Source point of the Ray.
+	Vector direction_; //!< Direction of the Ray, assumed to be normalized.
+
+	bool has_differentials_ = false; //!< Indicates if differentials are set.
+	Vector origin_dx_;    //!< Derivative of the origin along the image width.
+	Vector origin_dy_;    //!< Derivative of the origin along the image height.
+	Vector direction_dx_; //!< Derivative of the direction along the width.
+	Vector direction_dy_; //!< Derivative of the direction along the height.
+
+	const RawObject *source_ = nullptr; //!< Object left by the Ray, if any.
+	size_t source_primitive_ = 0; //!< Identifier of the primitive left.
 
 public:
+	/// Constructs a dummy Ray, to be assigned later.
+	Ray() :
+		Ray{Point{0, 0, 0}, Vector{0, 0, 1}}
+	{
+	}
+
 	/// Constructs a Ray from its origin and a direction.
 	Ray(const Point &origin, const Vector &direction) :
 		origin_{origin},
@@ -214,6 +300,70 @@ public:
 		return direction_;
 	}
 
+	/// Sets the derivatives of the origin and of the direction with respect
+	/// to the image coordinates (along the width, then the height).
+	inline void SetDifferentials(
+		const Vector &origin_dx, const Vector &origin_dy,
+		const Vector &direction_dx, const Vector &direction_dy
+	) {
+		has_differentials_ = true;
+		origin_dx_ = origin_dx;
+		origin_dy_ = origin_dy;
+		direction_dx_ = direction_dx;
+		direction_dy_ = direction_dy;
+	}
+
+	/// Scales the differentials, e.g. by the inverse of the square root of
+	/// the number of samples per pixel.
+	inline void ScaleDifferentials(double scale) {
+		origin_dx_ = scale*origin_dx_;
+		origin_dy_ = scale*origin_dy_;
+		direction_dx_ = scale*direction_dx_;
+		direction_dy_ = scale*direction_dy_;
+	}
+
+	/// Indicates if the Ray carries differentials.
+	inline bool HasDifferentials() const {
+		return has_differentials_;
+	}
+
+	/// Returns the derivative of the origin along the image width.
+	inline const Vector& OriginDx() const {
+		return origin_dx_;
+	}
+
+	/// Returns the derivative of the origin along the image height.
+	inline const Vector& OriginDy() const {
+		return origin_dy_;
+	}
+
+	/// Returns the derivative of the direction along the image width.
+	inline const Vector& DirectionDx() const {
+		return direction_dx_;
+	}
+
+	/// Returns the derivative of the direction along the image height.
+	inline const Vector& DirectionDy() const {
+		return direction_dy_;
+	}
+
+	/// Records the object, and the identifier of the primitive inside it (see
+	/// Intersection::Primitive), whose surface the Ray leaves.
+	inline void SetSource(const RawObject &object, size_t primitive) {
+		source_ = &object;
+		source_primitive_ = primitive;
+	}
+
+	/// Returns the object whose surface the Ray leaves, or nullptr.
+	inline const RawObject* Source() const {
+		return source_;
+	}
+
+	/// Returns the identifier of the primitive whose surface the Ray leaves.
+	inline size_t SourcePrimitive() const {
+		return source_primitive_;
+	}
+
 	/**
 	 * \fn Point operator()(double t) const
 	 * \brief Gives the point on the Ray at a given distance of the origin.
@@ -228,17 +378,85 @@ public:
 };
 
 
-class RawObject;
+/**
+ * \class Transform
+ * \brief Affine transformation of \f$\mathbb{R}^3\f$, stored as a 3x4 matrix
+ *        (linear part and translation).
+ */
+class Transform {
+private:
+	double m_[3][4]; //!< Rows of the matrix; the last column is the translation.
+
+public:
+	/// Creates the identity.
+	Transform() :
+		m_{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}
+	{
+	}
+
+	/// Creates a translation by the input Vector.
+	static Transform Translation(const Vector &v);
+
+	/// Creates a scaling by the given factors along each axis.
+	static Transform Scaling(double sx, double sy, double sz);
+
+	/// Creates a rotation of the given angle (in radians) around the input
+	/// axis, which goes through the origin.
+	static Transform Rotation(const Vector &axis, double angle);
+
+	/// Composition of two Transforms: the input one is applied first.
+	Transform operator*(const Transform &t) const;
+
+	/// Outputs the inverse Transform, assuming that the matrix is invertible.
+	Transform Inverse() const;
+
+	/// Transforms a Point.
+	inline Point ApplyToPoint(const Point &p) const {
+		return Point{
+			m_[0][0]*p.x() + m_[0][1]*p.y() + m_[0][2]*p.z() + m_[0][3],
+			m_[1][0]*p.x() + m_[1][1]*p.y() + m_[1][2]*p.z() + m_[1][3],
+			m_[2][0]*p.x() + m_[2][1]*p.y() + m_[2][2]*p.z() + m_[2][3]
+		};
+	}
+
+	/// Transforms a Vector (ignores the translation).
+	inline Vector ApplyToVector(const Vector &v) const {
+		return Vector{
+			m_[0][0]*v.x() + m_[0][1]*v.y() + m_[0][2]*v.z(),
+			m_[1][0]*v.x() + m_[1][1]*v.y() + m_[1][2]*v.z(),
+			m_[2][0]*v.x() + m_[2][1]*v.y() + m_[2][2]*v.z()
+		};
+	}
+
+	/**
+	 * \fn Vector ApplyTransposedToVector(const Vector &v) const
+	 * \brief Applies the transpose of the linear part to a Vector.
+	 *
+	 * Applied by the inverse of a Transform, it transforms normals.
+	 */
+	inline Vector ApplyTransposedToVector(const Vector &v) const {
+		return Vector{
+			m_[0][0]*v.x() + m_[1][0]*v.y() + m_[2][0]*v.z(),
+			m_[0][1]*v.x() + m_[1][1]*v.y() + m_[2][1]*v.z(),
+			m_[0][2]*v.x() + m_[1][2]*v.y() + m_[2][2]*v.z()
+		};
+	}
+};
 
 
 /**
  * \class Intersection
  * \brief Represents an intersection point, or the empty set.
+ *
+ * An Intersection only records what is needed to find the closest hit along
+ * a Ray: its distance, the object that was hit, an identifier of the hit
+ * primitive inside this object, and the raw parametric coordinates of the
+ * hit point on it. The shading data (point, normal, material...) is only
+ * computed once the closest Intersection is known, by
+ * RawObject::Interact.
  */
 class Intersection {
 private:
-	bool exists_; //!< Indicates if there is an intersection.
-
 	/**
 	 * \brief Distance on the ray from its origin for which the intersection
 	 *        point is reached.
@@ -248,32 +466,42 @@ private:
 	 */
 	double t_;
 
-	/// Indicates if the intersection arises from the exterior of the object.
-	bool out_;
+	/// First parametric coordinate of the intersection point on the hit
+	/// primitive, if relevant (e.g. barycentric coordinate of a triangle).
+	double u_;
 
-	/// Barycentric coordinates corresponding to the intersection point's
-	/// triangle, if relevant.
-	Vector barycentric_;
+	double v_; //!< Second parametric coordinate of the intersection point.
 
 	/// Object corresponding to the tested intersection.
-	std::reference_wrapper<const RawObject> object_;
+	const RawObject *object_;
+
+	/// Identifier of the hit primitive inside object_, if relevant.
+	size_t primitive_;
+
+	bool exists_; //!< Indicates if there is an intersection.
+
+	/// Indicates if the intersection arises from the exterior of the object.
+	bool out_;
 
 public:
 	/**
-	 * \fn Intersection(const std::reference_wrapper<const RawObject> &object)
+	 * \fn Intersection(const RawObject &object)
 	 * \brief Creates an empty Intersection.
 	 * \param object Object with which the intersection was tested.
 	 */
-	Intersection(const std::reference_wrapper<const RawObject> &object) :
-		exists_{false},
+	Intersection(const RawObject &object) :
 		t_{0},
-		out_{false},
-		object_{object}
+		u_{0},
+		v_{0},
+		object_{&object},
+		primitive_{0},
+		exists_{false},
+		out_{false}
 	{
 	}
 
 	/**
-	 * \fn Intersection(double t, bool out, const std::reference_wrapper<const RawObject> &object)
+	 * \fn Intersection(double t, bool out, const RawObject &object)
 	 * \brief Creates an Intersection using the given ray parameter.
 	 * \param t Ray parameter at which the ray reached the intersection point,
 	 *        i.e. the latter is at distance t from the origin, following the
@@ -284,32 +512,29 @@ public:
 	 * \note If the input parameter is non-positive, then the Intersection is
 	 * considered to be empty.
 	 */
-	Intersection(
-		double t,
-		bool out,
-		const std::reference_wrapper<const RawObject> &object
-	) :
-		exists_{t > 0},
-		t_{std::max(t, 0.)},
-		out_{out},
-		object_{object}
+	Intersection(double t, bool out, const RawObject &object) :
+		Intersection{t, out, 0, 0, object}
 	{
 	}
 
-	/// Builds an Intersection using the barycentric coordinates of the
-	/// intersection point.
-	/// \see Intersection(double t, bool out, std::reference_wrapper<const RawObject> object)
+	/// Builds an Intersection using the parametric coordinates of the
+	/// intersection point on the given primitive of the object.
+	/// \see Intersection(double t, bool out, const RawObject &object)
 	Intersection(
 		double t,
 		bool out,
-		const Vector &barycentric,
-		const std::reference_wrapper<const RawObject> &object
+		double u,
+		double v,
+		const RawObject &object,
+		size_t primitive=0
 	) :
-		exists_{t > 0},
 		t_{std::max(t, 0.)},
-		out_{out},
-		barycentric_{barycentric},
-		object_{object}
+		u_{u},
+		v_{v},
+		object_{&object},
+		primitive_{primitive},
+		exists_{t > 0},
+		out_{out}
 	{
 	}
 
@@ -332,15 +557,24 @@ public:
 		return out_;
 	}
 
-	/// Returns the barycentric coordinates associated to the intersection
-	/// point.
-	inline const Vector& BarycentricCoordinates() const {
-		return barycentric_;
+	/// Returns the first parametric coordinate of the intersection point.
+	inline double U() const {
+		return u_;
+	}
+
+	/// Returns the second parametric coordinate of the intersection point.
+	inline double V() const {
+		return v_;
 	}
 
 	/// Outputs a reference to the object corresponding to the Intersection.
-	inline const std::reference_wrapper<const RawObject>& Object() const {
-		return object_;
+	inline const RawObject& Object() const {
+		return *object_;
+	}
+
+	/// Outputs the identifier of the hit primitive inside Object().
+	inline size_t Primitive() const {
+		return primitive_;
 	}
 
 	/**
@@ -351,22 +585,10 @@ public:
 	 * Chooses the closest Intersection to the origin point.
 	 */
 	Intersection operator|(const Intersection &inter) const {
-		if (IsEmpty()) {
-			return Intersection{
-				inter.Distance(), inter.IsOut(), inter.BarycentricCoordinates(),
-				inter.Object()
-			};
-		} else if (inter.IsEmpty()) {
-			return Intersection{t_, out_, barycentric_, object_};
+		if (inter < *this) {
+			return inter;
 		} else {
-			if (t_ < inter.Distance()) {
-				return Intersection{t_, out_, barycentric_, object_};
-			} else {
-				return Intersection{
-					inter.Distance(), inter.IsOut(),
-					inter.BarycentricCoordinates(), inter.Object()
-				};
-			}
+			return *this;
 		}
 	}
 